@@ -1,146 +1,698 @@
 #include "block.h"
 #include "require.h"
+#include "stats.h"
+#include <algorithm>
+
+// Per-opcode execution counts cost a thread-local lookup per instruction, so
+// they are only compiled in on request.
+#ifdef BV_COUNT_OPCODES
+#define COUNT_OPCODE(op) countOpcode(op)
+#else
+#define COUNT_OPCODE(op) ((void)0)
+#endif
 
 
 namespace {
 
-typedef std::vector<uint64_t> Stack;
+// Points past the top of the stack.
+typedef uint64_t* Stack;
 
 void opNot(Stack* const stack)
 {
-    stack->back() = ~stack->back();
+    (*stack)[-1] = ~(*stack)[-1];
 }
 
 void opShl1(Stack* const stack)
 {
-    stack->back() <<= 1;
+    (*stack)[-1] <<= 1;
 }
 
 void opShr1(Stack* const stack)
 {
-    stack->back() >>= 1;
+    (*stack)[-1] >>= 1;
 }
 
 void opShr4(Stack* const stack)
 {
-    stack->back() >>= 4;
+    (*stack)[-1] >>= 4;
 }
 
 void opShr16(Stack* const stack)
 {
-    stack->back() >>= 16;
+    (*stack)[-1] >>= 16;
 }
 
 void opAnd(Stack* const stack)
 {
-    stack->rbegin()[1] &= stack->back();
-    stack->pop_back();
+    (*stack)[-2] &= (*stack)[-1];
+    --*stack;
 }
 
 void opOr(Stack* const stack)
 {
-    stack->rbegin()[1] |= stack->back();
-    stack->pop_back();
+    (*stack)[-2] |= (*stack)[-1];
+    --*stack;
 }
 
 void opXor(Stack* const stack)
 {
-    stack->rbegin()[1] ^= stack->back();
-    stack->pop_back();
+    (*stack)[-2] ^= (*stack)[-1];
+    --*stack;
 }
 
 void opPlus(Stack* const stack)
 {
-    stack->rbegin()[1] += stack->back();
+    (*stack)[-2] += (*stack)[-1];
+    --*stack;
+}
+
+void opShl(Stack* const stack, int shift)
+{
+    (*stack)[-1] <<= shift;
+}
+
+void opShr(Stack* const stack, int shift)
+{
+    (*stack)[-1] >>= shift;
+}
+
+void opUnfold(Stack* const stack)
+{
+    const uint64_t value = *--*stack;
+    for (int offset = 56; offset >= 0; offset -= 8) {
+        *(*stack)++ = 0xff & (value >> offset);
+    }
+}
+
+// [.., value, accumulator] -> [.., value >> 8, 7] with the lowest byte in
+// args[0] and the accumulator in args[1].
+void opFoldBegin(Stack* const stack, uint64_t* const args)
+{
+    uint64_t* const top = *stack;
+    args[1] = top[-1];
+    args[0] = 0xff & top[-2];
+    top[-2] >>= 8;
+    top[-1] = 7;
+}
+
+// [.., rest, counter, result]: returns true to run the body again with the
+// next byte, or leaves [.., result] when all 8 bytes are done.
+bool opFoldNext(Stack* const stack, uint64_t* const args)
+{
+    uint64_t* const top = *stack;
+    if (top[-2] == 0) {
+        top[-3] = top[-1];
+        *stack -= 2;
+        return false;
+    }
+    args[1] = top[-1];
+    args[0] = 0xff & top[-3];
+    top[-3] >>= 8;
+    --top[-2];
+    --*stack;
+    return true;
+}
+
+const size_t BATCH_WIDTH = 32;
+
+struct Lanes {
+    uint64_t value[BATCH_WIDTH];
+};
+
+typedef std::vector<Lanes> BatchStack;
+
+bool anyLane(const Lanes& lanes)
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        result |= lanes.value[i];
+    }
+    return result != 0;
+}
+
+void batchNot(BatchStack* const stack)
+{
+    uint64_t* const a = stack->back().value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] = ~a[i];
+    }
+}
+
+void batchShl(BatchStack* const stack, int shift)
+{
+    uint64_t* const a = stack->back().value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] <<= shift;
+    }
+}
+
+void batchShr(BatchStack* const stack, int shift)
+{
+    uint64_t* const a = stack->back().value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] >>= shift;
+    }
+}
+
+void batchAnd(BatchStack* const stack)
+{
+    uint64_t* const a = stack->rbegin()[1].value;
+    const uint64_t* const b = stack->back().value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] &= b[i];
+    }
     stack->pop_back();
 }
 
-void opUnfold(Stack * const stack)
+void batchOr(BatchStack* const stack)
 {
-    const uint64_t value = stack->back();
+    uint64_t* const a = stack->rbegin()[1].value;
+    const uint64_t* const b = stack->back().value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] |= b[i];
+    }
+    stack->pop_back();
+}
+
+void batchXor(BatchStack* const stack)
+{
+    uint64_t* const a = stack->rbegin()[1].value;
+    const uint64_t* const b = stack->back().value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] ^= b[i];
+    }
+    stack->pop_back();
+}
+
+void batchPlus(BatchStack* const stack)
+{
+    uint64_t* const a = stack->rbegin()[1].value;
+    const uint64_t* const b = stack->back().value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] += b[i];
+    }
+    stack->pop_back();
+}
+
+void batchUnfold(BatchStack* const stack)
+{
+    const Lanes value = stack->back();
     stack->pop_back();
     for (int offset = 56; offset >= 0; offset -= 8) {
-        stack->push_back(0xff & (value >> offset));
+        stack->emplace_back();
+        uint64_t* const a = stack->back().value;
+        for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+            a[i] = 0xff & (value.value[i] >> offset);
+        }
+    }
+}
+
+void batchStoreArg(BatchStack* const stack, const Lanes& mask, Lanes* const arg)
+{
+    uint64_t* const a = arg->value;
+    const uint64_t* const b = stack->back().value;
+    const uint64_t* const m = mask.value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] = (b[i] & m[i]) | (a[i] & ~m[i]);
+    }
+    stack->pop_back();
+}
+
+void batchLoad(BatchStack* const stack, uint64_t c)
+{
+    stack->emplace_back();
+    uint64_t* const a = stack->back().value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] = c;
+    }
+}
+
+// Pops the condition and returns the mask of lanes where it is zero.
+Lanes batchPopZeroMask(BatchStack* const stack)
+{
+    Lanes result;
+    const uint64_t* const a = stack->back().value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        result.value[i] = a[i] == 0 ? ~uint64_t(0) : 0;
+    }
+    stack->pop_back();
+    return result;
+}
+
+// Replaces [.., ifValue, elseValue] by the per lane choice between them.
+void batchSelect(BatchStack* const stack, const Lanes& ifMask)
+{
+    uint64_t* const a = stack->rbegin()[1].value;
+    const uint64_t* const b = stack->back().value;
+    const uint64_t* const m = ifMask.value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] = (a[i] & m[i]) | (b[i] & ~m[i]);
+    }
+    stack->pop_back();
+}
+
+void batchFoldBegin(BatchStack* const stack, const Lanes& mask, Lanes* const args)
+{
+    batchStoreArg(stack, mask, &args[1]);
+    uint64_t* const value = stack->back().value;
+    uint64_t* const a = args[0].value;
+    const uint64_t* const m = mask.value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] = ((0xff & value[i]) & m[i]) | (a[i] & ~m[i]);
+        value[i] >>= 8;
+    }
+    batchLoad(stack, 7);
+}
+
+// The counter is the same in every lane.
+bool batchFoldNext(BatchStack* const stack, const Lanes& mask, Lanes* const args)
+{
+    const size_t depth = stack->size();
+    if ((*stack)[depth - 2].value[0] == 0) {
+        (*stack)[depth - 3] = (*stack)[depth - 1];
+        stack->resize(depth - 2);
+        return false;
+    }
+    batchStoreArg(stack, mask, &args[1]);
+    uint64_t* const counter = stack->back().value;
+    uint64_t* const rest = stack->rbegin()[1].value;
+    uint64_t* const a = args[0].value;
+    const uint64_t* const m = mask.value;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        a[i] = ((0xff & rest[i]) & m[i]) | (a[i] & ~m[i]);
+        rest[i] >>= 8;
+        --counter[i];
+    }
+    return true;
+}
+
+Lanes andMask(const Lanes& lhs, const Lanes& rhs, bool invertRhs)
+{
+    Lanes result;
+    const uint64_t invert = invertRhs ? ~uint64_t(0) : 0;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        result.value[i] = lhs.value[i] & (rhs.value[i] ^ invert);
+    }
+    return result;
+}
+
+uint16_t jumpShift(const Op* code, size_t ip)
+{
+    return *(const uint16_t*)&code[ip + 1];
+}
+
+// Executes code[begin, end) for all lanes. Only lanes set in the mask are
+// live: stores into arguments are masked, and a branch that has no live lanes
+// is skipped entirely. Jumps are expected in the shape produced by emitIf0.
+void executeBatchRange(const Op* code, size_t begin, size_t end,
+                       const Lanes& mask, Lanes* const args, BatchStack* const stack)
+{
+    size_t ip = begin;
+    while (ip < end) {
+        COUNT_OPCODE(code[ip]);
+        switch (code[ip]) {
+        case Op::NOT:
+            batchNot(stack);
+            ++ip;
+            break;
+
+        case Op::SHL1:
+            batchShl(stack, 1);
+            ++ip;
+            break;
+
+        case Op::SHR1:
+            batchShr(stack, 1);
+            ++ip;
+            break;
+
+        case Op::SHR4:
+            batchShr(stack, 4);
+            ++ip;
+            break;
+
+        case Op::SHR16:
+            batchShr(stack, 16);
+            ++ip;
+            break;
+
+        case Op::AND:
+            batchAnd(stack);
+            ++ip;
+            break;
+
+        case Op::OR:
+            batchOr(stack);
+            ++ip;
+            break;
+
+        case Op::XOR:
+            batchXor(stack);
+            ++ip;
+            break;
+
+        case Op::PLUS:
+            batchPlus(stack);
+            ++ip;
+            break;
+
+        case Op::UNFOLD:
+            batchUnfold(stack);
+            ++ip;
+            break;
+
+        case Op::STORE_ARG0:
+        case Op::STORE_ARG1:
+        case Op::STORE_ARG2:
+        case Op::STORE_ARG3:
+        case Op::STORE_ARG4:
+        case Op::STORE_ARG5:
+        case Op::STORE_ARG6:
+        case Op::STORE_ARG7:
+            batchStoreArg(stack, mask, &args[static_cast<int>(code[ip]) - static_cast<int>(Op::STORE_ARG0)]);
+            ++ip;
+            break;
+
+        case Op::LOAD_ARG0:
+        case Op::LOAD_ARG1:
+        case Op::LOAD_ARG2:
+        case Op::LOAD_ARG3:
+        case Op::LOAD_ARG4:
+        case Op::LOAD_ARG5:
+        case Op::LOAD_ARG6:
+        case Op::LOAD_ARG7:
+            stack->push_back(args[static_cast<int>(code[ip]) - static_cast<int>(Op::LOAD_ARG0)]);
+            ++ip;
+            break;
+
+        case Op::LOAD_0:
+        case Op::LOAD_1:
+        case Op::LOAD_2:
+        case Op::LOAD_3:
+        case Op::LOAD_4:
+        case Op::LOAD_5:
+        case Op::LOAD_6:
+        case Op::LOAD_7:
+            batchLoad(stack, static_cast<int>(code[ip]) - static_cast<int>(Op::LOAD_0));
+            ++ip;
+            break;
+
+        case Op::LOAD_CONST:
+            batchLoad(stack, *(const uint64_t*)&code[ip + 1]);
+            ip += 9;
+            break;
+
+        case Op::SHL_N:
+            batchShl(stack, static_cast<int>(code[ip + 1]));
+            ip += 2;
+            break;
+
+        case Op::SHR_N:
+            batchShr(stack, static_cast<int>(code[ip + 1]));
+            ip += 2;
+            break;
+
+        case Op::DROP:
+            stack->pop_back();
+            ++ip;
+            break;
+
+        case Op::JNZ: {
+            const size_t ifBegin = ip + 3;
+            const size_t ifEnd = ip + jumpShift(code, ip);
+            require (ifEnd + 3 <= end && code[ifEnd] == Op::JMP,
+                     "executeBatch: Unstructured control flow.");
+            const size_t elseBegin = ifEnd + 3;
+            const size_t elseEnd = elseBegin + jumpShift(code, ifEnd);
+            require (elseEnd <= end, "executeBatch: Unstructured control flow.");
+
+            const Lanes zero = batchPopZeroMask(stack);
+            const Lanes ifMask = andMask(mask, zero, false);
+            const Lanes elseMask = andMask(mask, zero, true);
+            if (anyLane(ifMask)) {
+                executeBatchRange(code, ifBegin, ifEnd, ifMask, args, stack);
+            } else {
+                stack->emplace_back();
+            }
+            if (anyLane(elseMask)) {
+                executeBatchRange(code, elseBegin, elseEnd, elseMask, args, stack);
+            } else {
+                stack->emplace_back();
+            }
+            batchSelect(stack, zero);
+            ip = elseEnd;
+            break;
+        }
+
+        case Op::JMP:
+            require (false, "executeBatch: Unstructured control flow.");
+            break;
+
+        case Op::FOLD_BEGIN:
+            batchFoldBegin(stack, mask, &args[static_cast<int>(code[ip + 1])]);
+            ip += 4;
+            break;
+
+        case Op::FOLD_NEXT:
+            if (batchFoldNext(stack, mask, &args[static_cast<int>(code[ip + 1])])) {
+                ip -= jumpShift(code, ip + 1);
+            } else {
+                ip += 4;
+            }
+            break;
+        }
     }
 }
 
 } // namespace
 
 
+size_t opSize(Op op)
+{
+    switch (op) {
+    case Op::LOAD_CONST:
+        return 9;
+    case Op::SHL_N:
+    case Op::SHR_N:
+        return 2;
+    case Op::JNZ:
+    case Op::JMP:
+        return 3;
+    case Op::FOLD_BEGIN:
+    case Op::FOLD_NEXT:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+size_t stackInputs(Op op)
+{
+    switch (op) {
+    case Op::AND:
+    case Op::OR:
+    case Op::XOR:
+    case Op::PLUS:
+    case Op::FOLD_BEGIN:
+        return 2;
+    case Op::FOLD_NEXT:
+        return 3;
+    case Op::LOAD_ARG0:
+    case Op::LOAD_ARG1:
+    case Op::LOAD_ARG2:
+    case Op::LOAD_ARG3:
+    case Op::LOAD_ARG4:
+    case Op::LOAD_ARG5:
+    case Op::LOAD_ARG6:
+    case Op::LOAD_ARG7:
+    case Op::LOAD_0:
+    case Op::LOAD_1:
+    case Op::LOAD_2:
+    case Op::LOAD_3:
+    case Op::LOAD_4:
+    case Op::LOAD_5:
+    case Op::LOAD_6:
+    case Op::LOAD_7:
+    case Op::LOAD_CONST:
+    case Op::JMP:
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+const char* opName(Op op)
+{
+    static const char* const NAMES[] = {
+        "NOT", "SHL1", "SHR1", "SHR4", "SHR16",
+        "AND", "OR", "XOR", "PLUS",
+        "UNFOLD",
+        "STORE_ARG0", "STORE_ARG1", "STORE_ARG2", "STORE_ARG3",
+        "STORE_ARG4", "STORE_ARG5", "STORE_ARG6", "STORE_ARG7",
+        "LOAD_ARG0", "LOAD_ARG1", "LOAD_ARG2", "LOAD_ARG3",
+        "LOAD_ARG4", "LOAD_ARG5", "LOAD_ARG6", "LOAD_ARG7",
+        "LOAD_0", "LOAD_1", "LOAD_2", "LOAD_3", "LOAD_4", "LOAD_5", "LOAD_6", "LOAD_7",
+        "LOAD_CONST",
+        "JNZ", "JMP",
+        "SHL_N", "SHR_N",
+        "DROP",
+        "FOLD_BEGIN", "FOLD_NEXT"
+    };
+    const size_t index = static_cast<size_t>(op);
+    return index < sizeof(NAMES) / sizeof(NAMES[0]) ? NAMES[index] : "?";
+}
+
+
+ExecutionContext::ExecutionContext()
+{ }
+
+uint64_t* ExecutionContext::args(const uint64_t* argv, size_t argc)
+{
+    argc = std::min<size_t>(argc, 8);
+    std::copy(argv, argv + argc, args_);
+    std::fill(args_ + argc, args_ + 8, 0);
+    return args_;
+}
+
+uint64_t* ExecutionContext::stack(size_t size)
+{
+    if (size <= INLINE_STACK_SIZE) {
+        return inlineStack_;
+    }
+    if (heapStack_.size() < size) {
+        heapStack_.resize(size);
+    }
+    return heapStack_.data();
+}
+
+
+const size_t Block::NO_DEPTH;
+
 Block::Block(size_t initalStackSize)
   : initalStackSize_(initalStackSize)
   , stackSize_(initalStackSize)
+  , maxStackSize_(initalStackSize)
+  , maxBranchStackSize_(initalStackSize)
+  , stackFloor_(0)
+  , ifResults_(0)
 { }
 
+void Block::reserve(size_t size)
+{
+    code_.reserve(size);
+}
+
+void Block::push(size_t count)
+{
+    stackSize_ += count;
+    maxStackSize_ = std::max(maxStackSize_, stackSize_ + ifResults_);
+    maxBranchStackSize_ = std::max(maxBranchStackSize_, stackSize_ + ifResults_);
+}
+
 void Block::emitNot()
 {
-    require (stackSize_ > 0, "emitNot: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_, "emitNot: Inconsisten stack state.");
     code_.push_back(Op::NOT);
 }
 
 void Block::emitShl1()
 {
-    require (stackSize_ > 0, "emitShl1: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_, "emitShl1: Inconsisten stack state.");
     code_.push_back(Op::SHL1);
 }
 
 void Block::emitShr1()
 {
-    require (stackSize_ > 0, "emitShr1: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_, "emitShr1: Inconsisten stack state.");
     code_.push_back(Op::SHR1);
 }
 
 void Block::emitShr4()
 {
-    require (stackSize_ > 0, "emitShr4: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_, "emitShr4: Inconsisten stack state.");
     code_.push_back(Op::SHR4);
 }
 
 void Block::emitShr16()
 {
-    require (stackSize_ > 0, "emitShr16: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_, "emitShr16: Inconsisten stack state.");
     code_.push_back(Op::SHR16);
 }
 
 void Block::emitAnd()
 {
-    require (stackSize_ > 1, "emitAnd: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_ + 1, "emitAnd: Inconsisten stack state.");
     code_.push_back(Op::AND);
     --stackSize_;
 }
 
 void Block::emitOr()
 {
-    require (stackSize_ > 1, "emitOr: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_ + 1, "emitOr: Inconsisten stack state.");
     code_.push_back(Op::OR);
     --stackSize_;
 }
 
 void Block::emitXor()
 {
-    require (stackSize_ > 1, "emitXor: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_ + 1, "emitXor: Inconsisten stack state.");
     code_.push_back(Op::XOR);
     --stackSize_;
 }
 
 void Block::emitPlus()
 {
-    require (stackSize_ > 1, "emitPlus: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_ + 1, "emitPlus: Inconsisten stack state.");
     code_.push_back(Op::PLUS);
     --stackSize_;
 }
 
 void Block::emitUnfold()
 {
-    require (stackSize_ > 0, "emitUnfold: Inconsistent stack state.");
+    require (stackSize_ > stackFloor_, "emitUnfold: Inconsistent stack state.");
     code_.push_back(Op::UNFOLD);
-    stackSize_ += 7;
+    push(7);
+}
+
+void Block::emitShl(int n)
+{
+    require (0 < n && n < 64, "emitShl: Unsupported N.");
+    require (stackSize_ > stackFloor_, "emitShl: Inconsisten stack state.");
+    if (n == 1) {
+        code_.push_back(Op::SHL1);
+    } else {
+        code_.push_back(Op::SHL_N);
+        code_.push_back(static_cast<Op>(n));
+    }
+}
+
+void Block::emitShr(int n)
+{
+    require (0 < n && n < 64, "emitShr: Unsupported N.");
+    require (stackSize_ > stackFloor_, "emitShr: Inconsisten stack state.");
+    if (n == 1) {
+        code_.push_back(Op::SHR1);
+    } else if (n == 4) {
+        code_.push_back(Op::SHR4);
+    } else if (n == 16) {
+        code_.push_back(Op::SHR16);
+    } else {
+        code_.push_back(Op::SHR_N);
+        code_.push_back(static_cast<Op>(n));
+    }
+}
+
+void Block::emitDrop()
+{
+    require (stackSize_ > stackFloor_, "emitDrop: Inconsisten stack state.");
+    code_.push_back(Op::DROP);
+    --stackSize_;
 }
 
 void Block::emitStoreArg(int n)
 {
     require (0 <= n && n < 8, "emitStoreArg: Unsupported N.");
-    require (stackSize_ > 0, "emitStoreArg: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_, "emitStoreArg: Inconsisten stack state.");
     code_.push_back(static_cast<Op>(static_cast<int>(Op::STORE_ARG0) + n));
     --stackSize_;
 }
@@ -149,7 +701,7 @@ void Block::emitLoadArg(int n)
 {
     require (0 <= n && n < 8, "emitLoadArg: Unsupported N.");
     code_.push_back(static_cast<Op>(static_cast<int>(Op::LOAD_ARG0) + n));
-    ++stackSize_;
+    push(1);
 }
 
 void Block::emitLoadConst(uint64_t c)
@@ -161,12 +713,12 @@ void Block::emitLoadConst(uint64_t c)
         code_.resize(code_.size() + 8);
         *(uint64_t*)(&code_[code_.size() - 8]) = c;
     }
-    ++stackSize_;
+    push(1);
 }
 
 void Block::emitJnz(size_t shift)
 {
-    require (stackSize_ > 0, "emitJnz: Inconsisten stack state.");
+    require (stackSize_ > stackFloor_, "emitJnz: Inconsisten stack state.");
     require (static_cast<uint16_t>(shift) == shift, "emitJnz: Shift is too large.");
     code_.push_back(Op::JNZ);
     code_.resize(code_.size() + 2);
@@ -184,38 +736,278 @@ void Block::emitJmp(size_t shift)
 
 void Block::emitBlock(const Block& block)
 {
-    require (stackSize_ >= block.initalStackSize_, "emitBlock: Inconsisten stack state.");
+    require (stackSize_ >= stackFloor_ + block.initalStackSize_, "emitBlock: Inconsisten stack state.");
     code_.insert(code_.end(), block.code_.begin(), block.code_.end());
+    const size_t base = stackSize_ - block.initalStackSize_ + ifResults_;
+    maxStackSize_ = std::max(maxStackSize_, base + block.maxStackSize_);
+    maxBranchStackSize_ = std::max(maxBranchStackSize_, base + block.maxBranchStackSize_);
     stackSize_ = stackSize_ - block.initalStackSize_ + block.stackSize_;
 }
 
+void Block::emitCode(const Op* code, size_t size)
+{
+    // Depths above the floor, so that the code cannot pop below it.
+    const std::vector<size_t> depths = stackDepths(code, size, stackSize_ - stackFloor_);
+    require (depths[size] != NO_DEPTH, "emitCode: Code does not end.");
+
+    for (size_t depth : depths) {
+        if (depth != NO_DEPTH) {
+            maxStackSize_ = std::max(maxStackSize_, stackFloor_ + ifResults_ + depth);
+        }
+    }
+    maxBranchStackSize_ = std::max(maxBranchStackSize_, stackFloor_ + ifResults_ +
+                                   maxBranchStackSize(code, size, stackSize_ - stackFloor_));
+    code_.insert(code_.end(), code, code + size);
+    stackSize_ = stackFloor_ + depths[size];
+}
+
 void Block::emitIf0(const Block& ifBlock, const Block& elseBlock)
 {
     require (ifBlock.initalStackSize_ == 0 && ifBlock.stackSize_ == 1,
              "emitIf0: Inconsisten ifBlock.");
     require (elseBlock.initalStackSize_ == 0 && elseBlock.stackSize_ == 1,
              "emitIf0: Inconsisten elseBlock.");
-    require (stackSize_ > 0, "emitIf0: Inconsisten stack state.");
 
-    emitJnz(ifBlock.code_.size() + /* jmp_size */ 3);
+    const Patch ifPatch = beginIf0();
     emitBlock(ifBlock);
-    emitJmp(elseBlock.code_.size());
+    const Patch elsePatch = elseIf0(ifPatch);
     emitBlock(elseBlock);
+    endIf0(elsePatch);
+}
+
+void Block::emitFold(int n, const Block& body)
+{
+    require (body.initalStackSize_ == 0 && body.stackSize_ == 1, "emitFold: Inconsisten body.");
+
+    const Patch patch = beginFold(n);
+    emitBlock(body);
+    endFold(patch);
+}
+
+Block::Patch Block::beginIf0()
+{
+    require (stackSize_ > stackFloor_, "beginIf0: Inconsisten stack state.");
+    const Patch result = {code_.size(), stackFloor_};
+    emitJnz(0);
+    stackFloor_ = stackSize_;
+    return result;
+}
+
+Block::Patch Block::elseIf0(const Patch& ifPatch)
+{
+    require (ifPatch.position < code_.size() && code_[ifPatch.position] == Op::JNZ,
+             "elseIf0: Not an if0.");
+    require (stackSize_ == stackFloor_ + 1, "elseIf0: Inconsisten if branch.");
+    const Patch result = {code_.size(), ifPatch.stackFloor};
+    emitJmp(0);
+    patchShift(ifPatch.position + 1, code_.size() - 3 - ifPatch.position);
+    // The else branch starts from the depth the if branch started from,
+    // but the lane-parallel backends keep the result of the if branch below
+    // it, and so do maxStackSize() and maxBranchStackSize().
     --stackSize_;
+    ++ifResults_;
+    return result;
+}
+
+void Block::endIf0(const Patch& elsePatch)
+{
+    require (elsePatch.position < code_.size() && code_[elsePatch.position] == Op::JMP,
+             "endIf0: Not an else branch.");
+    require (stackSize_ == stackFloor_ + 1, "endIf0: Inconsisten else branch.");
+    patchShift(elsePatch.position + 1, code_.size() - elsePatch.position - 3);
+    stackFloor_ = elsePatch.stackFloor;
+    --ifResults_;
+}
+
+Block::Patch Block::beginFold(int n)
+{
+    require (0 <= n && n + 1 < 8, "beginFold: Unsupported N.");
+    require (stackSize_ > stackFloor_ + 1, "beginFold: Inconsisten stack state.");
+    const Patch result = {code_.size(), stackFloor_};
+    code_.push_back(Op::FOLD_BEGIN);
+    code_.push_back(static_cast<Op>(n));
+    code_.resize(code_.size() + 2);
+    // The value and the accumulator make room for the remaining bytes and
+    // the counter, which the body must leave alone.
+    stackFloor_ = stackSize_;
+    return result;
+}
+
+void Block::endFold(const Patch& patch)
+{
+    require (patch.position < code_.size() && code_[patch.position] == Op::FOLD_BEGIN,
+             "endFold: Not a fold.");
+    require (stackSize_ == stackFloor_ + 1, "endFold: Inconsisten body.");
+    const size_t size = code_.size() - patch.position - opSize(Op::FOLD_BEGIN);
+    patchShift(patch.position + 2, size);
+    code_.push_back(Op::FOLD_NEXT);
+    code_.push_back(code_[patch.position + 1]);
+    code_.resize(code_.size() + 2);
+    patchShift(code_.size() - 2, size);
+    stackSize_ -= 2;
+    stackFloor_ = patch.stackFloor;
+}
+
+void Block::patchShift(size_t position, size_t shift)
+{
+    require (static_cast<uint16_t>(shift) == shift, "patchShift: Shift is too large.");
+    *(uint16_t*)(&code_[position]) = shift;
+}
+
+
+std::vector<size_t> Block::stackDepths() const
+{
+    return stackDepths(code_.data(), code_.size(), initalStackSize_);
 }
 
+size_t Block::maxBranchStackSize(const Op* code, size_t size, size_t initalStackSize)
+{
+    const std::vector<size_t> depths = stackDepths(code, size, initalStackSize);
+    // If results held below the else branches being walked, by where the
+    // branches end.
+    std::vector<size_t> ends(size + 1, 0);
+    size_t ifResults = 0;
+    size_t result = initalStackSize;
+    for (size_t ip = 0; ; ip += opSize(code[ip])) {
+        // At the end of an else branch both results are still there.
+        if (depths[ip] != NO_DEPTH) {
+            result = std::max(result, depths[ip] + ifResults);
+        }
+        ifResults -= ends[ip];
+        if (ip == size) {
+            break;
+        }
+        if (code[ip] == Op::JMP && depths[ip] != NO_DEPTH) {
+            ++ends[ip + 3 + *(const uint16_t*)&code[ip + 1]];
+            ++ifResults;
+        }
+    }
+    return result;
+}
+
+std::vector<size_t> Block::stackDepths(const Op* code, size_t size, size_t initalStackSize)
+{
+    std::vector<size_t> depths(size + 1, NO_DEPTH);
+    std::vector<bool> starts(size + 1, false);
+    const auto mark = [&depths](size_t target, size_t depth) {
+        require (target < depths.size(), "stackDepths: Jump out of code.");
+        require (depths[target] == NO_DEPTH || depths[target] == depth,
+                 "stackDepths: Inconsistent stack depth at jump target.");
+        depths[target] = depth;
+    };
+
+    size_t depth = initalStackSize;
+    bool reachable = true;
+    size_t ip = 0;
+    while (ip < size) {
+        const Op op = code[ip];
+        require (op <= Op::FOLD_NEXT && ip + opSize(op) <= size, "stackDepths: Invalid instruction.");
+        starts[ip] = true;
+        if (depths[ip] != NO_DEPTH) {
+            require (!reachable || depths[ip] == depth,
+                     "stackDepths: Inconsistent stack depth at jump target.");
+            depth = depths[ip];
+            reachable = true;
+        }
+        if (!reachable) {
+            ip += opSize(op);
+            continue;
+        }
+        depths[ip] = depth;
+
+        require (depth >= stackInputs(op), "stackDepths: Inconsistent stack state.");
+        if (op >= Op::AND && op <= Op::PLUS) {
+            --depth;
+        } else if (op == Op::UNFOLD) {
+            depth += 7;
+        } else if ((op >= Op::STORE_ARG0 && op <= Op::STORE_ARG7) || op == Op::DROP) {
+            --depth;
+        } else if (op >= Op::LOAD_ARG0 && op <= Op::LOAD_CONST) {
+            ++depth;
+        } else if (op == Op::SHL_N || op == Op::SHR_N) {
+            const int n = static_cast<int>(code[ip + 1]);
+            require (0 < n && n < 64, "stackDepths: Unsupported N.");
+        } else if (op == Op::JNZ) {
+            --depth;
+            mark(ip + 3 + *(const uint16_t*)&code[ip + 1], depth);
+        } else if (op == Op::JMP) {
+            mark(ip + 3 + *(const uint16_t*)&code[ip + 1], depth);
+            reachable = false;
+        } else if (op == Op::FOLD_BEGIN || op == Op::FOLD_NEXT) {
+            const int n = static_cast<int>(code[ip + 1]);
+            require (0 <= n && n + 1 < 8, "stackDepths: Unsupported N.");
+            if (op == Op::FOLD_NEXT) {
+                require (*(const uint16_t*)&code[ip + 2] <= ip, "stackDepths: Jump out of code.");
+                mark(ip - *(const uint16_t*)&code[ip + 2], depth - 1);
+                depth -= 2;
+            }
+        }
+        ip += opSize(op);
+    }
+    starts[size] = true;
+    if (reachable) {
+        mark(size, depth);
+    }
+    for (size_t target = 0; target < depths.size(); ++target) {
+        require (depths[target] == NO_DEPTH || starts[target], "stackDepths: Jump into an instruction.");
+    }
+    return depths;
+}
 
 uint64_t Block::execute(std::vector<uint64_t> argv) const
+{
+    ExecutionContext context;
+    return execute(argv.data(), argv.size(), &context);
+}
+
+uint64_t Block::execute(const uint64_t* argv, size_t argc, ExecutionContext* const context) const
 {
     require (initalStackSize_ == 0, "execute: Block is not runnable.");
     require (stackSize_ == 1, "execute: Block incomplete.");
+    return BlockRef(code_.data(), code_.size(), maxStackSize_, BlockRef::TRUSTED).execute(argv, argc, context);
+}
 
-    argv.resize(8);
+void Block::executeBatch(const uint64_t* inputs, size_t n, uint64_t* out) const
+{
+    executeBatch(&inputs, 1, n, out);
+}
+
+void Block::executeBatch(const uint64_t* const* inputs, size_t argc, size_t n, uint64_t* out) const
+{
+    require (initalStackSize_ == 0, "executeBatch: Block is not runnable.");
+    require (stackSize_ == 1, "executeBatch: Block incomplete.");
+    BlockRef(code_.data(), code_.size(), maxStackSize_, BlockRef::TRUSTED).executeBatch(inputs, argc, n, out);
+}
 
-    Stack stack;
+
+BlockRef::BlockRef(const Op* code, size_t size, size_t maxStackSize)
+  : code_(code)
+  , size_(size)
+  , maxStackSize_(maxStackSize)
+{
+    const std::vector<size_t> depths = Block::stackDepths(code, size, 0);
+    require (depths[size] == 1, "BlockRef: Block incomplete.");
+    for (size_t depth : depths) {
+        require (depth == Block::NO_DEPTH || depth <= maxStackSize, "BlockRef: Stack size exceeded.");
+    }
+}
+
+BlockRef::BlockRef(const Op* code, size_t size, size_t maxStackSize, Trusted)
+  : code_(code)
+  , size_(size)
+  , maxStackSize_(maxStackSize)
+{ }
+
+uint64_t BlockRef::execute(const uint64_t* argv, size_t argc, ExecutionContext* const context) const
+{
+    // The emitters (or the constructor) have verified stack usage and
+    // argument indices, so the loop below runs without any checks.
+    uint64_t* const args = context->args(argv, argc);
+    Stack stack = context->stack(maxStackSize_);
 
     size_t ip = 0;
-    while (ip < code_.size()) {
+    while (ip < size_) {
+        COUNT_OPCODE(code_[ip]);
         switch (code_[ip]) {
         case Op::NOT:
             opNot(&stack);
@@ -275,8 +1067,7 @@ uint64_t Block::execute(std::vector<uint64_t> argv) const
         case Op::STORE_ARG5:
         case Op::STORE_ARG6:
         case Op::STORE_ARG7:
-            argv.at(static_cast<int>(code_[ip]) - static_cast<int>(Op::STORE_ARG0)) = stack.back();
-            stack.pop_back();
+            args[static_cast<int>(code_[ip]) - static_cast<int>(Op::STORE_ARG0)] = *--stack;
             ++ip;
             break;
 
@@ -288,7 +1079,7 @@ uint64_t Block::execute(std::vector<uint64_t> argv) const
         case Op::LOAD_ARG5:
         case Op::LOAD_ARG6:
         case Op::LOAD_ARG7:
-            stack.push_back(argv.at(static_cast<int>(code_[ip]) - static_cast<int>(Op::LOAD_ARG0)));
+            *stack++ = args[static_cast<int>(code_[ip]) - static_cast<int>(Op::LOAD_ARG0)];
             ++ip;
             break;
 
@@ -300,20 +1091,34 @@ uint64_t Block::execute(std::vector<uint64_t> argv) const
         case Op::LOAD_5:
         case Op::LOAD_6:
         case Op::LOAD_7:
-            stack.push_back(static_cast<int>(code_[ip]) - static_cast<int>(Op::LOAD_0));
+            *stack++ = static_cast<int>(code_[ip]) - static_cast<int>(Op::LOAD_0);
             ++ip;
             break;
 
         case Op::LOAD_CONST:
-            stack.push_back(*(const uint64_t*)&code_[ip + 1]);
+            *stack++ = *(const uint64_t*)&code_[ip + 1];
             ip += 9;
             break;
 
+        case Op::SHL_N:
+            opShl(&stack, static_cast<int>(code_[ip + 1]));
+            ip += 2;
+            break;
+
+        case Op::SHR_N:
+            opShr(&stack, static_cast<int>(code_[ip + 1]));
+            ip += 2;
+            break;
+
+        case Op::DROP:
+            --stack;
+            ++ip;
+            break;
+
         case Op::JNZ:
-            if (stack.back() != 0) {
+            if (*--stack != 0) {
                 ip += *(const uint16_t*)&code_[ip + 1];
             }
-            stack.pop_back();
             ip += 3;
             break;
 
@@ -321,7 +1126,52 @@ uint64_t Block::execute(std::vector<uint64_t> argv) const
             ip += *(const uint16_t*)&code_[ip + 1];
             ip += 3;
             break;
+
+        case Op::FOLD_BEGIN:
+            opFoldBegin(&stack, args + static_cast<int>(code_[ip + 1]));
+            ip += 4;
+            break;
+
+        case Op::FOLD_NEXT:
+            if (opFoldNext(&stack, args + static_cast<int>(code_[ip + 1]))) {
+                ip -= *(const uint16_t*)&code_[ip + 2];
+            } else {
+                ip += 4;
+            }
+            break;
         }
     }
-    return stack.back();
+    return stack[-1];
+}
+
+void BlockRef::executeBatch(const uint64_t* inputs, size_t n, uint64_t* out) const
+{
+    executeBatch(&inputs, 1, n, out);
+}
+
+void BlockRef::executeBatch(const uint64_t* const* inputs, size_t argc, size_t n, uint64_t* out) const
+{
+    require (argc <= 8, "executeBatch: Unsupported argc.");
+
+    Lanes mask;
+    for (size_t i = 0; i < BATCH_WIDTH; ++i) {
+        mask.value[i] = ~uint64_t(0);
+    }
+
+    BatchStack stack;
+    stack.reserve(maxStackSize_);
+    for (size_t offset = 0; offset < n; offset += BATCH_WIDTH) {
+        const size_t width = std::min(BATCH_WIDTH, n - offset);
+
+        Lanes args[8] = {};
+        for (size_t arg = 0; arg < argc; ++arg) {
+            if (inputs[arg]) {
+                std::copy(inputs[arg] + offset, inputs[arg] + offset + width, args[arg].value);
+            }
+        }
+
+        stack.clear();
+        executeBatchRange(code_, 0, size_, mask, args, &stack);
+        std::copy(stack.back().value, stack.back().value + width, out + offset);
+    }
 }
@@ -16,14 +16,82 @@ enum class Op : uint8_t {
     LOAD_0, LOAD_1, LOAD_2, LOAD_3, LOAD_4, LOAD_5, LOAD_6, LOAD_7,
     LOAD_CONST,
 
-    JNZ, JMP
+    JNZ, JMP,
+
+    // Produced by optimize(): shifts by an immediate byte, and a plain pop.
+    SHL_N, SHR_N,
+    DROP,
+
+    // Loop over the 8 bytes of a value; see Block::emitFold.
+    FOLD_BEGIN, FOLD_NEXT
+};
+
+// Size in bytes of an instruction, including its immediate operand.
+size_t opSize(Op op);
+
+// Number of stack values an instruction reads.
+size_t stackInputs(Op op);
+
+const char* opName(Op op);
+
+// Scratch memory for Block::execute, reused across calls so that evaluation
+// does not allocate. Stacks up to INLINE_STACK_SIZE deep live inside the
+// context itself. One context per thread.
+class ExecutionContext {
+public:
+    ExecutionContext();
+
+    ExecutionContext(const ExecutionContext&) = delete;
+    ExecutionContext& operator=(const ExecutionContext&) = delete;
+
+    // Copies argv[0..argc) into the 8 argument slots, zero-filling the rest.
+    uint64_t* args(const uint64_t* argv, size_t argc);
+    uint64_t* stack(size_t size);
+
+private:
+    static const size_t INLINE_STACK_SIZE = 64;
+
+    uint64_t args_[8];
+    uint64_t inlineStack_[INLINE_STACK_SIZE];
+    std::vector<uint64_t> heapStack_;
 };
 
 class Block {
 public:
+    static const size_t NO_DEPTH = static_cast<size_t>(-1);
+
     explicit Block(size_t initalStackSize);
 
+    size_t initalStackSize() const { return initalStackSize_; }
+    size_t stackSize() const { return stackSize_; }
+    // Upper bound of the stack depth reached while running the block.
+    size_t maxStackSize() const { return maxStackSize_; }
+    // Same when both branches of every if0 run, the else branch on top of
+    // the result of the if branch, as in executeSliced.
+    size_t maxBranchStackSize() const { return maxBranchStackSize_; }
+    const std::vector<Op>& code() const { return code_; }
+    // Preallocates code() for size bytes.
+    void reserve(size_t size);
+
+    // Static stack depth before every instruction of code(), plus the depth at
+    // code().size(). Operand bytes and unreachable code get NO_DEPTH.
+    std::vector<size_t> stackDepths() const;
+    // Same for code[0, size) starting at the given depth; throws when the
+    // code could not have been emitted.
+    static std::vector<size_t> stackDepths(const Op* code, size_t size, size_t initalStackSize);
+    // maxBranchStackSize() of code[0, size) starting at the given depth;
+    // throws like stackDepths().
+    static size_t maxBranchStackSize(const Op* code, size_t size, size_t initalStackSize);
+
     uint64_t execute(std::vector<uint64_t> argv) const;
+    uint64_t execute(const uint64_t* argv, size_t argc, ExecutionContext* context) const;
+
+    // Runs the block once per input (argv = {inputs[i]}) and stores the
+    // results into out[0..n). Lanes are evaluated together, opcode by opcode.
+    void executeBatch(const uint64_t* inputs, size_t n, uint64_t* out) const;
+    // Same with argv = {inputs[0][i], .., inputs[argc - 1][i]}; a null
+    // column stands for zeros.
+    void executeBatch(const uint64_t* const* inputs, size_t argc, size_t n, uint64_t* out) const;
 
     void emitNot();
     void emitShl1();
@@ -35,18 +103,90 @@ public:
     void emitXor();
     void emitPlus();
     void emitUnfold();
+    // Shift by 0 < n < 64; uses SHL1/SHR1/SHR4/SHR16 when they match.
+    void emitShl(int n);
+    void emitShr(int n);
+    void emitDrop();
 
     void emitStoreArg(int n);
     void emitLoadArg(int n);
     void emitLoadConst(uint64_t c);
 
+    // Raw jumps must form the shape emitted by emitIf0: stack depth tracking
+    // (and thus maxStackSize) follows the code linearly.
     void emitJnz(size_t shift);
     void emitJmp(size_t shift);
     void emitBlock(const Block& block);
+    // Appends raw code, such as a slice of another block's code(). The code
+    // is validated the same way as by stackDepths().
+    void emitCode(const Op* code, size_t size);
     void emitIf0(const Block& ifBlock, const Block& elseBlock);
 
+    // Pops [value, accumulator] and runs body once per byte of value, lowest
+    // byte first, with the byte in argument n and the accumulator in argument
+    // n + 1; each result of body becomes the next accumulator. Emits
+    //
+    //   FOLD_BEGIN n size, body, FOLD_NEXT n size
+    //
+    // with size = body size in bytes. While body runs, the remaining bytes
+    // and an iteration counter sit below it on the stack.
+    void emitFold(int n, const Block& body);
+
+    // The same, emitted in one pass: the branches and the body are emitted
+    // in place between the calls, and the jumps and sizes are patched in
+    // once known, so nested if0s and folds need no Blocks of their own.
+    //
+    //   <condition> beginIf0() <if branch> elseIf0() <else branch> endIf0()
+    //   <value> <accumulator> beginFold(n) <body> endFold()
+    //
+    // Each branch and the body must push one value, and cannot pop what was
+    // on the stack before they started. The block is not runnable while a
+    // Patch is pending; they are closed innermost first.
+    struct Patch {
+        size_t position;                    // of the instruction to patch
+        size_t stackFloor;                  // to restore when it is closed
+    };
+    Patch beginIf0();
+    Patch elseIf0(const Patch& ifPatch);
+    void endIf0(const Patch& elsePatch);
+    Patch beginFold(int n);
+    void endFold(const Patch& patch);
+
 private:
+    void push(size_t count);
+    void patchShift(size_t position, size_t shift);
+
     size_t initalStackSize_;
     size_t stackSize_;
+    size_t maxStackSize_;
+    size_t maxBranchStackSize_;
+    size_t stackFloor_;                     // emitted code cannot pop below it
+    size_t ifResults_;                      // held below the else branches being emitted
     std::vector<Op> code_;
 };
+
+// Runnable code owned by someone else, such as a corpus file mapped into
+// memory; executes in place like the Block it was emitted as.
+class BlockRef {
+public:
+    enum Trusted { TRUSTED };
+
+    // Throws unless code[0, size) is the code of a runnable Block whose stack
+    // stays within maxStackSize.
+    BlockRef(const Op* code, size_t size, size_t maxStackSize);
+    // Skips the checks, for code known to come from a runnable Block.
+    BlockRef(const Op* code, size_t size, size_t maxStackSize, Trusted);
+
+    const Op* code() const { return code_; }
+    size_t size() const { return size_; }
+    size_t maxStackSize() const { return maxStackSize_; }
+
+    uint64_t execute(const uint64_t* argv, size_t argc, ExecutionContext* context) const;
+    void executeBatch(const uint64_t* inputs, size_t n, uint64_t* out) const;
+    void executeBatch(const uint64_t* const* inputs, size_t argc, size_t n, uint64_t* out) const;
+
+private:
+    const Op* code_;
+    size_t size_;
+    size_t maxStackSize_;
+};
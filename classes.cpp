@@ -0,0 +1,71 @@
+#include "classes.h"
+#include "stats.h"
+#include <algorithm>
+
+
+namespace {
+
+bool isSmaller(StringRef lhs, const std::string& rhs)
+{
+    if (lhs.size() != rhs.size()) {
+        return lhs.size() < rhs.size();
+    }
+    return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
+}
+
+} // namespace
+
+
+ClassTable::Shard& ClassTable::shardOf(const Fingerprint& fingerprint)
+{
+    // With a single input the 64-bit hash is the output value itself, so its
+    // low bits are not spread out.
+    return shards_[(((fingerprint.low ^ fingerprint.high) * 0x9e3779b97f4a7c15UL) >> 58) % SHARD_COUNT];
+}
+
+void ClassTable::add(const Fingerprint& fingerprint, StringRef program)
+{
+    Shard& shard = shardOf(fingerprint);
+    TimedLock<std::mutex> lock(shard.mutex);
+    const auto inserted = shard.classes.emplace(fingerprint, Entry());
+    Entry& entry = inserted.first->second;
+    if (inserted.second || isSmaller(program, entry.representative)) {
+        entry.representative.assign(program.data(), program.size());
+    }
+    ++entry.size;
+}
+
+std::vector<ClassTable::Class> ClassTable::classes() const
+{
+    std::vector<Class> result;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& entry : shard.classes) {
+            result.push_back(Class{entry.first, entry.second.size, entry.second.representative});
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const Class& lhs, const Class& rhs) {
+        return lhs.fingerprint < rhs.fingerprint;
+    });
+    return result;
+}
+
+
+bool CanonicalTable::find(const Fingerprint& canonical, Fingerprint* const outputs)
+{
+    Shard& shard = shards_[(canonical.low >> 58) % SHARD_COUNT];
+    TimedLock<std::mutex> lock(shard.mutex);
+    const auto found = shard.outputs.find(canonical);
+    if (found == shard.outputs.end()) {
+        return false;
+    }
+    *outputs = found->second;
+    return true;
+}
+
+void CanonicalTable::add(const Fingerprint& canonical, const Fingerprint& outputs)
+{
+    Shard& shard = shards_[(canonical.low >> 58) % SHARD_COUNT];
+    TimedLock<std::mutex> lock(shard.mutex);
+    shard.outputs.emplace(canonical, outputs);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "fingerprint.h"
+#include "parser.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Programs grouped by the fingerprint of their output vector, filled by many
+// threads at once. Only the size of a class and its smallest program are
+// kept: the shortest, the lexicographically first among equally short ones,
+// so the result does not depend on the order of insertion.
+class ClassTable {
+public:
+    struct Class {
+        Fingerprint fingerprint;
+        size_t size;
+        std::string representative;
+    };
+
+    void add(const Fingerprint& fingerprint, StringRef program);
+
+    // Ordered by fingerprint.
+    std::vector<Class> classes() const;
+
+private:
+    struct Entry {
+        size_t size;
+        std::string representative;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<Fingerprint, Entry, FingerprintHash> classes;
+    };
+
+    static const size_t SHARD_COUNT = 64;
+
+    Shard& shardOf(const Fingerprint& fingerprint);
+
+    Shard shards_[SHARD_COUNT];
+};
+
+// Output fingerprints of programs by canonical hash (see parseLambda), filled
+// by many threads at once. Programs with equal canonical hashes compute the
+// same outputs, so only the first of them needs to be evaluated.
+class CanonicalTable {
+public:
+    // False until a program with canonical has been added.
+    bool find(const Fingerprint& canonical, Fingerprint* outputs);
+    void add(const Fingerprint& canonical, const Fingerprint& outputs);
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<Fingerprint, Fingerprint, FingerprintHash> outputs;
+    };
+
+    static const size_t SHARD_COUNT = 64;
+
+    Shard shards_[SHARD_COUNT];
+};
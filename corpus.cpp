@@ -0,0 +1,99 @@
+#include "corpus.h"
+#include "require.h"
+#include <cstring>
+
+
+namespace {
+
+const char CORPUS_FILE_MAGIC[8] = {'B', 'V', 'C', 'O', 'R', 'P', 'U', 'S'};
+const uint32_t CORPUS_FILE_VERSION = 1;
+
+const size_t ALIGNMENT = 8;
+
+size_t entrySize(const CorpusEntry& entry)
+{
+    const size_t size = sizeof(CorpusEntry) + entry.codeSize + entry.textSize;
+    return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+} // namespace
+
+
+CorpusFileHeader corpusFileHeader()
+{
+    CorpusFileHeader result;
+    std::memcpy(result.magic, CORPUS_FILE_MAGIC, sizeof(result.magic));
+    result.version = CORPUS_FILE_VERSION;
+    result.reserved = 0;
+    return result;
+}
+
+void appendCorpusEntry(const Block& block, StringRef program, std::string* const output)
+{
+    require (block.initalStackSize() == 0 && block.stackSize() == 1, "appendCorpusEntry: Block is not runnable.");
+    require (static_cast<uint32_t>(block.code().size()) == block.code().size() &&
+             static_cast<uint32_t>(program.size()) == program.size(),
+             "appendCorpusEntry: Program is too large.");
+
+    const CorpusEntry entry = {
+        static_cast<uint32_t>(block.code().size()),
+        static_cast<uint32_t>(program.size()),
+        static_cast<uint32_t>(block.maxStackSize()),
+        0
+    };
+    const size_t begin = output->size();
+    output->append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    output->append(reinterpret_cast<const char*>(block.code().data()), block.code().size());
+    output->append(program.data(), program.size());
+    output->resize(begin + entrySize(entry), '\0');
+}
+
+
+Corpus::Corpus(const std::string& path)
+  : file_(path)
+{
+    const StringRef text = file_.text();
+    CorpusFileHeader header;
+    require (text.size() >= sizeof(header), "Corpus: " + path + " is not a corpus.");
+    std::memcpy(&header, text.data(), sizeof(header));
+    require (std::memcmp(header.magic, CORPUS_FILE_MAGIC, sizeof(header.magic)) == 0,
+             "Corpus: " + path + " is not a corpus.");
+    require (header.version == CORPUS_FILE_VERSION, "Corpus: Unsupported version of " + path + ".");
+
+    // Entries are not read until they are executed, but their sizes must
+    // chain up to the end of the file.
+    size_t offset = sizeof(header);
+    while (offset < text.size()) {
+        require (text.size() - offset >= sizeof(CorpusEntry), "Corpus: Truncated entry in " + path + ".");
+        const CorpusEntry& entry = *reinterpret_cast<const CorpusEntry*>(text.data() + offset);
+        require (text.size() - offset >= entrySize(entry), "Corpus: Truncated entry in " + path + ".");
+        offsets_.push_back(offset);
+        offset += entrySize(entry);
+    }
+}
+
+const CorpusEntry& Corpus::entry(size_t index) const
+{
+    return *reinterpret_cast<const CorpusEntry*>(file_.text().data() + offsets_[index]);
+}
+
+BlockRef Corpus::block(size_t index) const
+{
+    const CorpusEntry& entry = this->entry(index);
+    const Op* const code = reinterpret_cast<const Op*>(&entry + 1);
+    // No instruction pushes more than 8 values; keeps a corrupt entry from
+    // asking for a huge stack.
+    require (entry.maxStackSize <= 8 * size_t(entry.codeSize) + 1, "Corpus: Invalid stack size.");
+    return BlockRef(code, entry.codeSize, entry.maxStackSize);
+}
+
+StringRef Corpus::program(size_t index) const
+{
+    const CorpusEntry& entry = this->entry(index);
+    return StringRef(reinterpret_cast<const char*>(&entry + 1) + entry.codeSize, entry.textSize);
+}
+
+uint64_t Corpus::programOffset(size_t index) const
+{
+    return offsets_[index] + sizeof(CorpusEntry) + entry(index).codeSize;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "block.h"
+#include "input.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Parsed programs saved for later runs, which map the file and execute the
+// code in place instead of parsing the text again.
+//
+// The file is a CorpusFileHeader followed by one entry per program, each
+// starting at a multiple of 8 bytes: a CorpusEntry, the code, the program
+// text and zero padding. Numbers are in the byte order of the writing machine.
+struct CorpusFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct CorpusEntry {
+    uint32_t codeSize;
+    uint32_t textSize;
+    uint32_t maxStackSize;
+    uint32_t reserved;
+};
+
+CorpusFileHeader corpusFileHeader();
+
+// Appends the entry of a runnable block to output.
+void appendCorpusEntry(const Block& block, StringRef program, std::string* output);
+
+class Corpus {
+public:
+    // Throws unless the file is a corpus whose entries lie within the file.
+    explicit Corpus(const std::string& path);
+
+    Corpus(const Corpus&) = delete;
+    Corpus& operator=(const Corpus&) = delete;
+
+    size_t size() const { return offsets_.size(); }
+
+    // Throws when the stored code is not that of a runnable Block.
+    BlockRef block(size_t index) const;
+    StringRef program(size_t index) const;
+    // Position of program(index) in the file.
+    uint64_t programOffset(size_t index) const;
+
+private:
+    const CorpusEntry& entry(size_t index) const;
+
+    const MappedFile file_;
+    std::vector<size_t> offsets_;       // of the entries
+};
@@ -0,0 +1,174 @@
+#include "enumerator.h"
+#include "require.h"
+
+
+namespace {
+
+struct Operator {
+    const char* name;
+    Op op;
+};
+
+const Operator UNARY[] = {
+    {"not", Op::NOT}, {"shl1", Op::SHL1}, {"shr1", Op::SHR1}, {"shr4", Op::SHR4}, {"shr16", Op::SHR16}
+};
+
+const Operator BINARY[] = {
+    {"and", Op::AND}, {"or", Op::OR}, {"xor", Op::XOR}, {"plus", Op::PLUS}
+};
+
+const char* nameOf(Op op)
+{
+    for (const auto& entry : UNARY) {
+        if (entry.op == op) {
+            return entry.name;
+        }
+    }
+    for (const auto& entry : BINARY) {
+        if (entry.op == op) {
+            return entry.name;
+        }
+    }
+    return "?";
+}
+
+void emitOp(Op op, Block* const block)
+{
+    switch (op) {
+    case Op::NOT:
+        block->emitNot();
+        break;
+    case Op::SHL1:
+        block->emitShl1();
+        break;
+    case Op::SHR1:
+        block->emitShr1();
+        break;
+    case Op::SHR4:
+        block->emitShr4();
+        break;
+    case Op::SHR16:
+        block->emitShr16();
+        break;
+    case Op::AND:
+        block->emitAnd();
+        break;
+    case Op::OR:
+        block->emitOr();
+        break;
+    case Op::XOR:
+        block->emitXor();
+        break;
+    default:
+        block->emitPlus();
+        break;
+    }
+}
+
+} // namespace
+
+
+Enumerator::Enumerator(std::vector<uint64_t> inputs, const std::vector<std::string>& operators)
+  : inputs_(std::move(inputs))
+  , if0_(false)
+{
+    for (const auto& name : operators) {
+        bool known = false;
+        for (const auto& entry : UNARY) {
+            if (name == entry.name) {
+                unary_.push_back(entry.op);
+                known = true;
+            }
+        }
+        for (const auto& entry : BINARY) {
+            if (name == entry.name) {
+                binary_.push_back(entry.op);
+                known = true;
+            }
+        }
+        if (name == "if0") {
+            if0_ = true;
+            known = true;
+        }
+        require (known, "Enumerator: Unsupported operator " + name + ".");
+    }
+}
+
+void Enumerator::add(std::string text, Block block, size_t size, const Visitor& visit)
+{
+    std::vector<uint64_t> outputs(inputs_.size());
+    block.executeBatch(inputs_.data(), inputs_.size(), outputs.data());
+    if (!seen_.insert(outputs).second) {
+        return;
+    }
+    visit("(lambda (x) " + text + ")", outputs);
+    terms_[size].push_back(Term{std::move(text), std::move(block)});
+}
+
+void Enumerator::run(size_t maxSize, const Visitor& visit)
+{
+    terms_.assign(maxSize, std::vector<Term>());
+    seen_.clear();
+
+    // Term sizes exclude the lambda.
+    for (size_t size = 1; size < maxSize; ++size) {
+        if (size == 1) {
+            for (uint64_t c = 0; c < 2; ++c) {
+                Block block(0);
+                block.emitLoadConst(c);
+                add(std::to_string(c), std::move(block), size, visit);
+            }
+            Block block(0);
+            block.emitLoadArg(0);
+            add("x", std::move(block), size, visit);
+            continue;
+        }
+
+        for (Op op : unary_) {
+            for (size_t index = 0; index < terms_[size - 1].size(); ++index) {
+                const Term& term = terms_[size - 1][index];
+                Block block = term.block;
+                emitOp(op, &block);
+                add(std::string("(") + nameOf(op) + ' ' + term.text + ')', std::move(block), size, visit);
+            }
+        }
+
+        // Binary operators are commutative: only lhs <= rhs.
+        for (Op op : binary_) {
+            for (size_t lhsSize = 1; 2 * lhsSize <= size - 1; ++lhsSize) {
+                const size_t rhsSize = size - 1 - lhsSize;
+                for (size_t lhs = 0; lhs < terms_[lhsSize].size(); ++lhs) {
+                    const size_t first = lhsSize == rhsSize ? lhs : 0;
+                    for (size_t rhs = first; rhs < terms_[rhsSize].size(); ++rhs) {
+                        const Term& left = terms_[lhsSize][lhs];
+                        const Term& right = terms_[rhsSize][rhs];
+                        Block block = left.block;
+                        block.emitBlock(right.block);
+                        emitOp(op, &block);
+                        add(std::string("(") + nameOf(op) + ' ' + left.text + ' ' + right.text + ')',
+                            std::move(block), size, visit);
+                    }
+                }
+            }
+        }
+
+        if (!if0_) {
+            continue;
+        }
+        for (size_t conditionSize = 1; conditionSize + 2 <= size - 1; ++conditionSize) {
+            for (size_t ifSize = 1; conditionSize + ifSize + 1 <= size - 1; ++ifSize) {
+                const size_t elseSize = size - 1 - conditionSize - ifSize;
+                for (const Term& condition : terms_[conditionSize]) {
+                    for (const Term& ifTerm : terms_[ifSize]) {
+                        for (const Term& elseTerm : terms_[elseSize]) {
+                            Block block = condition.block;
+                            block.emitIf0(ifTerm.block, elseTerm.block);
+                            add("(if0 " + condition.text + ' ' + ifTerm.text + ' ' + elseTerm.text + ')',
+                                std::move(block), size, visit);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "block.h"
+#include <boost/functional/hash.hpp>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Bottom-up enumeration of \BV programs with observational-equivalence pruning.
+//
+// Terms are built size by size from the kept terms of smaller sizes, emitting
+// their Blocks directly, and run on the inputs as they are built. A term whose
+// outputs equal those of an earlier (thus not larger) term is dropped, and so
+// is never used as a subterm either. fold is not enumerated: its body is not a
+// closed term and cannot be drawn from the kept terms.
+class Enumerator {
+public:
+    typedef std::function<void(const std::string& program, const std::vector<uint64_t>& outputs)> Visitor;
+
+    // operators are \BV names: not shl1 shr1 shr4 shr16 and or xor plus if0.
+    Enumerator(std::vector<uint64_t> inputs, const std::vector<std::string>& operators);
+
+    // Calls visit for every kept program of size at most maxSize, lambda
+    // included, smallest first.
+    void run(size_t maxSize, const Visitor& visit);
+
+private:
+    struct Term {
+        std::string text;
+        Block block;
+    };
+
+    void add(std::string text, Block block, size_t size, const Visitor& visit);
+
+    std::vector<uint64_t> inputs_;
+    std::vector<Op> unary_;
+    std::vector<Op> binary_;
+    bool if0_;
+    std::vector<std::vector<Term>> terms_;   // kept terms by size
+    std::unordered_set<std::vector<uint64_t>, boost::hash<std::vector<uint64_t>>> seen_;
+};
@@ -0,0 +1,59 @@
+#include "fingerprint.h"
+
+
+namespace {
+
+const size_t LANES = 4;
+
+const uint64_t K0 = 0x87c37b91114253d5UL;
+const uint64_t K1 = 0x4cf5ad432745937fUL;
+
+inline uint64_t rotl(uint64_t value, int shift)
+{
+    return (value << shift) | (value >> (64 - shift));
+}
+
+} // namespace
+
+
+Fingerprint fingerprint(const uint64_t* const values, size_t size)
+{
+    // Each lane keeps two halves fed with differently scrambled values, as
+    // the two halves of MurmurHash3_x64_128 are.
+    uint64_t low[LANES] = {0x243f6a8885a308d3UL, 0x13198a2e03707344UL, 0xa4093822299f31d0UL, 0x082efa98ec4e6c89UL};
+    uint64_t high[LANES] = {0x452821e638d01377UL, 0xbe5466cf34e90c6cUL, 0xc0ac29b7c97c50ddUL, 0x3f84d5b5b5470917UL};
+
+    size_t index = 0;
+    for (; index + LANES <= size; index += LANES) {
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            const uint64_t value = values[index + lane];
+            low[lane] = rotl(low[lane] ^ (rotl(value * K0, 31) * K1), 27) * 5 + 0x52dce729;
+            high[lane] = rotl(high[lane] ^ (rotl(value * K1, 33) * K0), 31) * 5 + 0x38495ab5;
+        }
+    }
+    for (size_t lane = 0; index < size; ++index, ++lane) {
+        const uint64_t value = values[index];
+        low[lane] = rotl(low[lane] ^ (rotl(value * K0, 31) * K1), 27) * 5 + 0x52dce729;
+        high[lane] = rotl(high[lane] ^ (rotl(value * K1, 33) * K0), 31) * 5 + 0x38495ab5;
+    }
+
+    // Lanes are combined in order, so permuting the values changes the result.
+    uint64_t resultLow = size;
+    uint64_t resultHigh = ~static_cast<uint64_t>(size);
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        resultLow = fmix(resultLow ^ low[lane]) + high[lane];
+        resultHigh = fmix(resultHigh ^ high[lane]) + resultLow;
+    }
+    return Fingerprint{fmix(resultLow + resultHigh), fmix(resultHigh)};
+}
+
+void appendHex(const Fingerprint& fingerprint, std::string* const out)
+{
+    static const char DIGITS[] = "0123456789abcdef";
+    char buffer[32];
+    for (int index = 0; index < 16; ++index) {
+        buffer[15 - index] = DIGITS[(fingerprint.high >> (4 * index)) & 15];
+        buffer[31 - index] = DIGITS[(fingerprint.low >> (4 * index)) & 15];
+    }
+    out->append(buffer, sizeof(buffer));
+}
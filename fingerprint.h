@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 128-bit digest of an output vector; equal vectors of different programs
+// have equal fingerprints, and distinct ones collide with probability about
+// 2^-128 instead of the 2^-64 of boost::hash_range.
+struct Fingerprint {
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(const Fingerprint& other) const { return low == other.low && high == other.high; }
+    bool operator!=(const Fingerprint& other) const { return !(*this == other); }
+    bool operator<(const Fingerprint& other) const
+    {
+        return high != other.high ? high < other.high : low < other.low;
+    }
+};
+
+struct FingerprintHash {
+    size_t operator()(const Fingerprint& fingerprint) const { return fingerprint.low ^ fingerprint.high; }
+};
+
+// MurmurHash3's finalizer: every bit of value affects every bit of the
+// result.
+inline uint64_t fmix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdUL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53UL;
+    value ^= value >> 33;
+    return value;
+}
+
+// The values are mixed in four independent lanes, so the loop has no
+// dependency chain longer than one lane and vectorizes.
+Fingerprint fingerprint(const uint64_t* values, size_t size);
+
+// 32 hexadecimal digits, high half first.
+void appendHex(const Fingerprint& fingerprint, std::string* out);
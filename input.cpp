@@ -0,0 +1,103 @@
+#include "input.h"
+#include "require.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+MappedFile::MappedFile(const std::string& path)
+  : memory_(nullptr)
+  , size_(0)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    require (fd >= 0, "MappedFile: Unable to open " + path + ".");
+
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        ::close(fd);
+        require (false, "MappedFile: Unable to stat " + path + ".");
+    }
+    size_ = static_cast<size_t>(status.st_size);
+
+    // mmap rejects empty mappings; an empty file is an empty text.
+    if (size_ > 0) {
+        memory_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    require (memory_ != MAP_FAILED, "MappedFile: Unable to map " + path + ".");
+
+    if (memory_) {
+        // Each chunk is read front to back.
+        ::madvise(memory_, size_, MADV_SEQUENTIAL);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (memory_) {
+        ::munmap(memory_, size_);
+    }
+}
+
+
+ChunkedInput::ChunkedInput(StringRef text, size_t chunkSize)
+  : begin_(text.begin())
+  , next_(0)
+{
+    require (chunkSize > 0, "ChunkedInput: Chunk size must be positive.");
+
+    const size_t size = text.size();
+    boundaries_.push_back(0);
+    while (size - boundaries_.back() > chunkSize) {
+        const char* const from = begin_ + boundaries_.back() + chunkSize;
+        const void* const newline = std::memchr(from, '\n', text.end() - from);
+        if (!newline) {
+            break;
+        }
+        boundaries_.push_back(static_cast<const char*>(newline) + 1 - begin_);
+    }
+    if (boundaries_.back() != size || boundaries_.size() == 1) {
+        boundaries_.push_back(size);
+    }
+}
+
+bool ChunkedInput::nextChunk(StringRef* const chunk)
+{
+    const size_t index = next_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= chunkCount()) {
+        return false;
+    }
+    *chunk = StringRef(begin_ + boundaries_[index], boundaries_[index + 1] - boundaries_[index]);
+    return true;
+}
+
+
+bool popProgram(StringRef* const text, StringRef* const program)
+{
+    const char* position = text->begin();
+    const char* const end = text->end();
+    while (position != end) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(position, '\n', end - position));
+        if (!lineEnd) {
+            lineEnd = end;
+        }
+        const char* const begin = static_cast<const char*>(std::memchr(position, '(', lineEnd - position));
+        position = lineEnd == end ? end : lineEnd + 1;
+
+        if (begin) {
+            const char* last = lineEnd;
+            while (last != begin && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r' ||
+                                     last[-1] == '\v' || last[-1] == '\f'))
+            {
+                --last;
+            }
+            *program = StringRef(begin, last - begin);
+            *text = StringRef(position, end - position);
+            return true;
+        }
+    }
+    *text = StringRef(end, 0);
+    return false;
+}
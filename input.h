@@ -0,0 +1,54 @@
+#pragma once
+
+#include "parser.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Read-only mapping of a whole file for the lifetime of the object.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    StringRef text() const { return StringRef(static_cast<const char*>(memory_), size_); }
+
+private:
+    void* memory_;
+    size_t size_;
+};
+
+// Program corpus split at line boundaries into chunks of about chunkSize
+// bytes. Threads claim whole chunks, so they never share a line and the
+// input needs no lock.
+class ChunkedInput {
+public:
+    static const size_t DEFAULT_CHUNK_SIZE = size_t(1) << 20;
+
+    explicit ChunkedInput(StringRef text, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+    ChunkedInput(const ChunkedInput&) = delete;
+    ChunkedInput& operator=(const ChunkedInput&) = delete;
+
+    // False once every chunk has been handed out.
+    bool nextChunk(StringRef* chunk);
+
+    size_t chunkCount() const { return boundaries_.size() - 1; }
+
+    // Position of chunk in the text.
+    size_t offsetOf(StringRef chunk) const { return chunk.data() - begin_; }
+
+private:
+    const char* const begin_;
+    std::vector<size_t> boundaries_;        // chunk N is [boundaries_[N], boundaries_[N + 1])
+    std::atomic<size_t> next_;
+};
+
+// Moves the first program of text into program and removes the lines up to
+// and including it from text. A program starts at the first '(' of its line
+// and has no trailing whitespace; lines without one are skipped. False when
+// text has no program left.
+bool popProgram(StringRef* text, StringRef* program);
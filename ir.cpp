@@ -0,0 +1,359 @@
+#include "ir.h"
+#include "require.h"
+
+
+namespace {
+
+const uint16_t NO_ALIAS = 0xffff;
+
+uint16_t slotRegister(size_t slot)
+{
+    require (IR_ARG_COUNT + slot < NO_ALIAS, "IrBlock: Stack is too deep.");
+    return static_cast<uint16_t>(IR_ARG_COUNT + slot);
+}
+
+// Emits instructions while tracking stack slots that still alias an argument:
+// LOAD_ARG costs nothing until the argument is overwritten or control flow
+// merges, and operands read the argument register directly.
+class Lowering {
+public:
+    Lowering(size_t maxDepth, std::vector<IrInstruction>* const code)
+      : aliases_(maxDepth, NO_ALIAS)
+      , code_(code)
+    { }
+
+    uint16_t read(size_t slot) const
+    {
+        return aliases_[slot] != NO_ALIAS ? aliases_[slot] : slotRegister(slot);
+    }
+
+    // Slot is about to be overwritten.
+    void define(size_t slot)
+    {
+        aliases_[slot] = NO_ALIAS;
+    }
+
+    void alias(size_t slot, uint16_t argument)
+    {
+        aliases_[slot] = argument;
+    }
+
+    void materialize(size_t slot)
+    {
+        if (aliases_[slot] != NO_ALIAS) {
+            emit(IrOp::MOV, slotRegister(slot), aliases_[slot]);
+            aliases_[slot] = NO_ALIAS;
+        }
+    }
+
+    void materializeAll(size_t depth)
+    {
+        for (size_t slot = 0; slot < depth; ++slot) {
+            materialize(slot);
+        }
+    }
+
+    void materializeArgument(uint16_t argument, size_t depth)
+    {
+        for (size_t slot = 0; slot < depth; ++slot) {
+            if (aliases_[slot] == argument) {
+                materialize(slot);
+            }
+        }
+    }
+
+    void emit(IrOp op, uint16_t dst, uint16_t a = 0, uint16_t b = 0, uint64_t imm = 0)
+    {
+        code_->push_back(IrInstruction{op, dst, a, b, imm});
+    }
+
+private:
+    std::vector<uint16_t> aliases_;
+    std::vector<IrInstruction>* const code_;
+};
+
+} // namespace
+
+
+IrBlock::IrBlock(const Block& block)
+{
+    require (block.initalStackSize() == 0, "IrBlock: Block is not runnable.");
+    require (block.stackSize() == 1, "IrBlock: Block incomplete.");
+
+    const std::vector<Op>& code = block.code();
+    const std::vector<size_t> depths = block.stackDepths();
+
+    const size_t maxDepth = block.maxStackSize();
+    std::vector<bool> targets(code.size() + 1, false);
+    for (size_t ip = 0; ip < code.size(); ip += opSize(code[ip])) {
+        if (depths[ip] == Block::NO_DEPTH) {
+            continue;
+        }
+        if (code[ip] == Op::JNZ || code[ip] == Op::JMP) {
+            targets[ip + 3 + *(const uint16_t*)&code[ip + 1]] = true;
+        } else if (code[ip] == Op::FOLD_NEXT) {
+            targets[ip - *(const uint16_t*)&code[ip + 2]] = true;
+        }
+    }
+    registerCount_ = IR_ARG_COUNT + maxDepth;
+
+    Lowering lowering(maxDepth, &code_);
+    std::vector<size_t> labels(code.size() + 1, 0);
+    std::vector<size_t> jumps;
+
+    size_t ip = 0;
+    while (ip < code.size()) {
+        const Op op = code[ip];
+        const size_t depth = depths[ip];
+        if (depth == Block::NO_DEPTH) {
+            ip += opSize(op);
+            continue;
+        }
+        if (targets[ip]) {
+            lowering.materializeAll(depth);
+        }
+        labels[ip] = code_.size();
+
+        switch (op) {
+        case Op::NOT:
+            lowering.emit(IrOp::NOT, slotRegister(depth - 1), lowering.read(depth - 1));
+            lowering.define(depth - 1);
+            break;
+
+        case Op::SHL1:
+            lowering.emit(IrOp::SHL, slotRegister(depth - 1), lowering.read(depth - 1), 0, 1);
+            lowering.define(depth - 1);
+            break;
+
+        case Op::SHR1:
+        case Op::SHR4:
+        case Op::SHR16: {
+            const uint64_t shift = op == Op::SHR1 ? 1 : op == Op::SHR4 ? 4 : 16;
+            lowering.emit(IrOp::SHR, slotRegister(depth - 1), lowering.read(depth - 1), 0, shift);
+            lowering.define(depth - 1);
+            break;
+        }
+
+        case Op::AND:
+        case Op::OR:
+        case Op::XOR:
+        case Op::PLUS: {
+            const IrOp irOp =
+                op == Op::AND ? IrOp::AND :
+                op == Op::OR ? IrOp::OR :
+                op == Op::XOR ? IrOp::XOR : IrOp::PLUS;
+            lowering.emit(irOp, slotRegister(depth - 2), lowering.read(depth - 2), lowering.read(depth - 1));
+            lowering.define(depth - 2);
+            lowering.define(depth - 1);
+            break;
+        }
+
+        case Op::UNFOLD: {
+            // Highest slot first: the lowest one overwrites the source.
+            const uint16_t source = lowering.read(depth - 1);
+            for (int index = 7; index >= 0; --index) {
+                lowering.emit(IrOp::BYTE, slotRegister(depth - 1 + index), source, 0, 56 - 8 * index);
+                lowering.define(depth - 1 + index);
+            }
+            break;
+        }
+
+        case Op::STORE_ARG0:
+        case Op::STORE_ARG1:
+        case Op::STORE_ARG2:
+        case Op::STORE_ARG3:
+        case Op::STORE_ARG4:
+        case Op::STORE_ARG5:
+        case Op::STORE_ARG6:
+        case Op::STORE_ARG7: {
+            const uint16_t argument = static_cast<int>(op) - static_cast<int>(Op::STORE_ARG0);
+            const uint16_t source = lowering.read(depth - 1);
+            lowering.define(depth - 1);
+            lowering.materializeArgument(argument, depth - 1);
+            if (source != argument) {
+                lowering.emit(IrOp::MOV, argument, source);
+            }
+            break;
+        }
+
+        case Op::LOAD_ARG0:
+        case Op::LOAD_ARG1:
+        case Op::LOAD_ARG2:
+        case Op::LOAD_ARG3:
+        case Op::LOAD_ARG4:
+        case Op::LOAD_ARG5:
+        case Op::LOAD_ARG6:
+        case Op::LOAD_ARG7:
+            lowering.alias(depth, static_cast<int>(op) - static_cast<int>(Op::LOAD_ARG0));
+            break;
+
+        case Op::LOAD_0:
+        case Op::LOAD_1:
+        case Op::LOAD_2:
+        case Op::LOAD_3:
+        case Op::LOAD_4:
+        case Op::LOAD_5:
+        case Op::LOAD_6:
+        case Op::LOAD_7:
+            lowering.emit(IrOp::CONST, slotRegister(depth), 0, 0, static_cast<int>(op) - static_cast<int>(Op::LOAD_0));
+            lowering.define(depth);
+            break;
+
+        case Op::LOAD_CONST:
+            lowering.emit(IrOp::CONST, slotRegister(depth), 0, 0, *(const uint64_t*)&code[ip + 1]);
+            lowering.define(depth);
+            break;
+
+        case Op::SHL_N:
+        case Op::SHR_N:
+            lowering.emit(op == Op::SHL_N ? IrOp::SHL : IrOp::SHR, slotRegister(depth - 1),
+                          lowering.read(depth - 1), 0, static_cast<uint64_t>(code[ip + 1]));
+            lowering.define(depth - 1);
+            break;
+
+        case Op::DROP:
+            lowering.define(depth - 1);
+            break;
+
+        case Op::JNZ: {
+            const uint16_t condition = lowering.read(depth - 1);
+            lowering.define(depth - 1);
+            lowering.materializeAll(depth - 1);
+            jumps.push_back(code_.size());
+            lowering.emit(IrOp::JNZ, 0, condition, 0, ip + 3 + *(const uint16_t*)&code[ip + 1]);
+            break;
+        }
+
+        case Op::JMP:
+            lowering.materializeAll(depth);
+            jumps.push_back(code_.size());
+            lowering.emit(IrOp::JMP, 0, 0, 0, ip + 3 + *(const uint16_t*)&code[ip + 1]);
+            break;
+
+        // The iteration counter is kept as a bit mask, 0x7f shifted right once
+        // per iteration, so that no decrement is needed.
+        case Op::FOLD_BEGIN: {
+            const uint16_t argument = static_cast<uint16_t>(code[ip + 1]);
+            lowering.materialize(depth - 2);
+            lowering.materialize(depth - 1);
+            lowering.materializeArgument(argument, depth);
+            lowering.materializeArgument(argument + 1, depth);
+            lowering.emit(IrOp::MOV, argument + 1, slotRegister(depth - 1));
+            lowering.emit(IrOp::BYTE, argument, slotRegister(depth - 2), 0, 0);
+            lowering.emit(IrOp::SHR, slotRegister(depth - 2), slotRegister(depth - 2), 0, 8);
+            lowering.emit(IrOp::CONST, slotRegister(depth - 1), 0, 0, 0x7f);
+            break;
+        }
+
+        case Op::FOLD_NEXT: {
+            const uint16_t argument = static_cast<uint16_t>(code[ip + 1]);
+            const uint16_t result = lowering.read(depth - 1);
+            const uint16_t rest = slotRegister(depth - 3);
+            const uint16_t counter = slotRegister(depth - 2);
+            lowering.define(depth - 1);
+            lowering.materializeAll(depth - 1);
+
+            const size_t next = code_.size();
+            lowering.emit(IrOp::JNZ, 0, counter);
+            lowering.emit(IrOp::MOV, rest, result);
+            jumps.push_back(code_.size());
+            lowering.emit(IrOp::JMP, 0, 0, 0, ip + 4);
+
+            code_[next].imm = code_.size();
+            lowering.emit(IrOp::MOV, argument + 1, result);
+            lowering.emit(IrOp::BYTE, argument, rest, 0, 0);
+            lowering.emit(IrOp::SHR, rest, rest, 0, 8);
+            lowering.emit(IrOp::SHR, counter, counter, 0, 1);
+            jumps.push_back(code_.size());
+            lowering.emit(IrOp::JMP, 0, 0, 0, ip - *(const uint16_t*)&code[ip + 2]);
+            lowering.define(depth - 3);
+            break;
+        }
+        }
+        ip += opSize(op);
+    }
+
+    if (depths[code.size()] != Block::NO_DEPTH) {
+        lowering.materializeAll(depths[code.size()]);
+    }
+    labels[code.size()] = code_.size();
+
+    for (size_t jump : jumps) {
+        code_[jump].imm = labels[code_[jump].imm];
+    }
+}
+
+uint64_t IrBlock::execute(std::vector<uint64_t> argv) const
+{
+    argv.resize(IR_ARG_COUNT);
+    argv.resize(registerCount_);
+    return execute(argv.data());
+}
+
+uint64_t IrBlock::execute(uint64_t* const registers) const
+{
+    const IrInstruction* const code = code_.data();
+    const size_t size = code_.size();
+
+    size_t ip = 0;
+    while (ip < size) {
+        const IrInstruction& instruction = code[ip];
+        uint64_t* const dst = &registers[instruction.dst];
+        const uint64_t a = registers[instruction.a];
+        const uint64_t b = registers[instruction.b];
+        switch (instruction.op) {
+        case IrOp::MOV:
+            *dst = a;
+            break;
+
+        case IrOp::CONST:
+            *dst = instruction.imm;
+            break;
+
+        case IrOp::NOT:
+            *dst = ~a;
+            break;
+
+        case IrOp::SHL:
+            *dst = a << instruction.imm;
+            break;
+
+        case IrOp::SHR:
+            *dst = a >> instruction.imm;
+            break;
+
+        case IrOp::AND:
+            *dst = a & b;
+            break;
+
+        case IrOp::OR:
+            *dst = a | b;
+            break;
+
+        case IrOp::XOR:
+            *dst = a ^ b;
+            break;
+
+        case IrOp::PLUS:
+            *dst = a + b;
+            break;
+
+        case IrOp::BYTE:
+            *dst = 0xff & (a >> instruction.imm);
+            break;
+
+        case IrOp::JNZ:
+            if (a != 0) {
+                ip = instruction.imm;
+                continue;
+            }
+            break;
+
+        case IrOp::JMP:
+            ip = instruction.imm;
+            continue;
+        }
+        ++ip;
+    }
+    return registers[IR_ARG_COUNT];
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "block.h"
+
+// Three-address register form of a Block.
+//
+// Registers [0, IR_ARG_COUNT) hold the arguments, register IR_ARG_COUNT + N
+// holds stack slot N of the original Block: the static stack depth assigns
+// every value its register, so no instruction pushes or pops.
+const size_t IR_ARG_COUNT = 8;
+
+enum class IrOp : uint8_t {
+    MOV,    // dst = a
+    CONST,  // dst = imm
+    NOT,    // dst = ~a
+    SHL,    // dst = a << imm
+    SHR,    // dst = a >> imm
+    AND,    // dst = a & b
+    OR,     // dst = a | b
+    XOR,    // dst = a ^ b
+    PLUS,   // dst = a + b
+    BYTE,   // dst = 0xff & (a >> imm)
+    JNZ,    // if (a != 0) goto imm
+    JMP     // goto imm
+};
+
+struct IrInstruction {
+    IrOp op;
+    uint16_t dst;
+    uint16_t a;
+    uint16_t b;
+    uint64_t imm;
+};
+
+class IrBlock {
+public:
+    // Lowers a runnable Block.
+    explicit IrBlock(const Block& block);
+
+    // Drop-in replacement for Block::execute.
+    uint64_t execute(std::vector<uint64_t> argv) const;
+
+    // registers[0..IR_ARG_COUNT) are the arguments; the array must hold
+    // registerCount() values. Returns the result register.
+    uint64_t execute(uint64_t* registers) const;
+
+    size_t registerCount() const { return registerCount_; }
+    const std::vector<IrInstruction>& code() const { return code_; }
+
+private:
+    std::vector<IrInstruction> code_;
+    size_t registerCount_;
+};
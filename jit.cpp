@@ -0,0 +1,464 @@
+#include "jit.h"
+#include "require.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define BV_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#endif
+
+
+namespace {
+
+enum Reg {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9 = 9, R10 = 10, R11 = 11
+};
+
+// Stack slot N lives in SLOT_REGS[N]; deeper slots spill into the frame.
+// All of them are caller-saved, so the generated code needs no prologue.
+const Reg SLOT_REGS[] = { RAX, RCX, RDX, RSI, R8, R9, R10 };
+const size_t SLOT_REG_COUNT = sizeof(SLOT_REGS) / sizeof(SLOT_REGS[0]);
+
+const Reg FRAME = RDI;
+const Reg SCRATCH = R11;
+
+// Either a register or a qword at [FRAME + disp].
+struct Operand {
+    bool memory;
+    Reg reg;
+    int32_t disp;
+};
+
+Operand regOperand(Reg reg)
+{
+    return Operand{false, reg, 0};
+}
+
+Operand frameOperand(size_t index)
+{
+    return Operand{true, FRAME, static_cast<int32_t>(8 * index)};
+}
+
+Operand argOperand(int n)
+{
+    return frameOperand(n);
+}
+
+Operand slotOperand(size_t slot)
+{
+    if (slot < SLOT_REG_COUNT) {
+        return regOperand(SLOT_REGS[slot]);
+    }
+    return frameOperand(8 + slot - SLOT_REG_COUNT);
+}
+
+
+class Assembler {
+public:
+    size_t size() const { return bytes_.size(); }
+    const std::vector<uint8_t>& bytes() const { return bytes_; }
+
+    // <opcode> r/m64, reg
+    void rmReg(uint8_t opcode, int reg, const Operand& rm)
+    {
+        rex(reg, rm);
+        byte(opcode);
+        modrm(reg, rm);
+    }
+
+    void movRmReg(const Operand& rm, Reg reg) { rmReg(0x89, reg, rm); }
+    void movRegRm(Reg reg, const Operand& rm) { rmReg(0x8b, reg, rm); }
+
+    void movRegImm(Reg reg, uint64_t imm)
+    {
+        if (static_cast<uint32_t>(imm) == imm) {
+            // mov r32, imm32 zero-extends into the full register.
+            if (reg >= 8) {
+                byte(0x41);
+            }
+            byte(0xb8 + (reg & 7));
+            dword(static_cast<uint32_t>(imm));
+        } else {
+            byte(0x48 | (reg >= 8 ? 1 : 0));
+            byte(0xb8 + (reg & 7));
+            qword(imm);
+        }
+    }
+
+    void notRm(const Operand& rm) { rmReg(0xf7, 2, rm); }
+
+    void shlRm(const Operand& rm, uint8_t shift)
+    {
+        if (shift == 1) {
+            rmReg(0xd1, 4, rm);
+        } else {
+            rmReg(0xc1, 4, rm);
+            byte(shift);
+        }
+    }
+
+    void shrRm(const Operand& rm, uint8_t shift)
+    {
+        if (shift == 1) {
+            rmReg(0xd1, 5, rm);
+        } else {
+            rmReg(0xc1, 5, rm);
+            byte(shift);
+        }
+    }
+
+    void andRmImm32(const Operand& rm, uint32_t imm)
+    {
+        rmReg(0x81, 4, rm);
+        dword(imm);
+    }
+
+    void testRmReg(const Operand& rm, Reg reg) { rmReg(0x85, reg, rm); }
+    void decRm(const Operand& rm) { rmReg(0xff, 1, rm); }
+
+    // Returns the position of the rel32 field to patch.
+    size_t jnz()
+    {
+        byte(0x0f);
+        byte(0x85);
+        dword(0);
+        return size() - 4;
+    }
+
+    size_t jmp()
+    {
+        byte(0xe9);
+        dword(0);
+        return size() - 4;
+    }
+
+    void ret() { byte(0xc3); }
+
+    void patchRel32(size_t position, size_t target)
+    {
+        const int64_t rel = static_cast<int64_t>(target) - static_cast<int64_t>(position + 4);
+        require (static_cast<int32_t>(rel) == rel, "NativeBlock: Jump is too far.");
+        const int32_t rel32 = static_cast<int32_t>(rel);
+        std::memcpy(&bytes_[position], &rel32, 4);
+    }
+
+private:
+    void rex(int reg, const Operand& rm)
+    {
+        byte(0x48 | ((reg & 8) ? 4 : 0) | ((rm.reg & 8) ? 1 : 0));
+    }
+
+    void modrm(int reg, const Operand& rm)
+    {
+        if (rm.memory) {
+            // [base + disp32]; FRAME is never RSP/R12, so no SIB byte is needed.
+            byte(0x80 | ((reg & 7) << 3) | (rm.reg & 7));
+            dword(static_cast<uint32_t>(rm.disp));
+        } else {
+            byte(0xc0 | ((reg & 7) << 3) | (rm.reg & 7));
+        }
+    }
+
+    void byte(uint8_t value) { bytes_.push_back(value); }
+
+    void dword(uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i) {
+            byte(value >> (8 * i));
+        }
+    }
+
+    void qword(uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i) {
+            byte(value >> (8 * i));
+        }
+    }
+
+    std::vector<uint8_t> bytes_;
+};
+
+
+// dst = value, going through SCRATCH when dst is in memory.
+void emitMove(Assembler* as, const Operand& dst, const Operand& src)
+{
+    if (!dst.memory) {
+        as->movRegRm(dst.reg, src);
+    } else if (!src.memory) {
+        as->movRmReg(dst, src.reg);
+    } else {
+        as->movRegRm(SCRATCH, src);
+        as->movRmReg(dst, SCRATCH);
+    }
+}
+
+void emitLoadImm(Assembler* as, const Operand& dst, uint64_t imm)
+{
+    if (!dst.memory) {
+        as->movRegImm(dst.reg, imm);
+    } else {
+        as->movRegImm(SCRATCH, imm);
+        as->movRmReg(dst, SCRATCH);
+    }
+}
+
+// dst <op>= src for and/or/xor/add.
+void emitBinary(Assembler* as, uint8_t opcode, const Operand& dst, const Operand& src)
+{
+    Reg srcReg = src.reg;
+    if (src.memory) {
+        as->movRegRm(SCRATCH, src);
+        srcReg = SCRATCH;
+    }
+    as->rmReg(opcode, srcReg, dst);
+}
+
+void emitTest(Assembler* as, const Operand& operand)
+{
+    if (operand.memory) {
+        as->movRegRm(SCRATCH, operand);
+        as->testRmReg(regOperand(SCRATCH), SCRATCH);
+    } else {
+        as->testRmReg(operand, operand.reg);
+    }
+}
+
+// arg[n + 1] = accumulator, arg[n] = 0xff & rest, rest >>= 8.
+void emitFoldStep(Assembler* as, int n, const Operand& rest, const Operand& accumulator)
+{
+    emitMove(as, argOperand(n + 1), accumulator);
+    as->movRegRm(SCRATCH, rest);
+    as->andRmImm32(regOperand(SCRATCH), 0xff);
+    as->movRmReg(argOperand(n), SCRATCH);
+    as->shrRm(rest, 8);
+}
+
+struct Fixup {
+    size_t position;
+    size_t target;
+};
+
+std::vector<uint8_t> compile(const Block& block, size_t* const frameSize)
+{
+    require (block.initalStackSize() == 0, "NativeBlock: Block is not runnable.");
+    require (block.stackSize() == 1, "NativeBlock: Block incomplete.");
+
+    const std::vector<Op>& code = block.code();
+    const std::vector<size_t> depths = block.stackDepths();
+
+    const size_t maxDepth = block.maxStackSize();
+    *frameSize = 8 + (maxDepth > SLOT_REG_COUNT ? maxDepth - SLOT_REG_COUNT : 0);
+
+    Assembler as;
+    std::vector<size_t> labels(code.size() + 1, 0);
+    std::vector<Fixup> fixups;
+
+    size_t ip = 0;
+    while (ip < code.size()) {
+        const Op op = code[ip];
+        const size_t depth = depths[ip];
+        labels[ip] = as.size();
+        if (depth == Block::NO_DEPTH) {
+            ip += opSize(op);
+            continue;
+        }
+
+        switch (op) {
+        case Op::NOT:
+            as.notRm(slotOperand(depth - 1));
+            break;
+
+        case Op::SHL1:
+            as.shlRm(slotOperand(depth - 1), 1);
+            break;
+
+        case Op::SHR1:
+            as.shrRm(slotOperand(depth - 1), 1);
+            break;
+
+        case Op::SHR4:
+            as.shrRm(slotOperand(depth - 1), 4);
+            break;
+
+        case Op::SHR16:
+            as.shrRm(slotOperand(depth - 1), 16);
+            break;
+
+        case Op::AND:
+            emitBinary(&as, 0x21, slotOperand(depth - 2), slotOperand(depth - 1));
+            break;
+
+        case Op::OR:
+            emitBinary(&as, 0x09, slotOperand(depth - 2), slotOperand(depth - 1));
+            break;
+
+        case Op::XOR:
+            emitBinary(&as, 0x31, slotOperand(depth - 2), slotOperand(depth - 1));
+            break;
+
+        case Op::PLUS:
+            emitBinary(&as, 0x01, slotOperand(depth - 2), slotOperand(depth - 1));
+            break;
+
+        case Op::UNFOLD:
+            as.movRegRm(SCRATCH, slotOperand(depth - 1));
+            for (int index = 0; index < 8; ++index) {
+                const Operand dst = slotOperand(depth - 1 + index);
+                const uint8_t offset = 56 - 8 * index;
+                if (dst.memory) {
+                    as.movRmReg(dst, SCRATCH);
+                } else {
+                    as.movRegRm(dst.reg, regOperand(SCRATCH));
+                }
+                if (offset != 0) {
+                    as.shrRm(dst, offset);
+                }
+                as.andRmImm32(dst, 0xff);
+            }
+            break;
+
+        case Op::STORE_ARG0:
+        case Op::STORE_ARG1:
+        case Op::STORE_ARG2:
+        case Op::STORE_ARG3:
+        case Op::STORE_ARG4:
+        case Op::STORE_ARG5:
+        case Op::STORE_ARG6:
+        case Op::STORE_ARG7:
+            emitMove(&as, argOperand(static_cast<int>(op) - static_cast<int>(Op::STORE_ARG0)),
+                     slotOperand(depth - 1));
+            break;
+
+        case Op::LOAD_ARG0:
+        case Op::LOAD_ARG1:
+        case Op::LOAD_ARG2:
+        case Op::LOAD_ARG3:
+        case Op::LOAD_ARG4:
+        case Op::LOAD_ARG5:
+        case Op::LOAD_ARG6:
+        case Op::LOAD_ARG7:
+            emitMove(&as, slotOperand(depth),
+                     argOperand(static_cast<int>(op) - static_cast<int>(Op::LOAD_ARG0)));
+            break;
+
+        case Op::LOAD_0:
+        case Op::LOAD_1:
+        case Op::LOAD_2:
+        case Op::LOAD_3:
+        case Op::LOAD_4:
+        case Op::LOAD_5:
+        case Op::LOAD_6:
+        case Op::LOAD_7:
+            emitLoadImm(&as, slotOperand(depth), static_cast<int>(op) - static_cast<int>(Op::LOAD_0));
+            break;
+
+        case Op::LOAD_CONST:
+            emitLoadImm(&as, slotOperand(depth), *(const uint64_t*)&code[ip + 1]);
+            break;
+
+        case Op::SHL_N:
+            as.shlRm(slotOperand(depth - 1), static_cast<uint8_t>(code[ip + 1]));
+            break;
+
+        case Op::SHR_N:
+            as.shrRm(slotOperand(depth - 1), static_cast<uint8_t>(code[ip + 1]));
+            break;
+
+        case Op::DROP:
+            break;
+
+        case Op::JNZ:
+            emitTest(&as, slotOperand(depth - 1));
+            fixups.push_back(Fixup{as.jnz(), ip + 3 + *(const uint16_t*)&code[ip + 1]});
+            break;
+
+        case Op::JMP:
+            fixups.push_back(Fixup{as.jmp(), ip + 3 + *(const uint16_t*)&code[ip + 1]});
+            break;
+
+        case Op::FOLD_BEGIN:
+            emitFoldStep(&as, static_cast<int>(code[ip + 1]), slotOperand(depth - 2), slotOperand(depth - 1));
+            emitLoadImm(&as, slotOperand(depth - 1), 7);
+            break;
+
+        case Op::FOLD_NEXT: {
+            // [.., rest, counter, result]
+            const Operand rest = slotOperand(depth - 3);
+            const Operand counter = slotOperand(depth - 2);
+            const Operand result = slotOperand(depth - 1);
+            emitTest(&as, counter);
+            const size_t next = as.jnz();
+            emitMove(&as, rest, result);
+            fixups.push_back(Fixup{as.jmp(), ip + 4});
+            as.patchRel32(next, as.size());
+            emitFoldStep(&as, static_cast<int>(code[ip + 1]), rest, result);
+            as.decRm(counter);
+            fixups.push_back(Fixup{as.jmp(), ip - *(const uint16_t*)&code[ip + 2]});
+            break;
+        }
+        }
+        ip += opSize(op);
+    }
+
+    // The result is in slot 0, which is RAX.
+    labels[code.size()] = as.size();
+    as.ret();
+
+    for (const auto& fixup : fixups) {
+        require (depths[fixup.target] != Block::NO_DEPTH, "NativeBlock: Bad jump target.");
+        as.patchRel32(fixup.position, labels[fixup.target]);
+    }
+    return as.bytes();
+}
+
+} // namespace
+
+
+bool NativeBlock::isSupported()
+{
+#ifdef BV_JIT_SUPPORTED
+    return true;
+#else
+    return false;
+#endif
+}
+
+NativeBlock::NativeBlock(const Block& block)
+  : memory_(nullptr)
+  , memorySize_(0)
+  , function_(nullptr)
+  , frameSize_(0)
+{
+#ifdef BV_JIT_SUPPORTED
+    const std::vector<uint8_t> bytes = compile(block, &frameSize_);
+
+    memorySize_ = bytes.size();
+    memory_ = ::mmap(nullptr, memorySize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    require (memory_ != MAP_FAILED, "NativeBlock: Unable to allocate code pages.");
+    std::memcpy(memory_, bytes.data(), bytes.size());
+    if (::mprotect(memory_, memorySize_, PROT_READ | PROT_EXEC) != 0) {
+        ::munmap(memory_, memorySize_);
+        require (false, "NativeBlock: Unable to make code pages executable.");
+    }
+    function_ = reinterpret_cast<Function>(memory_);
+#else
+    (void)block;
+    require (false, "NativeBlock: JIT is not supported on this platform.");
+#endif
+}
+
+NativeBlock::~NativeBlock()
+{
+#ifdef BV_JIT_SUPPORTED
+    ::munmap(memory_, memorySize_);
+#endif
+}
+
+uint64_t NativeBlock::execute(std::vector<uint64_t> argv) const
+{
+    argv.resize(8);
+    argv.resize(frameSize_);
+    return function_(argv.data());
+}
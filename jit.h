@@ -0,0 +1,37 @@
+#pragma once
+
+#include "block.h"
+
+// Native x86-64 translation of a runnable Block.
+//
+// Stack slots are mapped onto registers (the deepest ones spill into the frame),
+// constants become immediates and JNZ/JMP and fold loops become native
+// branches. The code lives in its own executable pages for the lifetime of
+// the object.
+class NativeBlock {
+public:
+    // False when the JIT cannot run on this platform; constructor throws then.
+    static bool isSupported();
+
+    explicit NativeBlock(const Block& block);
+    ~NativeBlock();
+
+    NativeBlock(const NativeBlock&) = delete;
+    NativeBlock& operator=(const NativeBlock&) = delete;
+
+    // Drop-in replacement for Block::execute.
+    uint64_t execute(std::vector<uint64_t> argv) const;
+
+    // frame[0..8) are the arguments (clobbered by STORE_ARG), followed by
+    // frameSize() - 8 spill slots.
+    uint64_t execute(uint64_t* frame) const { return function_(frame); }
+    size_t frameSize() const { return frameSize_; }
+
+private:
+    typedef uint64_t (*Function)(uint64_t* frame);
+
+    void* memory_;
+    size_t memorySize_;
+    Function function_;
+    size_t frameSize_;
+};
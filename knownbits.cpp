@@ -0,0 +1,270 @@
+#include "knownbits.h"
+#include "require.h"
+#include <array>
+#include <vector>
+
+
+namespace {
+
+typedef std::array<KnownBits, 8> KnownArgs;
+
+uint16_t jumpShift(const Op* code, size_t ip)
+{
+    return *(const uint16_t*)&code[ip + 1];
+}
+
+// Abstract interpretation of code[begin, end) over known bits. False when
+// the code is not structured.
+bool analyze(const Op* code, size_t begin, size_t end,
+             std::vector<KnownBits>* const stack, KnownArgs* const args)
+{
+    size_t ip = begin;
+    while (ip < end) {
+        const Op op = code[ip];
+        switch (op) {
+        case Op::NOT:
+            stack->back() = knownNot(stack->back());
+            break;
+
+        case Op::SHL1:
+            stack->back() = knownShl(stack->back(), 1);
+            break;
+
+        case Op::SHR1:
+            stack->back() = knownShr(stack->back(), 1);
+            break;
+
+        case Op::SHR4:
+            stack->back() = knownShr(stack->back(), 4);
+            break;
+
+        case Op::SHR16:
+            stack->back() = knownShr(stack->back(), 16);
+            break;
+
+        case Op::SHL_N:
+            stack->back() = knownShl(stack->back(), static_cast<int>(code[ip + 1]));
+            break;
+
+        case Op::SHR_N:
+            stack->back() = knownShr(stack->back(), static_cast<int>(code[ip + 1]));
+            break;
+
+        case Op::AND:
+        case Op::OR:
+        case Op::XOR:
+        case Op::PLUS: {
+            const KnownBits rhs = stack->back();
+            stack->pop_back();
+            KnownBits& lhs = stack->back();
+            lhs = op == Op::AND ? knownAnd(lhs, rhs) :
+                  op == Op::OR ? knownOr(lhs, rhs) :
+                  op == Op::XOR ? knownXor(lhs, rhs) : knownPlus(lhs, rhs);
+            break;
+        }
+
+        case Op::UNFOLD: {
+            const KnownBits value = stack->back();
+            stack->pop_back();
+            for (int offset = 56; offset >= 0; offset -= 8) {
+                stack->push_back(knownByte(value, offset));
+            }
+            break;
+        }
+
+        case Op::STORE_ARG0:
+        case Op::STORE_ARG1:
+        case Op::STORE_ARG2:
+        case Op::STORE_ARG3:
+        case Op::STORE_ARG4:
+        case Op::STORE_ARG5:
+        case Op::STORE_ARG6:
+        case Op::STORE_ARG7:
+            (*args)[static_cast<int>(op) - static_cast<int>(Op::STORE_ARG0)] = stack->back();
+            stack->pop_back();
+            break;
+
+        case Op::LOAD_ARG0:
+        case Op::LOAD_ARG1:
+        case Op::LOAD_ARG2:
+        case Op::LOAD_ARG3:
+        case Op::LOAD_ARG4:
+        case Op::LOAD_ARG5:
+        case Op::LOAD_ARG6:
+        case Op::LOAD_ARG7:
+            stack->push_back((*args)[static_cast<int>(op) - static_cast<int>(Op::LOAD_ARG0)]);
+            break;
+
+        case Op::LOAD_0:
+        case Op::LOAD_1:
+        case Op::LOAD_2:
+        case Op::LOAD_3:
+        case Op::LOAD_4:
+        case Op::LOAD_5:
+        case Op::LOAD_6:
+        case Op::LOAD_7:
+            stack->push_back(KnownBits::constant(static_cast<int>(op) - static_cast<int>(Op::LOAD_0)));
+            break;
+
+        case Op::LOAD_CONST:
+            stack->push_back(KnownBits::constant(*(const uint64_t*)&code[ip + 1]));
+            break;
+
+        case Op::DROP:
+            stack->pop_back();
+            break;
+
+        case Op::JNZ: {
+            const size_t ifBegin = ip + 3;
+            const size_t ifEnd = ip + jumpShift(code, ip);
+            if (ifEnd < ifBegin || ifEnd + 3 > end || code[ifEnd] != Op::JMP) {
+                return false;
+            }
+            const size_t elseBegin = ifEnd + 3;
+            const size_t elseEnd = elseBegin + jumpShift(code, ifEnd);
+            if (elseEnd > end) {
+                return false;
+            }
+
+            const KnownBits condition = stack->back();
+            stack->pop_back();
+            if (condition.isZero()) {
+                if (!analyze(code, ifBegin, ifEnd, stack, args)) {
+                    return false;
+                }
+            } else if (condition.isNonzero()) {
+                if (!analyze(code, elseBegin, elseEnd, stack, args)) {
+                    return false;
+                }
+            } else {
+                // Each branch pushes one value onto the stack it starts with.
+                std::vector<KnownBits> elseStack = *stack;
+                KnownArgs elseArgs = *args;
+                if (!analyze(code, ifBegin, ifEnd, stack, args) ||
+                    !analyze(code, elseBegin, elseEnd, &elseStack, &elseArgs))
+                {
+                    return false;
+                }
+                stack->back() = knownJoin(stack->back(), elseStack.back());
+                for (size_t n = 0; n < args->size(); ++n) {
+                    (*args)[n] = knownJoin((*args)[n], elseArgs[n]);
+                }
+            }
+            ip = elseEnd;
+            continue;
+        }
+
+        case Op::JMP:
+        case Op::FOLD_NEXT:
+            return false;
+
+        case Op::FOLD_BEGIN: {
+            const int n = static_cast<int>(code[ip + 1]);
+            const size_t bodyBegin = ip + 4;
+            const size_t bodyEnd = bodyBegin + *(const uint16_t*)&code[ip + 2];
+            if (bodyEnd + 4 > end || code[bodyEnd] != Op::FOLD_NEXT) {
+                return false;
+            }
+
+            // The loop always runs 8 times, so it is followed exactly.
+            KnownBits accumulator = stack->back();
+            stack->pop_back();
+            const KnownBits value = stack->back();
+            stack->pop_back();
+            for (int offset = 0; offset < 64; offset += 8) {
+                (*args)[n] = knownByte(value, offset);
+                (*args)[n + 1] = accumulator;
+                if (!analyze(code, bodyBegin, bodyEnd, stack, args)) {
+                    return false;
+                }
+                accumulator = stack->back();
+                stack->pop_back();
+            }
+            stack->push_back(accumulator);
+            ip = bodyEnd + opSize(Op::FOLD_NEXT);
+            continue;
+        }
+        }
+        ip += opSize(op);
+    }
+    return true;
+}
+
+} // namespace
+
+
+KnownBits knownNot(const KnownBits& value)
+{
+    return KnownBits{value.ones, value.zeros};
+}
+
+KnownBits knownShl(const KnownBits& value, int shift)
+{
+    return KnownBits{(value.zeros << shift) | ((uint64_t(1) << shift) - 1), value.ones << shift};
+}
+
+KnownBits knownShr(const KnownBits& value, int shift)
+{
+    return KnownBits{(value.zeros >> shift) | ~(~uint64_t(0) >> shift), value.ones >> shift};
+}
+
+KnownBits knownAnd(const KnownBits& lhs, const KnownBits& rhs)
+{
+    return KnownBits{lhs.zeros | rhs.zeros, lhs.ones & rhs.ones};
+}
+
+KnownBits knownOr(const KnownBits& lhs, const KnownBits& rhs)
+{
+    return KnownBits{lhs.zeros & rhs.zeros, lhs.ones | rhs.ones};
+}
+
+KnownBits knownXor(const KnownBits& lhs, const KnownBits& rhs)
+{
+    return KnownBits{(lhs.zeros & rhs.zeros) | (lhs.ones & rhs.ones),
+                     (lhs.zeros & rhs.ones) | (lhs.ones & rhs.zeros)};
+}
+
+// A bit of the sum is known where both operand bits and the carry into it
+// are. The carries are known where the sums with every unknown bit 0 and
+// with every unknown bit 1 agree on them.
+KnownBits knownPlus(const KnownBits& lhs, const KnownBits& rhs)
+{
+    const uint64_t smallest = lhs.ones + rhs.ones;
+    const uint64_t largest = ~lhs.zeros + ~rhs.zeros;
+    const uint64_t carryZeros = ~(largest ^ lhs.zeros ^ rhs.zeros);
+    const uint64_t carryOnes = smallest ^ lhs.ones ^ rhs.ones;
+    const uint64_t known = (lhs.zeros | lhs.ones) & (rhs.zeros | rhs.ones) & (carryZeros | carryOnes);
+    return KnownBits{~largest & known, smallest & known};
+}
+
+KnownBits knownByte(const KnownBits& value, int offset)
+{
+    return knownAnd(knownShr(value, offset), KnownBits::constant(0xff));
+}
+
+KnownBits knownJoin(const KnownBits& lhs, const KnownBits& rhs)
+{
+    return KnownBits{lhs.zeros & rhs.zeros, lhs.ones & rhs.ones};
+}
+
+KnownBits knownResult(const BlockRef& block, size_t argc)
+{
+    KnownArgs args;
+    for (size_t n = 0; n < args.size(); ++n) {
+        args[n] = n < argc ? KnownBits::unknown() : KnownBits::constant(0);
+    }
+    std::vector<KnownBits> stack;
+    stack.reserve(block.maxStackSize());
+    if (!analyze(block.code(), 0, block.size(), &stack, &args) || stack.size() != 1) {
+        return KnownBits::unknown();
+    }
+    return stack.back();
+}
+
+KnownBits knownResult(const Block& block, size_t argc)
+{
+    require (block.initalStackSize() == 0, "knownResult: Block is not runnable.");
+    require (block.stackSize() == 1, "knownResult: Block incomplete.");
+    return knownResult(BlockRef(block.code().data(), block.code().size(), block.maxStackSize(), BlockRef::TRUSTED),
+                       argc);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "block.h"
+#include <cstddef>
+#include <cstdint>
+
+// Bits of a value that are the same on every input: set in zeros when known
+// to be 0, in ones when known to be 1, and in neither when they depend on
+// the input.
+struct KnownBits {
+    uint64_t zeros;
+    uint64_t ones;
+
+    static KnownBits unknown() { return KnownBits{0, 0}; }
+    static KnownBits constant(uint64_t value) { return KnownBits{~value, value}; }
+
+    bool isConstant() const { return (zeros | ones) == ~uint64_t(0); }
+    // The value of a constant.
+    uint64_t value() const { return ones; }
+    bool isZero() const { return zeros == ~uint64_t(0); }
+    bool isNonzero() const { return ones != 0; }
+
+    bool operator==(const KnownBits& rhs) const { return zeros == rhs.zeros && ones == rhs.ones; }
+    bool operator!=(const KnownBits& rhs) const { return !(*this == rhs); }
+};
+
+KnownBits knownNot(const KnownBits& value);
+KnownBits knownShl(const KnownBits& value, int shift);
+KnownBits knownShr(const KnownBits& value, int shift);
+KnownBits knownAnd(const KnownBits& lhs, const KnownBits& rhs);
+KnownBits knownOr(const KnownBits& lhs, const KnownBits& rhs);
+KnownBits knownXor(const KnownBits& lhs, const KnownBits& rhs);
+KnownBits knownPlus(const KnownBits& lhs, const KnownBits& rhs);
+// 0xff & (value >> offset), as pushed by UNFOLD and fold.
+KnownBits knownByte(const KnownBits& value, int offset);
+// What holds for a value that is either lhs or rhs.
+KnownBits knownJoin(const KnownBits& lhs, const KnownBits& rhs);
+
+// Known bits of the result of block run as by execute(argv, argc, ...):
+// argc unknown arguments, the rest zero. Follows both branches of an if0
+// unless its condition is known, and every iteration of a fold. Blocks whose
+// jumps do not have the shape emitted by emitIf0 give unknown().
+KnownBits knownResult(const BlockRef& block, size_t argc);
+KnownBits knownResult(const Block& block, size_t argc);
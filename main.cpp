@@ -1,435 +1,485 @@
 #include "block.h"
+#include "classes.h"
+#include "corpus.h"
+#include "enumerator.h"
+#include "fingerprint.h"
+#include "input.h"
+#include "ir.h"
+#include "jit.h"
+#include "knownbits.h"
+#include "memo.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "refine.h"
+#include "results.h"
+#include "sliced.h"
+#include "stats.h"
+#include "store.h"
+#include "target.h"
+#include "threaded.h"
 #include "test_block.h"
-#include <perfmon.h>
+#include "test_classes.h"
+#include "test_corpus.h"
+#include "test_enumerator.h"
+#include "test_fingerprint.h"
+#include "test_input.h"
+#include "test_ir.h"
+#include "test_jit.h"
+#include "test_knownbits.h"
+#include "test_memo.h"
+#include "test_optimizer.h"
+#include "test_parser.h"
+#include "test_pipeline.h"
+#include "test_refine.h"
+#include "test_sliced.h"
+#include "test_stats.h"
+#include "test_store.h"
+#include "test_target.h"
+#include "test_threaded.h"
+#include <algorithm>
 #include <cctype>
+#include <fstream>
 #include <iostream>
-#include <set>
 #include <map>
 #include <sstream>
+#include <unistd.h>
 
 
-bool nextToken(std::streambuf* const istreambuf, std::string* token)
-{
-    int character = istreambuf->sgetc();
-    while (character != EOF && ::isspace(character)) {
-        character = istreambuf->snextc();
-    }
-    if (character == EOF) {
-        return false;
-    }
-    if (character != '(' && character != ')' && character != '_' && !::isalnum(character)) {
-        return false;
-    }
-
-    if (character == '(') {
-        token->assign(1, '(');
-        istreambuf->snextc();
-
-    } else if (character == ')') {
-        token->assign(1, ')');
-        istreambuf->snextc();
-
-    } else {
-        token->clear();
-        do {
-            token->append(1, character);
-            character = istreambuf->snextc();
-        } while (character != EOF && (::isalnum(character) || character == '_'));
-    }
-    return true;
-}
-
-
-bool toInteger(const std::string& input, uint64_t* result)
-{
-    char* endptr = nullptr;
-    *result = strtoull(input.c_str(), &endptr, 0);
-    return endptr && *endptr == '\0';
-}
-
-
-typedef std::map<std::string, int> Variables;
-
-bool isIdentifier(const std::string& token)
-{
-    static const std::set<std::string> KEYWORD = {
-        "not", "shl1", "shr1", "shr4", "shr16",
-        "and", "or", "xor", "plus",
-        "if0",
-        "lambda",
-        "fold",
-        "(", ")"
-    };
-    return !::isdigit(static_cast<unsigned char>(token.at(0))) && KEYWORD.count(token) == 0;
-}
+#include <boost/functional/hash.hpp>
+#include <memory>
 
-bool readBlock(std::streambuf* const istreambuf, const Variables& variables, Block* const block)
+std::string nextProgram()
 {
-    std::string token;
-    if (!nextToken(istreambuf, &token)) {
-        return false;
-    }
-
-    const auto it = variables.find(token);
-    if (it != variables.end()) {
-        block->emitLoadArg(it->second);
-        return true;
-    }
-
-    uint64_t c;
-    if (toInteger(token, &c)) {
-        block->emitLoadConst(c);
-        return true;
-    }
-
-    if (token != "(" || !nextToken(istreambuf, &token)) {
-        return false;
-    }
-
-
-#define OP1(name, emit)                                                 \
-    if (token == name) {                                                \
-        if (readBlock(istreambuf, variables, block) &&                  \
-            nextToken(istreambuf, &token) && token == ")")              \
-        {                                                               \
-            block-> emit ();                                            \
-            return true;                                                \
-        }                                                               \
-        return false;                                                   \
-    }
-
-#define OP2(name, emit)                                                 \
-    if (token == name) {                                                \
-        if (readBlock(istreambuf, variables, block) &&                  \
-            readBlock(istreambuf, variables, block) &&                  \
-            nextToken(istreambuf, &token) && token == ")")              \
-        {                                                               \
-            block-> emit ();                                            \
-            return true;                                                \
-        }                                                               \
-        return false;                                                   \
-    }
-
-    OP1("not", emitNot);
-    OP1("shl1", emitShl1);
-    OP1("shr1", emitShr1);
-    OP1("shr4", emitShr4);
-    OP1("shr16", emitShr16);
-
-    OP2("and", emitAnd);
-    OP2("or", emitOr);
-    OP2("xor", emitXor);
-    OP2("plus", emitPlus);
-
-#undef OP2
-#undef OP1
-
-    if (token == "if0") {
-        Block ifBlock(0), elseBlock(0);
-        if (readBlock(istreambuf, variables, block) &&
-            readBlock(istreambuf, variables, &ifBlock) &&
-            readBlock(istreambuf, variables, &elseBlock) &&
-            nextToken(istreambuf, &token) && token == ")")
-        {
-            block->emitIf0(ifBlock, elseBlock);
-            return true;
+    for (std::string line; std::getline(std::cin, line); ) {
+        line = line.substr(line.find('(')); // drop everything before the program
+        while (!line.empty() && ::isspace(static_cast<unsigned char>(line.back()))) {
+            line.resize(line.size() - 1);
+        }
+        if (!line.empty()) {
+            return line;
         }
-        return false;
     }
+    return {};
+}
 
-    if (token == "fold") {
-        // "(fold integer accumulator (lambda (x y) block)"
-        //   lambda (x y) ...
-        // x8 x7 x6 x5 x4 x3 x2 x1 accumulator $storeArg2 $storeArg3 $block ...
-        //
+enum class Backend {
+    SCALAR,
+    THREADED,
+    BATCH,
+    IR,
+    JIT,
+    SLICED
+};
+
+struct Options {
+    bool opcode_stats;
+    bool optimize;
+    bool memoize;
+    bool classes;
+    size_t refine_round;                    // inputs in the first round of --refine; 0 without
+    bool dedupe;                            // evaluate one of the programs with equal canonical hashes
+    bool wide_hash;                         // 128-bit fingerprints instead of boost::hash_range
+    bool binary_output;                     // ResultRecords instead of text
+    Backend backend;
+    std::vector<uint64_t> input_values;
+    std::vector<uint64_t> target_outputs;   // reports only the programs computing these, if any
+    std::shared_ptr<const SlicedInputs> sliced_inputs;  // input_values, transposed once for --backend=sliced
+    size_t enumerate_size;                  // 0 reads programs from input_file
+    std::string input_file;                 // empty reads programs from stdin
+    std::string corpus_file;                // evaluates a saved corpus instead
+    std::string write_corpus_file;          // saves the programs instead of evaluating them
+    std::string store_file;                 // empty keeps no outputs for the next run
+    size_t threads;                         // eval workers
+    bool pin;                               // bind each worker to a CPU
+    bool ordered;                           // write the results in input order
+    bool stats;                             // collect and dump instrumentation
+    std::string stats_file;                 // empty dumps to stderr
+    std::vector<std::string> enumerate_operators;
+};
+
+void evaluate(const Block& block, const Options& options, ExecutionContext* context,
+              std::vector<uint64_t>* output_values)
+{
+    const auto& input_values = options.input_values;
+    output_values->resize(input_values.size());
 
-        if (!readBlock(istreambuf, variables, block)) {
-            return false;
+    switch (options.backend) {
+    case Backend::SCALAR:
+        for (size_t index = 0; index < input_values.size(); ++index) {
+            (*output_values)[index] = block.execute(&input_values[index], 1, context);
         }
-        block->emitUnfold();
-        if (!readBlock(istreambuf, variables, block)) {
-            return false;
+        break;
+
+    case Backend::THREADED: {
+        const ThreadedBlock threaded(block);
+        uint64_t* const stack = context->stack(threaded.stackCapacity());
+        for (size_t index = 0; index < input_values.size(); ++index) {
+            uint64_t* const args = context->args(&input_values[index], 1);
+            (*output_values)[index] = threaded.execute(args, stack);
         }
+        break;
+    }
 
-        std::string leftArg, rightArg;
-        if (!nextToken(istreambuf, &token) || token != "(" ||
-            !nextToken(istreambuf, &token) || token != "lambda" ||
-            !nextToken(istreambuf, &token) || token != "(" ||
-            !nextToken(istreambuf, &leftArg) || !isIdentifier(leftArg) ||
-            !nextToken(istreambuf, &rightArg) || !isIdentifier(rightArg) ||
-            !nextToken(istreambuf, &token) || token != ")" ||
-            leftArg == rightArg)
-        {
-            return false;
-        }
-
-        auto foldVariables = variables;
-        const int leftArgN = foldVariables.size();
-        foldVariables[leftArg] = leftArgN;
-        foldVariables[rightArg] = leftArgN + 1;
-
-        Block foldBlock(0);
-        if (!readBlock(istreambuf, foldVariables, &foldBlock)) {
-            return false;
+    case Backend::BATCH:
+        block.executeBatch(input_values.data(), input_values.size(), output_values->data());
+        break;
+
+    case Backend::SLICED:
+        executeSliced(block, *options.sliced_inputs, output_values->data());
+        break;
+
+    case Backend::IR: {
+        const IrBlock ir(block);
+        std::vector<uint64_t> registers(ir.registerCount());
+        for (size_t index = 0; index < input_values.size(); ++index) {
+            std::fill(registers.begin(), registers.begin() + IR_ARG_COUNT, 0);
+            registers[0] = input_values[index];
+            (*output_values)[index] = ir.execute(registers.data());
         }
-        for (int index = 0; index < 8; ++index) {
-            block->emitStoreArg(leftArgN + 1);
-            block->emitStoreArg(leftArgN);
-            block->emitBlock(foldBlock);
-        }
-        return (nextToken(istreambuf, &token) && token == ")" &&
-                nextToken(istreambuf, &token) && token == ")");
+        break;
     }
 
-    return false;
-}
-
-bool readLambda(std::streambuf* const istreambuf, Block* block)
-{
-    std::string token;
-    if (!nextToken(istreambuf, &token) || token != "(" ||
-        !nextToken(istreambuf, &token) || token != "lambda" ||
-        !nextToken(istreambuf, &token) || token != "(")
-    {
-        return false;
+    case Backend::JIT: {
+        const NativeBlock native(block);
+        std::vector<uint64_t> frame(native.frameSize());
+        for (size_t index = 0; index < input_values.size(); ++index) {
+            std::fill(frame.begin(), frame.begin() + 8, 0);
+            frame[0] = input_values[index];
+            (*output_values)[index] = native.execute(frame.data());
+        }
+        break;
     }
-
-    Variables variables;
-    while (nextToken(istreambuf, &token) && isIdentifier(token)) {
-        const int v = variables.size();
-        variables[token] = v;
     }
-
-    return
-        token == ")" &&
-        readBlock(istreambuf, variables, block) &&
-        nextToken(istreambuf, &token) && token == ")";
 }
 
-Block parseLambda(const std::string& expression)
+// The backends that run a BlockRef in place.
+bool runsInPlace(Backend backend)
 {
-    PERFMON_FUNCTION_SCOPE;
-    Block result(0);
-    std::stringbuf istreambuf(expression);
-    std::string tmp;
-    require (readLambda(&istreambuf, &result) && !nextToken(&istreambuf, &tmp), "Unabled to parse lambda expression.");
-
-    return result;
+    return backend == Backend::SCALAR || backend == Backend::BATCH || backend == Backend::SLICED;
 }
 
-void test_read_not()
+void evaluate(const BlockRef& block, const Options& options, ExecutionContext* context,
+              std::vector<uint64_t>* output_values)
 {
-    const auto block = parseLambda("(lambda (x) (not x))");
-    require (block.execute({0x0000000000000000UL}) == 0xffffffffffffffffUL &&
-             block.execute({0xffffffffffffffffUL}) == 0x0000000000000000UL,
-             "READ_NOT is broken");
-}
+    const auto& input_values = options.input_values;
+    output_values->resize(input_values.size());
 
-void test_read_shl1()
-{
-    const auto block = parseLambda("(lambda (x) (shl1 x))");
-    require (block.execute({0x0000000000000000UL}) == 0x0000000000000000UL &&
-             block.execute({0xffffffffffffffffUL}) == 0xfffffffffffffffeUL,
-             "READ_SHL1 is broken");
-}
-
-void test_read_shr1()
-{
-    const auto block = parseLambda("(lambda (x) (shr1 x))");
-    require (block.execute({0x0000000000000000UL}) == 0x0000000000000000UL &&
-             block.execute({0xffffffffffffffffUL}) == 0x7fffffffffffffffUL,
-             "READ_SHR1 is broken");
+    require (runsInPlace(options.backend), "evaluate: Backend needs a Block.");
+    if (options.backend == Backend::SCALAR) {
+        for (size_t index = 0; index < input_values.size(); ++index) {
+            (*output_values)[index] = block.execute(&input_values[index], 1, context);
+        }
+    } else if (options.backend == Backend::SLICED) {
+        executeSliced(block, *options.sliced_inputs, output_values->data());
+    } else {
+        block.executeBatch(input_values.data(), input_values.size(), output_values->data());
+    }
 }
 
-void test_read_shr4()
+// Fills in the outputs of a block that is constant on the inputs without
+// running it.
+template <class Code>
+bool evaluateConstant(const Code& block, const Options& options, std::vector<uint64_t>* output_values)
 {
-    const auto block = parseLambda("(lambda (x) (shr4 x))");
-    require (block.execute({0x0000000000000000UL}) == 0x0000000000000000UL &&
-             block.execute({0xffffffffffffffffUL}) == 0x0fffffffffffffffUL,
-             "READ_SHR4 is broken");
+    const KnownBits bits = knownResult(block, 1);
+    if (!bits.isConstant()) {
+        return false;
+    }
+    output_values->assign(options.input_values.size(), bits.value());
+    addStat(StatsCounter::CONSTANT_PROGRAMS);
+    return true;
 }
 
-void test_read_shr16()
+// Sets up options->sliced_inputs for its input values.
+void transposeInputs(Options* const options)
 {
-    const auto block = parseLambda("(lambda (x) (shr16 x))");
-    require (block.execute({0x0000000000000000UL}) == 0x0000000000000000UL &&
-             block.execute({0xffffffffffffffffUL}) == 0x0000ffffffffffffUL,
-             "READ_SHR16 is broken");
+    if (options->backend == Backend::SLICED) {
+        const uint64_t* const column = options->input_values.data();
+        options->sliced_inputs = std::make_shared<SlicedInputs>(&column, 1, options->input_values.size());
+    }
 }
 
-void test_read_and()
-{
-    const auto block = parseLambda("(lambda (x y) (and x y))");
-    require (block.execute({0x0000000000000000UL, 0x0000000000000000UL}) == 0x0000000000000000UL &&
-             block.execute({0x0000000000000000UL, 0xffffffffffffffffUL}) == 0x0000000000000000UL &&
-             block.execute({0xffffffffffffffffUL, 0x0000000000000000UL}) == 0x0000000000000000UL &&
-             block.execute({0xffffffffffffffffUL, 0xffffffffffffffffUL}) == 0xffffffffffffffffUL,
-             "READ_AND is broken");
-}
+// --store: the outputs saved by the previous run, and those of this one.
+struct StoreState {
+    std::unique_ptr<ResultStore> saved;     // null on the first run
+    std::vector<size_t> columns;            // of each input in saved
+    Options missing;                        // evaluates only the inputs saved lacks
+    std::unique_ptr<ResultStoreWriter> writer;
+};
 
-void test_read_or()
+std::unique_ptr<StoreState> openStore(const Options& options)
 {
-    const auto block = parseLambda("(lambda (x y) (or x y))");
-    require (block.execute({0x0000000000000000UL, 0x0000000000000000UL}) == 0x0000000000000000UL &&
-             block.execute({0x0000000000000000UL, 0xffffffffffffffffUL}) == 0xffffffffffffffffUL &&
-             block.execute({0xffffffffffffffffUL, 0x0000000000000000UL}) == 0xffffffffffffffffUL &&
-             block.execute({0xffffffffffffffffUL, 0xffffffffffffffffUL}) == 0xffffffffffffffffUL,
-             "READ_OR is broken");
+    std::unique_ptr<StoreState> result(new StoreState());
+    result->missing = options;
+    if (::access(options.store_file.c_str(), F_OK) == 0) {
+        result->saved.reset(new ResultStore(options.store_file));
+        result->columns = result->saved->columnsOf(options.input_values);
+        result->missing.input_values.clear();
+        for (size_t index = 0; index < options.input_values.size(); ++index) {
+            if (result->columns[index] == ResultStore::MISSING) {
+                result->missing.input_values.push_back(options.input_values[index]);
+            }
+        }
+        transposeInputs(&result->missing);
+    }
+    result->writer.reset(new ResultStoreWriter(options.store_file, options.input_values));
+    return result;
 }
 
-void test_read_xor()
-{
-    const auto block = parseLambda("(lambda (x y) (xor x y))");
-    require (block.execute({0x0000000000000000UL, 0x0000000000000000UL}) == 0x0000000000000000UL &&
-             block.execute({0x0000000000000000UL, 0xffffffffffffffffUL}) == 0xffffffffffffffffUL &&
-             block.execute({0xffffffffffffffffUL, 0x0000000000000000UL}) == 0xffffffffffffffffUL &&
-             block.execute({0xffffffffffffffffUL, 0xffffffffffffffffUL}) == 0x0000000000000000UL,
-             "READ_XOR is broken");
-}
+// Upper bounds for the output vectors kept by --memoize and for its terms,
+// which take about 128 bytes each.
+const size_t MEMOIZE_BYTES = size_t(1) << 30;
+const size_t MEMOIZE_TERMS = size_t(1) << 22;
 
+// Inputs in the first round of --refine without =N: as many as the batch
+// interpreter runs at once, which most classes of test.in need no more than.
+const size_t REFINE_ROUND = 32;
 
-void test_read_plus()
+void appendDecimal(uint64_t value, std::string* const output)
 {
-    const auto block = parseLambda("(lambda (x y) (plus x y))");
-    require (block.execute({0x1111111111111111UL, 0x1111111111111111UL}) == 0x2222222222222222UL &&
-             block.execute({0x2222222222222222UL, 0x2222222222222222UL}) == 0x4444444444444444UL &&
-             block.execute({0x4444444444444444UL, 0x4444444444444444UL}) == 0x8888888888888888UL &&
-             block.execute({0x8888888888888888UL, 0x8888888888888888UL}) == 0x1111111111111110UL &&
-             block.execute({0xffffffffffffffffUL, 0x0000000000000001UL}) == 0x0000000000000000UL,
-             "READ_PLUS is broken");
+    char buffer[20];
+    char* digit = buffer + sizeof(buffer);
+    do {
+        *--digit = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    output->append(digit, buffer + sizeof(buffer));
 }
 
-void test_read_loadarg()
+// Narrow hashes are boost::hash_range of the outputs, or the output itself
+// when there is one; only their low half is set.
+Fingerprint hashOutputs(const std::vector<uint64_t>& outputs, bool wide)
 {
-    const Variables variables = {
-        {"(lambda (x y z) x)", 0},
-        {"(lambda (x y z) y)", 1},
-        {"(lambda (x y z) z)", 2},
-    };
-    for (const auto& var : variables) {
-        const auto block = parseLambda(var.first);
-        require (block.execute({0, 1, 2}) == static_cast<uint64_t>(var.second), "READ_ARG is broken");
+    if (wide) {
+        return fingerprint(outputs.data(), outputs.size());
     }
+    const uint64_t hash = outputs.size() == 1 ? outputs.front() : boost::hash_range(outputs.begin(), outputs.end());
+    return Fingerprint{hash, 0};
 }
 
-void test_read_c()
+void appendHash(const Fingerprint& hash, bool wide, std::string* const output)
 {
-    for (uint64_t i = 0; i < 10; ++i) {
-        std::ostringstream buf;
-        buf << "(lambda () " << i << ")";
-        const auto block = parseLambda(buf.str());
-        require (block.execute({}) == i, "READ_CONST is broken");
+    if (wide) {
+        appendHex(hash, output);
+    } else {
+        appendDecimal(hash.low, output);
     }
 }
 
-void test_read_if0()
+void appendResult(const Fingerprint& hash, bool wide, StringRef program, std::string* const output)
 {
-    const auto block = parseLambda("(lambda (x) (and 0xffffffff87654321 (if0 x 0xf0f0f0f0f0f0f0f0 0x0f0f0f0f0f0f0f0f)))");
-    require (block.execute({0}) == 0xf0f0f0f080604020 &&
-             block.execute({1}) == 0x0f0f0f0f07050301,
-             "READ_IF0 is broken");
+    appendHash(hash, wide, output);
+    output->push_back('\t');
+    output->append(program.data(), program.size());
+    output->push_back('\n');
 }
 
-void test_read_fold()
+void appendRecord(const Fingerprint& hash, uint64_t offset, StringRef program, std::string* const output)
 {
+    const ResultRecord record = {hash.low, hash.high, offset, program.size()};
+    output->append(reinterpret_cast<const char*>(&record), sizeof(record));
+}
+
+// Per-thread state of the pipeline's workers; cache is null unless --memoize
+// is given, classes unless --classes is, store unless --store is,
+// canonical unless --dedupe is and the programs are read as text, and target
+// unless --target is.
+class ProgramProcessor {
+public:
+    ProgramProcessor(const Options& options, TermCache* const cache, ClassTable* const classes,
+                     StoreState* const store, CanonicalTable* const canonical, Target* const target)
+      : options_(options)
+      , cache_(cache)
+      , classes_(classes)
+      , store_(store)
+      , shard_(store ? store->writer->shard() : nullptr)
+      , canonical_(canonical)
+      , matcher_(target ? new TargetMatcher(target) : nullptr)
+    { }
+
+    void operator()(StringRef program, uint64_t offset, std::string* const output, std::string* const errors)
     {
-        const auto block = parseLambda(
-                    "(lambda (x)"
-                    "  (fold x 0"
-                    "    (lambda (x y)"
-                    "      (or x"
-                    "        (shl1"
-                    "          (shl1"
-                    "            (shl1"
-                    "              (shl1 y)"
-                    "            )"
-                    "          )"
-                    "        )"
-                    "      )"
-                    "    )"
-                    "  )"
-                    ")");
-        require (block.execute({0x0706050403020100UL}) == 0x01234567, "READ_FOLD is broken");
+        Block block(0);
+        try {
+            block = canonical_ ? parseLambda(program, &canonical_hash_) : parseLambda(program);
+        } catch (const std::exception& ex) {
+            addStat(StatsCounter::PARSE_ERRORS);
+            errors->append("Unable to parse: ");
+            errors->append(program.data(), program.size());
+            errors->push_back('\n');
+            return;
+        }
+        Fingerprint hash;
+        if (canonical_ && canonical_->find(canonical_hash_, &hash)) {
+            ScopedTimer timer(StatsTimer::OUTPUT);
+            addStat(StatsCounter::DUPLICATE_PROGRAMS);
+            emit(hash, program, offset, output);
+            return;
+        }
+        if (matcher_) {
+            match(block, program, offset, output);
+            return;
+        }
+        evaluateBlock(&block);
+        report(program, offset, output);
     }
+
+    // Runs the code of the corpus in place, unless the backend or the
+    // options need a Block.
+    void operator()(const Corpus& corpus, size_t index, std::string* const output, std::string* const errors)
     {
-        const auto block = parseLambda(
-                    "(lambda (x)"
-                    "  (fold x 0"
-                    "    (lambda (x y)"
-                    "      (if0 x (plus 1 y) y)"
-                    "    )"
-                    "  )"
-                    ")");
-        require (block.execute({0x0101010101010101UL}) == 0, "READ_FOLD is broken");
-        require (block.execute({0x0100010001000100UL}) == 4, "READ_FOLD is broken");
-        require (block.execute({0x0100010001000100UL}) == 4, "READ_FOLD is broken");
-        require (block.execute({0x0000000000000000UL}) == 8, "READ_FOLD is broken");
+        const bool inPlace = !options_.optimize && !cache_ && runsInPlace(options_.backend);
+        Block block(0);
+        try {
+            const BlockRef code = corpus.block(index);
+            if (matcher_) {
+                match(code, corpus.program(index), corpus.programOffset(index), output);
+                return;
+            }
+            if (inPlace) {
+                evaluateInPlace(code);
+            } else {
+                block.emitCode(code.code(), code.size());
+            }
+        } catch (const std::exception& ex) {
+            errors->append("Invalid corpus entry: ");
+            appendDecimal(index, errors);
+            errors->push_back('\n');
+            return;
+        }
+        if (!inPlace) {
+            evaluateBlock(&block);
+        }
+        report(corpus.program(index), corpus.programOffset(index), output);
     }
-}
 
+private:
+    // Reports code only if it computes the outputs of --target, which it
+    // runs on as few inputs as it takes to tell.
+    template <class Code>
+    void match(const Code& code, StringRef program, uint64_t offset, std::string* const output)
+    {
+        {
+            ScopedTimer timer(StatsTimer::EVAL);
+            if (!matcher_->matches(code, &context_)) {
+                addStat(StatsCounter::REJECTED_PROGRAMS);
+                return;
+            }
+        }
+        output_values_ = options_.target_outputs;
+        report(program, offset, output);
+    }
 
-inline void test_read_block()
-{
-    using namespace internal;
-    try {
-        test_read_not();
-        test_read_shl1();
-        test_read_shr1();
-        test_read_shr4();
-        test_read_shr16();
-        test_read_and();
-        test_read_or();
-        test_read_xor();
-        test_read_plus();
-        test_read_loadarg();
-        test_read_c();
-        test_read_if0();
-        test_read_fold();
-
-    } catch(const std::exception& ex) {
-        std::cerr << "Exception: " << ex.what() << std::endl;
-        std::exit(-1);
+    void evaluateInPlace(const BlockRef& code)
+    {
+        const Fingerprint key = store_ ? programKey(code.code(), code.size()) : Fingerprint{0, 0};
+        if (!store_ || !evaluateSaved(key, code)) {
+            ScopedTimer timer(StatsTimer::EVAL);
+            if (!evaluateConstant(code, options_, &output_values_)) {
+                evaluate(code, options_, &context_, &output_values_);
+            }
+        }
+        save(key);
     }
-}
 
+    void evaluateBlock(Block* const block)
+    {
+        // Keyed by the code before --optimize, which the next run parses again.
+        const Fingerprint key = store_ ? programKey(block->code().data(), block->code().size()) : Fingerprint{0, 0};
+        if (options_.optimize) {
+            *block = optimize(*block);
+        }
 
-#include <boost/functional/hash.hpp>
-#include <mutex>
-#include <thread>
+        if (!store_ || !evaluateSaved(key, *block)) {
+            ScopedTimer timer(StatsTimer::EVAL);
+            if (!evaluateConstant(*block, options_, &output_values_)) {
+                if (cache_) {
+                    cache_->evaluate(*block, &output_values_);
+                } else {
+                    evaluate(*block, options_, &context_, &output_values_);
+                }
+            }
+        }
+        save(key);
+    }
 
-std::mutex g_io_mutex;
+    // Fills output_values_ with the outputs the previous run saved for key,
+    // evaluating code only on the inputs added since; false when it saved
+    // none.
+    template <class Code>
+    bool evaluateSaved(const Fingerprint& key, const Code& code)
+    {
+        const uint64_t* const saved = store_->saved ? store_->saved->find(key) : nullptr;
+        if (!saved) {
+            return false;
+        }
+        addStat(StatsCounter::STORED_PROGRAMS);
+        missing_values_.clear();
+        if (!store_->missing.input_values.empty()) {
+            ScopedTimer timer(StatsTimer::EVAL);
+            if (!evaluateConstant(code, store_->missing, &missing_values_)) {
+                evaluate(code, store_->missing, &context_, &missing_values_);
+            }
+        }
 
-std::string nextProgram()
-{
-    PERFMON_FUNCTION_SCOPE;
-    std::lock_guard<std::mutex> lock(g_io_mutex);
-    for (std::string line; std::getline(std::cin, line); ) {
-        line = line.substr(line.find('(')); // drop everything before the program
-        while (!line.empty() && ::isspace(static_cast<unsigned char>(line.back()))) {
-            line.resize(line.size() - 1);
+        const std::vector<size_t>& columns = store_->columns;
+        output_values_.resize(columns.size());
+        auto missing = missing_values_.begin();
+        for (size_t index = 0; index < columns.size(); ++index) {
+            output_values_[index] = columns[index] == ResultStore::MISSING ? *missing++ : saved[columns[index]];
         }
-        if (!line.empty()) {
-            return line;
+        return true;
+    }
+
+    void save(const Fingerprint& key)
+    {
+        if (shard_) {
+            shard_->add(key, output_values_.data());
         }
     }
-    return {};
-}
 
-void putResult(uint64_t hash, const std::string& program)
-{
-    PERFMON_FUNCTION_SCOPE;
-    std::lock_guard<std::mutex> lock(g_io_mutex);
-    std::cout << hash << '\t' << program << '\n';
-}
+    void report(StringRef program, uint64_t offset, std::string* const output)
+    {
+        ScopedTimer timer(StatsTimer::OUTPUT);
+        const Fingerprint hash = hashOutputs(output_values_, options_.wide_hash);
+        if (canonical_) {
+            canonical_->add(canonical_hash_, hash);
+        }
+        emit(hash, program, offset, output);
+    }
 
-void threadMain(const std::vector<uint64_t>& input_values)
-{
-    for (;;) {
-        const std::string program = nextProgram();
-        if (program.empty()) {
-            break;
+    void emit(const Fingerprint& hash, StringRef program, uint64_t offset, std::string* const output)
+    {
+        addStat(StatsCounter::PROGRAMS);
+        if (classes_) {
+            classes_->add(hash, program);
+        } else if (options_.binary_output) {
+            appendRecord(hash, offset, program, output);
+        } else {
+            appendResult(hash, options_.wide_hash, program, output);
         }
+    }
 
+    const Options& options_;
+    TermCache* const cache_;
+    ClassTable* const classes_;
+    StoreState* const store_;
+    ResultStoreWriter::Shard* const shard_; // of store_->writer, for this thread
+    CanonicalTable* const canonical_;
+    Fingerprint canonical_hash_;            // of the program being evaluated
+    const std::unique_ptr<TargetMatcher> matcher_;
+    ExecutionContext context_;
+    std::vector<uint64_t> output_values_;
+    std::vector<uint64_t> missing_values_;  // of the inputs the store lacks
+};
+
+// Prints the most frequent opcodes, opcode pairs and triples of the programs
+// on stdin; used to pick the superinstructions of ThreadedBlock.
+void printOpcodeStats()
+{
+    std::map<std::vector<Op>, uint64_t> counts[3];
+    for (std::string program; !(program = nextProgram()).empty(); ) {
         Block block(0);
         try {
             block = parseLambda(program);
@@ -437,79 +487,453 @@ void threadMain(const std::vector<uint64_t>& input_values)
             std::cerr << "Unable to parse: " << program << '\n';
             continue;
         }
-
-        std::vector<uint64_t> output_values;
-        PERFMON_STATEMENT("eval")
-        for (uint64_t value : input_values) {
-            output_values.push_back(block.execute({value}));
+        std::vector<Op> ops;
+        for (size_t ip = 0; ip < block.code().size(); ip += opSize(block.code()[ip])) {
+            ops.push_back(block.code()[ip]);
+        }
+        for (size_t index = 0; index < ops.size(); ++index) {
+            for (size_t length = 1; length <= 3 && index + length <= ops.size(); ++length) {
+                ++counts[length - 1][std::vector<Op>(ops.begin() + index, ops.begin() + index + length)];
+            }
         }
+    }
 
-        if (output_values.size() == 1) {
-            putResult(output_values.front(), program);
-        } else {
-            putResult(boost::hash_range(output_values.begin(), output_values.end()), program);
+    for (const auto& count : counts) {
+        std::vector<std::pair<uint64_t, std::vector<Op>>> sorted;
+        for (const auto& entry : count) {
+            sorted.emplace_back(entry.second, entry.first);
         }
+        std::sort(sorted.rbegin(), sorted.rend());
+        for (size_t index = 0; index < sorted.size() && index < 32; ++index) {
+            std::cout << sorted[index].first;
+            for (Op op : sorted[index].second) {
+                std::cout << ' ' << opName(op);
+            }
+            std::cout << '\n';
+        }
+        std::cout << '\n';
     }
 }
 
 void usage()
 {
-    std::cerr << "usage: arg1 arg2 ... < expressions\n\n";
+    std::cerr <<
+        "usage: [options] arg1 arg2 ... < expressions\n"
+        "       [options] --input=FILE arg1 arg2 ...\n"
+        "       [options] --corpus=FILE arg1 arg2 ...\n"
+        "       [--input=FILE] [--optimize] --write-corpus=FILE < expressions\n"
+        "       --enumerate=N [--ops=op1,op2,...] arg1 arg2 ...\n"
+        "       --opcode-stats < expressions\n\n"
+        "options:\n"
+        "  --backend=jit|batch|sliced|ir|threaded|scalar  evaluation backend\n"
+        "                  (default: batch; sliced suits fold-heavy programs; jit\n"
+        "                  falls back to batch where it is not supported)\n"
+        "  --optimize      run the bytecode optimizer before evaluation\n"
+        "  --memoize       share values of common subterms between programs, in up\n"
+        "                  to 1 GiB of values and 4M subterms\n"
+        "  --classes       print hash, size and smallest program of each class of\n"
+        "                  programs with equal hashes, instead of every program\n"
+        "  --refine[=N]    print size, inputs run and smallest program of each class\n"
+        "                  of programs with equal outputs; all programs run on the\n"
+        "                  first N (default 32) args, then only those not yet told\n"
+        "                  apart on twice as many more, and so on\n"
+        "  --hash=64|128   boost::hash_range of the outputs (default) or a 128-bit\n"
+        "                  fingerprint, printed in hex\n"
+        "  --output=text|binary  hash and program per line (default), or a header\n"
+        "                  and fixed-size records of 128-bit fingerprint, program\n"
+        "                  offset and size in the input (see results.h)\n"
+        "  --input=FILE    read the expressions from FILE, parsed in parallel\n"
+        "  --write-corpus=FILE  parse (and --optimize) the expressions into FILE\n"
+        "                  instead of evaluating them; needs no args\n"
+        "  --corpus=FILE   evaluate the programs saved by --write-corpus, without\n"
+        "                  parsing them again\n"
+        "  --target=OUT1,OUT2,...  report only the programs whose outputs on the\n"
+        "                  args are OUT1, OUT2, ...; each runs input by input with\n"
+        "                  the scalar interpreter until the first mismatch, trying\n"
+        "                  the inputs that rejected the most programs first\n"
+        "  --dedupe        evaluate only the first of the expressions that differ in\n"
+        "                  the order or nesting of and, or, xor and plus operands or\n"
+        "                  in variable names, and report the others with its hash\n"
+        "  --store=FILE    reuse the outputs FILE holds from an earlier run, so that\n"
+        "                  only new programs and new inputs are evaluated, then save\n"
+        "                  all outputs of this run to FILE\n"
+        "  --threads=N     eval workers (default: one per CPU)\n"
+        "  --pin           bind each eval worker to its own CPU\n"
+        "  --ordered       write the results in the order of the expressions, as\n"
+        "                  they are ready, instead of as the workers finish them\n"
+        "  --stats[=FILE]  dump counters and latency percentiles as JSON to stderr\n"
+        "                  (or FILE) at exit and on SIGUSR1\n"
+        "  --enumerate=N   evaluate all programs up to size N that differ on the args\n"
+        "  --ops=...       operators to enumerate (default: all but fold)\n\n";
     std::exit(-1);
 }
 
 
-std::vector<uint64_t> parseArguments(int argc, char** argv)
+Options parseArguments(int argc, char** argv)
 {
-    std::vector<uint64_t> result;
+    Options result;
+    result.opcode_stats = false;
+    result.optimize = false;
+    result.memoize = false;
+    result.classes = false;
+    result.refine_round = 0;
+    result.dedupe = false;
+    result.wide_hash = false;
+    result.binary_output = false;
+    result.backend = Backend::BATCH;
+    result.enumerate_size = 0;
+    result.threads = Pipeline::hardwareThreads();
+    result.pin = false;
+    result.ordered = false;
+    result.stats = false;
+    result.enumerate_operators = {"not", "shl1", "shr1", "shr4", "shr16", "and", "or", "xor", "plus", "if0"};
     for (int index = 1; index < argc; ++index) {
-        uint64_t argument;
-        if (toInteger(argv[index], &argument)) {
-            result.push_back(argument);
+        const std::string argument = argv[index];
+        uint64_t value;
+        if (argument == "--opcode-stats") {
+            result.opcode_stats = true;
+        } else if (argument == "--optimize") {
+            result.optimize = true;
+        } else if (argument == "--memoize") {
+            result.memoize = true;
+        } else if (argument == "--classes") {
+            result.classes = true;
+        } else if (argument == "--refine") {
+            result.refine_round = REFINE_ROUND;
+        } else if (argument.compare(0, 9, "--refine=") == 0 &&
+                   toInteger(argument.substr(9), &value) && value > 0)
+        {
+            result.refine_round = value;
+        } else if (argument == "--dedupe") {
+            result.dedupe = true;
+        } else if (argument == "--hash=64") {
+            result.wide_hash = false;
+        } else if (argument == "--hash=128") {
+            result.wide_hash = true;
+        } else if (argument == "--output=text") {
+            result.binary_output = false;
+        } else if (argument == "--output=binary") {
+            result.binary_output = true;
+        } else if (argument.compare(0, 12, "--enumerate=") == 0 &&
+                   toInteger(argument.substr(12), &value) && value > 0)
+        {
+            result.enumerate_size = value;
+        } else if (argument.compare(0, 10, "--threads=") == 0 &&
+                   toInteger(argument.substr(10), &value) && value > 0)
+        {
+            result.threads = value;
+        } else if (argument == "--pin") {
+            result.pin = true;
+        } else if (argument == "--ordered") {
+            result.ordered = true;
+        } else if (argument == "--stats") {
+            result.stats = true;
+        } else if (argument.compare(0, 8, "--stats=") == 0 && argument.size() > 8) {
+            result.stats = true;
+            result.stats_file = argument.substr(8);
+        } else if (argument.compare(0, 9, "--corpus=") == 0 && argument.size() > 9) {
+            result.corpus_file = argument.substr(9);
+        } else if (argument.compare(0, 15, "--write-corpus=") == 0 && argument.size() > 15) {
+            result.write_corpus_file = argument.substr(15);
+        } else if (argument.compare(0, 9, "--target=") == 0 && argument.size() > 9) {
+            std::istringstream outputs(argument.substr(9));
+            for (std::string output; std::getline(outputs, output, ','); ) {
+                if (!toInteger(output, &value)) {
+                    std::cerr << "Illegal argument: " << argument << std::endl;
+                    std::exit(-1);
+                }
+                result.target_outputs.push_back(value);
+            }
+        } else if (argument.compare(0, 8, "--store=") == 0 && argument.size() > 8) {
+            result.store_file = argument.substr(8);
+        } else if (argument.compare(0, 8, "--input=") == 0 && argument.size() > 8) {
+            result.input_file = argument.substr(8);
+        } else if (argument.compare(0, 6, "--ops=") == 0) {
+            result.enumerate_operators.clear();
+            std::istringstream operators(argument.substr(6));
+            for (std::string name; std::getline(operators, name, ','); ) {
+                result.enumerate_operators.push_back(name);
+            }
+        } else if (argument == "--backend=jit") {
+            // Compiling costs a few syscalls per program; pays off on long input vectors.
+            if (NativeBlock::isSupported()) {
+                result.backend = Backend::JIT;
+            } else {
+                std::cerr << "Warning: --backend=jit is not supported here; using --backend=batch." << std::endl;
+                result.backend = Backend::BATCH;
+            }
+        } else if (argument == "--backend=batch") {
+            result.backend = Backend::BATCH;
+        } else if (argument == "--backend=sliced") {
+            result.backend = Backend::SLICED;
+        } else if (argument == "--backend=ir") {
+            result.backend = Backend::IR;
+        } else if (argument == "--backend=threaded") {
+            result.backend = Backend::THREADED;
+        } else if (argument == "--backend=scalar") {
+            result.backend = Backend::SCALAR;
+        } else if (toInteger(argument, &value)) {
+            result.input_values.push_back(value);
         } else {
-            std::cerr << "Illegal argument: " << argv[index] << std::endl;
+            std::cerr << "Illegal argument: " << argument << std::endl;
             std::exit(-1);
         }
     }
+    if ((result.input_values.empty() && !result.opcode_stats && result.write_corpus_file.empty()) || (result.binary_output && (result.classes || result.enumerate_size > 0)))
+    {
+        usage();
+    }
+    // Matching computes no full output vectors to cache or save.
+    if (!result.target_outputs.empty() &&
+        (result.target_outputs.size() != result.input_values.size() || result.memoize ||
+         !result.store_file.empty() || result.enumerate_size > 0))
+    {
+        usage();
+    }
+    // Refinement reads the text itself and prints classes, not hashes.
+    if (result.refine_round > 0 &&
+        (!result.corpus_file.empty() || !result.write_corpus_file.empty() || !result.target_outputs.empty() ||
+         !result.store_file.empty() || result.enumerate_size > 0 || result.classes || result.binary_output))
+    {
+        usage();
+    }
+    // Records always hold the full fingerprint.
+    result.wide_hash |= result.binary_output;
+    transposeInputs(&result);
     return result;
 }
 
 
-int main(int argc, char** argv)
+// Feeds the expressions of --input, or of stdin, through the pipeline.
+void runPrograms(const Options& options, const Pipeline::ProcessorFactory& factory, std::ostream& output)
 {
-    test_block();
-    test_read_block();
+    Pipeline pipeline(options.threads, options.pin, options.ordered);
+    if (options.input_file.empty()) {
+        pipeline.run(std::cin, factory, output, std::cerr);
+    } else {
+        const MappedFile file(options.input_file);
+        ChunkedInput input(file.text(), Pipeline::BATCH_BYTES);
+        pipeline.run(&input, factory, output, std::cerr);
+    }
+}
 
-    if (argc < 2) {
-        usage();
+void writeCorpus(const Options& options)
+{
+    std::ofstream file(options.write_corpus_file, std::ios::binary | std::ios::trunc);
+    require (file.is_open(), "writeCorpus: Unable to create " + options.write_corpus_file + ".");
+    const CorpusFileHeader header = corpusFileHeader();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const auto makeWriter = [&options]() -> Pipeline::Processor {
+        return [&options](StringRef program, uint64_t, std::string* output, std::string* errors) {
+            try {
+                Block block = parseLambda(program);
+                if (options.optimize) {
+                    block = optimize(block);
+                }
+                appendCorpusEntry(block, program, output);
+            } catch (const std::exception& ex) {
+                errors->append("Unable to parse: ");
+                errors->append(program.data(), program.size());
+                errors->push_back('\n');
+            }
+        };
+    };
+    runPrograms(options, makeWriter, file);
+
+    file.close();
+    require (!file.fail(), "writeCorpus: Unable to write " + options.write_corpus_file + ".");
+}
+
+
+// Reads every expression of --input, or of stdin, and prints the classes
+// --refine finds.
+void refineClasses(const Options& options)
+{
+    Refiner refiner(options.input_values, options.refine_round, options.threads);
+    const auto add = [&refiner](StringRef program) {
+        try {
+            refiner.add(program);
+        } catch (const std::exception& ex) {
+            addStat(StatsCounter::PARSE_ERRORS);
+            std::cerr << "Unable to parse: " << program.str() << '\n';
+        }
+    };
+    if (options.input_file.empty()) {
+        for (std::string program; !(program = nextProgram()).empty(); ) {
+            add(program);
+        }
+    } else {
+        const MappedFile file(options.input_file);
+        StringRef text = file.text();
+        for (StringRef program; popProgram(&text, &program); ) {
+            add(program);
+        }
     }
 
+    std::string line;
+    for (const auto& entry : refiner.run()) {
+        line.clear();
+        appendDecimal(entry.size, &line);
+        line.push_back('\t');
+        appendDecimal(entry.inputs, &line);
+        line.push_back('\t');
+        line.append(entry.representative);
+        line.push_back('\n');
+        std::cout << line;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    test_block();
+    test_classes();
+    test_corpus();
+    test_parser();
+    test_ir();
+    test_jit();
+    test_knownbits();
+    test_threaded();
+    test_optimizer();
+    test_memo();
+    test_enumerator();
+    test_fingerprint();
+    test_input();
+    test_pipeline();
+    test_refine();
+    test_sliced();
+    test_stats();
+    test_store();
+    test_target();
+
     if (!isatty(1)) {
         std::cin.sync_with_stdio(false);
         std::cout.sync_with_stdio(false);
     }
 
-    const auto input_values = parseArguments(argc, argv);
+    const auto options = parseArguments(argc, argv);
+    // Dumps once more when main returns; created before any other thread.
+    std::unique_ptr<StatsDumper> statsDumper;
+    if (options.stats) {
+        enableStats();
+        statsDumper.reset(new StatsDumper(options.stats_file));
+    }
+    if (options.opcode_stats) {
+        printOpcodeStats();
+        return 0;
+    }
+    if (options.enumerate_size > 0) {
+        try {
+            Enumerator enumerator(options.input_values, options.enumerate_operators);
+            std::string line;
+            enumerator.run(options.enumerate_size, [&options, &line](const std::string& program,
+                                                                     const std::vector<uint64_t>& outputs) {
+                line.clear();
+                appendResult(hashOutputs(outputs, options.wide_hash), options.wide_hash, program, &line);
+                std::cout << line;
+            });
+        } catch (const std::exception& ex) {
+            std::cerr << "Exception: " << ex.what() << '\n';
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!options.write_corpus_file.empty()) {
+        try {
+            writeCorpus(options);
+        } catch (const std::exception& ex) {
+            std::cerr << "Exception: " << ex.what() << '\n';
+            return -1;
+        }
+        return 0;
+    }
+
+    if (options.refine_round > 0) {
+        try {
+            refineClasses(options);
+        } catch (const std::exception& ex) {
+            std::cerr << "Exception: " << ex.what() << '\n';
+            return -1;
+        }
+        return 0;
+    }
+
+    std::unique_ptr<TermCache> cache;
+    if (options.memoize) {
+        cache.reset(new TermCache(options.input_values, MEMOIZE_BYTES, MEMOIZE_TERMS));
+    }
+
+    std::unique_ptr<ClassTable> classes;
+    if (options.classes) {
+        classes.reset(new ClassTable());
+    }
+
+    std::unique_ptr<CanonicalTable> canonical;
+    if (options.dedupe) {
+        canonical.reset(new CanonicalTable());
+    }
+
+    std::unique_ptr<Target> target;
+    if (!options.target_outputs.empty()) {
+        target.reset(new Target(options.input_values, options.target_outputs));
+    }
+
+    std::unique_ptr<StoreState> store;
+
+    const auto makeProcessor = [&options, &cache, &classes, &store, &canonical, &target]() -> Pipeline::Processor {
+        const auto processor = std::make_shared<ProgramProcessor>(options, cache.get(), classes.get(), store.get(),
+                                                                  canonical.get(), target.get());
+        return [processor](StringRef program, uint64_t offset, std::string* output, std::string* errors) {
+            (*processor)(program, offset, output, errors);
+        };
+    };
+
+    if (options.binary_output) {
+        const ResultFileHeader header = resultFileHeader();
+        std::cout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
 
-    std::vector<std::thread> thread_group;
     try {
-        for (int index = 0; index < 3; ++index) {
-            thread_group.emplace_back(threadMain, std::cref(input_values));
+        if (!options.store_file.empty()) {
+            store = openStore(options);
+        }
+        if (options.corpus_file.empty()) {
+            runPrograms(options, makeProcessor, std::cout);
+        } else {
+            const Corpus corpus(options.corpus_file);
+            const auto makeCorpusProcessor = [&options, &cache, &classes, &store, &target, &corpus]() -> Pipeline::IndexProcessor {
+                const auto processor = std::make_shared<ProgramProcessor>(options, cache.get(), classes.get(),
+                                                                          store.get(), nullptr, target.get());
+                return [processor, &corpus](size_t index, std::string* output, std::string* errors) {
+                    (*processor)(corpus, index, output, errors);
+                };
+            };
+            Pipeline pipeline(options.threads, options.pin, options.ordered);
+            pipeline.run(corpus.size(), makeCorpusProcessor, std::cout, std::cerr);
+        }
+        if (store) {
+            store->writer->commit();
         }
     } catch (const std::exception& ex) {
         std::cerr << "Exception: " << ex.what() << '\n';
         return -1;
     }
 
-    for (auto& thread : thread_group) {
-        if (thread.joinable()) {
-            thread.join();
+    if (classes) {
+        std::string line;
+        for (const auto& entry : classes->classes()) {
+            line.clear();
+            appendHash(entry.fingerprint, options.wide_hash, &line);
+            line.push_back('\t');
+            appendDecimal(entry.size, &line);
+            line.push_back('\t');
+            line.append(entry.representative);
+            line.push_back('\n');
+            std::cout << line;
         }
     }
 
-    for (const auto& counter : PERFMON_COUNTERS) {
-        std::cerr << counter.Name() << ": " << counter.Calls() << ' ' << counter.Seconds() << "seconds\n";
-    }
-
     return 0;
 }
@@ -0,0 +1,327 @@
+#include "memo.h"
+#include "require.h"
+#include "stats.h"
+#include <algorithm>
+#include <functional>
+
+
+// op is LOAD_ARG0, LOAD_CONST, NOT, SHL_N, SHR_N, a binary op, JNZ for if0
+// or FOLD_BEGIN; imm is the constant, the shift or the fold argument.
+struct TermCache::Term {
+    Op op;
+    uint64_t imm;
+    const Term* operands[3];
+    std::string body;   // code of a fold body
+    size_t hash;
+
+    // Guarded by the mutex of the owning shard.
+    mutable Value value;
+};
+
+size_t TermCache::TermHash::operator()(const Term* term) const
+{
+    return term->hash;
+}
+
+bool TermCache::TermEqual::operator()(const Term* lhs, const Term* rhs) const
+{
+    return lhs->op == rhs->op && lhs->imm == rhs->imm &&
+           std::equal(lhs->operands, lhs->operands + 3, rhs->operands) &&
+           lhs->body == rhs->body;
+}
+
+
+TermCache::TermCache(std::vector<uint64_t> inputs, size_t maxValueBytes, size_t maxTerms)
+  : inputs_(std::make_shared<const std::vector<uint64_t>>(std::move(inputs)))
+  , maxValueBytes_(maxValueBytes)
+  , maxTerms_(maxTerms)
+  , valueBytes_(0)
+  , termCount_(0)
+{ }
+
+TermCache::~TermCache()
+{
+    for (auto& shard : shards_) {
+        for (const Term* term : shard.terms) {
+            delete term;
+        }
+    }
+}
+
+size_t TermCache::termCount() const
+{
+    return termCount_.load(std::memory_order_relaxed);
+}
+
+TermCache::Shard& TermCache::shardOf(const Term* term)
+{
+    return shards_[(term->hash >> 8) % SHARD_COUNT];
+}
+
+// Returns the unique term equal to term, which is left unspecified, or
+// nullptr.
+const TermCache::Term* TermCache::intern(Term* term)
+{
+    // Operands are interned before their parents, so their addresses
+    // identify them.
+    size_t hash = std::hash<uint64_t>()(term->imm) * 31 + static_cast<size_t>(term->op);
+    for (const Term* operand : term->operands) {
+        hash = hash * 0x9e3779b97f4a7c15UL + std::hash<const Term*>()(operand);
+    }
+    term->hash = hash ^ std::hash<std::string>()(term->body);
+
+    Shard& shard = shardOf(term);
+    TimedLock<std::mutex> lock(shard.mutex);
+    const auto found = shard.terms.find(term);
+    if (found != shard.terms.end()) {
+        return *found;
+    }
+    // Racing threads may overshoot by a term each.
+    if (termCount_.load(std::memory_order_relaxed) >= maxTerms_) {
+        return nullptr;
+    }
+    termCount_.fetch_add(1, std::memory_order_relaxed);
+    Term* const result = new Term(std::move(*term));
+    shard.terms.insert(result);
+    return result;
+}
+
+// Returns nullptr when code[begin, end) is not a single closed term, or has
+// a subterm that intern() turned down.
+const TermCache::Term* TermCache::decompile(const std::vector<Op>& code, size_t begin, size_t end)
+{
+    std::vector<const Term*> stack;
+    const auto push = [this, &stack](Op op, uint64_t imm, size_t operandCount, std::string body) {
+        Term term{op, imm, {nullptr, nullptr, nullptr}, std::move(body), 0, Value()};
+        std::copy(stack.end() - operandCount, stack.end(), term.operands);
+        stack.resize(stack.size() - operandCount);
+        // A turned down operand makes its parents nullptr too.
+        const bool complete = std::find(term.operands, term.operands + operandCount, nullptr) ==
+                              term.operands + operandCount;
+        stack.push_back(complete ? intern(&term) : nullptr);
+    };
+
+    size_t ip = begin;
+    while (ip < end) {
+        const Op op = code[ip];
+        if (stack.size() < stackInputs(op)) {
+            return nullptr;
+        }
+        switch (op) {
+        case Op::NOT:
+            push(Op::NOT, 0, 1, std::string());
+            break;
+
+        case Op::SHL1:
+            push(Op::SHL_N, 1, 1, std::string());
+            break;
+
+        case Op::SHR1:
+        case Op::SHR4:
+        case Op::SHR16:
+            push(Op::SHR_N, op == Op::SHR1 ? 1 : op == Op::SHR4 ? 4 : 16, 1, std::string());
+            break;
+
+        case Op::SHL_N:
+        case Op::SHR_N:
+            push(op, static_cast<uint64_t>(code[ip + 1]), 1, std::string());
+            break;
+
+        case Op::AND:
+        case Op::OR:
+        case Op::XOR:
+        case Op::PLUS:
+            push(op, 0, 2, std::string());
+            break;
+
+        case Op::LOAD_ARG0:
+            push(Op::LOAD_ARG0, 0, 0, std::string());
+            break;
+
+        case Op::LOAD_0:
+        case Op::LOAD_1:
+        case Op::LOAD_2:
+        case Op::LOAD_3:
+        case Op::LOAD_4:
+        case Op::LOAD_5:
+        case Op::LOAD_6:
+        case Op::LOAD_7:
+            push(Op::LOAD_CONST, static_cast<int>(op) - static_cast<int>(Op::LOAD_0), 0, std::string());
+            break;
+
+        case Op::LOAD_CONST:
+            push(Op::LOAD_CONST, *(const uint64_t*)&code[ip + 1], 0, std::string());
+            break;
+
+        case Op::JNZ: {
+            const size_t ifEnd = ip + *(const uint16_t*)&code[ip + 1];
+            if (ifEnd < ip + 3 || ifEnd + 3 > end || code[ifEnd] != Op::JMP) {
+                return nullptr;
+            }
+            const size_t elseEnd = ifEnd + 3 + *(const uint16_t*)&code[ifEnd + 1];
+            if (elseEnd > end) {
+                return nullptr;
+            }
+            const Term* const ifTerm = decompile(code, ip + 3, ifEnd);
+            const Term* const elseTerm = ifTerm ? decompile(code, ifEnd + 3, elseEnd) : nullptr;
+            if (!elseTerm) {
+                return nullptr;
+            }
+            stack.push_back(ifTerm);
+            stack.push_back(elseTerm);
+            push(Op::JNZ, 0, 3, std::string());
+            ip = elseEnd;
+            continue;
+        }
+
+        case Op::FOLD_BEGIN: {
+            // The parser gives top level folds arguments 1 and 2; the body may
+            // read only those and the input.
+            const size_t bodyEnd = ip + 4 + *(const uint16_t*)&code[ip + 2];
+            if (code[ip + 1] != static_cast<Op>(1) || bodyEnd + 4 > end || code[bodyEnd] != Op::FOLD_NEXT) {
+                return nullptr;
+            }
+            push(Op::FOLD_BEGIN, 1, 2, std::string((const char*)&code[ip + 4], (const char*)&code[bodyEnd]));
+            ip = bodyEnd + opSize(Op::FOLD_NEXT);
+            continue;
+        }
+
+        default:
+            return nullptr;
+        }
+        ip += opSize(op);
+    }
+    return stack.size() == 1 ? stack.back() : nullptr;
+}
+
+// Whole programs are rarely repeated, so the caller decides whether the value
+// is worth keeping.
+TermCache::Value TermCache::value(const Term* term, bool keep)
+{
+    Shard& shard = shardOf(term);
+    {
+        TimedLock<std::mutex> lock(shard.mutex);
+        if (term->value) {
+            return term->value;
+        }
+    }
+
+    const Value result = compute(term);
+    const size_t bytes = result->size() * sizeof(uint64_t);
+    if (keep && valueBytes_ + bytes <= maxValueBytes_) {
+        TimedLock<std::mutex> lock(shard.mutex);
+        if (!term->value) {
+            term->value = result;
+            valueBytes_ += bytes;
+        }
+    }
+    return result;
+}
+
+TermCache::Value TermCache::compute(const Term* term)
+{
+    const size_t size = inputs_->size();
+    if (term->op == Op::LOAD_ARG0) {
+        return inputs_;
+    }
+
+    auto result = std::make_shared<std::vector<uint64_t>>(size, term->imm);
+    uint64_t* const out = result->data();
+    if (term->op == Op::LOAD_CONST) {
+        return result;
+    }
+
+    Value operands[3];
+    for (int index = 0; index < 3 && term->operands[index]; ++index) {
+        operands[index] = value(term->operands[index], true);
+    }
+    const uint64_t* const a = operands[0]->data();
+    const uint64_t* const b = operands[1] ? operands[1]->data() : nullptr;
+    const uint64_t* const c = operands[2] ? operands[2]->data() : nullptr;
+    const int shift = static_cast<int>(term->imm);
+
+    switch (term->op) {
+    case Op::NOT:
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = ~a[i];
+        }
+        break;
+
+    case Op::SHL_N:
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = a[i] << shift;
+        }
+        break;
+
+    case Op::SHR_N:
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = a[i] >> shift;
+        }
+        break;
+
+    case Op::AND:
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = a[i] & b[i];
+        }
+        break;
+
+    case Op::OR:
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = a[i] | b[i];
+        }
+        break;
+
+    case Op::XOR:
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = a[i] ^ b[i];
+        }
+        break;
+
+    case Op::PLUS:
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = a[i] + b[i];
+        }
+        break;
+
+    case Op::JNZ:
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = a[i] == 0 ? b[i] : c[i];
+        }
+        break;
+
+    case Op::FOLD_BEGIN: {
+        const int n = static_cast<int>(term->imm);
+        Block body(0);
+        body.emitCode(reinterpret_cast<const Op*>(term->body.data()), term->body.size());
+        Block block(0);
+        block.emitLoadArg(n);
+        block.emitLoadArg(n + 1);
+        block.emitFold(n, body);
+
+        const uint64_t* columns[8] = {};
+        columns[0] = inputs_->data();
+        columns[n] = a;
+        columns[n + 1] = b;
+        block.executeBatch(columns, n + 2, size, out);
+        break;
+    }
+
+    default:
+        require (false, "TermCache: Unexpected term.");
+        break;
+    }
+    return result;
+}
+
+void TermCache::evaluate(const Block& block, std::vector<uint64_t>* const out)
+{
+    const std::vector<Op>& code = block.code();
+    const Term* const term = decompile(code, 0, code.size());
+    if (!term) {
+        out->resize(inputs_->size());
+        block.executeBatch(inputs_->data(), inputs_->size(), out->data());
+        return;
+    }
+    const Value result = value(term, false);
+    out->assign(result->begin(), result->end());
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "block.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Values of closed subterms over a fixed input vector, shared by all programs
+// and threads.
+//
+// Programs are decompiled from their bytecode into hash-consed terms, so the
+// same subterm in different programs is one Term whose output vector is
+// computed once. Only values of terms that occur as a subterm are kept, and
+// once they take up maxValueBytes further values are recomputed from their
+// operands on demand. Terms are never freed; once there are maxTerms of them
+// no more are made, and programs with a subterm not seen before are evaluated
+// directly.
+class TermCache {
+public:
+    TermCache(std::vector<uint64_t> inputs, size_t maxValueBytes, size_t maxTerms);
+    ~TermCache();
+
+    TermCache(const TermCache&) = delete;
+    TermCache& operator=(const TermCache&) = delete;
+
+    // Same result as block.executeBatch over the inputs. Blocks that are not
+    // made of closed terms (top level UNFOLD, STORE_ARG, DROP, or arguments
+    // other than 0) are evaluated directly.
+    void evaluate(const Block& block, std::vector<uint64_t>* out);
+
+    size_t termCount() const;
+
+private:
+    typedef std::shared_ptr<const std::vector<uint64_t>> Value;
+
+    struct Term;
+    struct TermHash {
+        size_t operator()(const Term* term) const;
+    };
+    struct TermEqual {
+        bool operator()(const Term* lhs, const Term* rhs) const;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_set<const Term*, TermHash, TermEqual> terms;
+    };
+
+    static const size_t SHARD_COUNT = 64;
+
+    // nullptr when term is new and there are maxTerms_ terms.
+    const Term* intern(Term* term);
+    const Term* decompile(const std::vector<Op>& code, size_t begin, size_t end);
+    Value value(const Term* term, bool keep);
+    Value compute(const Term* term);
+    Shard& shardOf(const Term* term);
+
+    const Value inputs_;
+    const size_t maxValueBytes_;
+    const size_t maxTerms_;
+    std::atomic<size_t> valueBytes_;
+    std::atomic<size_t> termCount_;
+    Shard shards_[SHARD_COUNT];
+};
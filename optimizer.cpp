@@ -0,0 +1,741 @@
+#include "optimizer.h"
+#include "knownbits.h"
+#include "require.h"
+#include <array>
+#include <stdexcept>
+
+
+namespace {
+
+// Code that does not have the shape emitted by emitIf0.
+class Unstructured : public std::runtime_error {
+public:
+    Unstructured() : std::runtime_error("optimize: Unstructured control flow.") { }
+};
+
+struct Branches {
+    size_t ifBegin;
+    size_t ifEnd;
+    size_t elseBegin;
+    size_t elseEnd;
+};
+
+uint16_t jumpShift(const std::vector<Op>& code, size_t ip)
+{
+    return *(const uint16_t*)&code[ip + 1];
+}
+
+Branches branchesAt(const std::vector<Op>& code, size_t ip, size_t end)
+{
+    Branches result;
+    result.ifBegin = ip + 3;
+    result.ifEnd = ip + jumpShift(code, ip);
+    if (result.ifEnd < result.ifBegin || result.ifEnd + 3 > end || code[result.ifEnd] != Op::JMP) {
+        throw Unstructured();
+    }
+    result.elseBegin = result.ifEnd + 3;
+    result.elseEnd = result.elseBegin + jumpShift(code, result.ifEnd);
+    if (result.elseEnd > end) {
+        throw Unstructured();
+    }
+    return result;
+}
+
+
+struct FoldBody {
+    int n;
+    size_t begin;
+    size_t end;
+};
+
+FoldBody foldBodyAt(const std::vector<Op>& code, size_t ip, size_t end)
+{
+    FoldBody result;
+    result.n = static_cast<int>(code[ip + 1]);
+    result.begin = ip + 4;
+    result.end = result.begin + *(const uint16_t*)&code[ip + 2];
+    if (result.end + 4 > end || code[result.end] != Op::FOLD_NEXT) {
+        throw Unstructured();
+    }
+    return result;
+}
+
+
+// Every instruction belongs to a region: the top level, one branch of an
+// if0 or the body of a fold. An instruction in region R always runs after
+// any earlier instruction in R or in a region nested inside R.
+class Regions {
+public:
+    explicit Regions(const std::vector<Op>& code)
+      : regions_(code.size(), 0)
+      , parents_(1, NO_PARENT)
+      , loops_(1, false)
+    {
+        assign(code, 0, code.size(), 0);
+    }
+
+    size_t at(size_t ip) const { return regions_[ip]; }
+
+    // Region is a fold body or nested inside one.
+    bool inLoop(size_t region) const
+    {
+        for (; region != NO_PARENT; region = parents_[region]) {
+            if (loops_[region]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool contains(size_t outer, size_t inner) const
+    {
+        for (size_t region = inner; region != NO_PARENT; region = parents_[region]) {
+            if (region == outer) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static const size_t NO_PARENT = static_cast<size_t>(-1);
+
+    void assign(const std::vector<Op>& code, size_t begin, size_t end, size_t region)
+    {
+        size_t ip = begin;
+        while (ip < end) {
+            regions_[ip] = region;
+            if (code[ip] == Op::JMP || code[ip] == Op::FOLD_NEXT) {
+                throw Unstructured();
+            }
+            if (code[ip] == Op::JNZ) {
+                const Branches branches = branchesAt(code, ip, end);
+                regions_[branches.ifEnd] = region;
+                assign(code, branches.ifBegin, branches.ifEnd, child(region, false));
+                assign(code, branches.elseBegin, branches.elseEnd, child(region, false));
+                ip = branches.elseEnd;
+            } else if (code[ip] == Op::FOLD_BEGIN) {
+                const FoldBody body = foldBodyAt(code, ip, end);
+                regions_[body.end] = region;
+                assign(code, body.begin, body.end, child(region, true));
+                ip = body.end + opSize(Op::FOLD_NEXT);
+            } else {
+                ip += opSize(code[ip]);
+            }
+        }
+    }
+
+    size_t child(size_t region, bool loop)
+    {
+        parents_.push_back(region);
+        loops_.push_back(loop);
+        return parents_.size() - 1;
+    }
+
+    std::vector<size_t> regions_;
+    std::vector<size_t> parents_;
+    std::vector<bool> loops_;
+};
+
+const size_t Regions::NO_PARENT;
+
+// A store is dead when the argument is not loaded before a later store that
+// is certain to overwrite it, or before the end of the block. Stores inside
+// a fold body may be read by the next iteration and are kept.
+std::vector<bool> findDeadStores(const std::vector<Op>& code, const Regions& regions)
+{
+    std::vector<bool> result(code.size(), false);
+    for (size_t ip = 0; ip < code.size(); ip += opSize(code[ip])) {
+        if (code[ip] < Op::STORE_ARG0 || code[ip] > Op::STORE_ARG7 || regions.inLoop(regions.at(ip))) {
+            continue;
+        }
+        const int n = static_cast<int>(code[ip]) - static_cast<int>(Op::STORE_ARG0);
+        const Op load = static_cast<Op>(static_cast<int>(Op::LOAD_ARG0) + n);
+
+        bool dead = true;
+        for (size_t next = ip + opSize(code[ip]); next < code.size(); next += opSize(code[next])) {
+            if (code[next] == load) {
+                dead = false;
+                break;
+            }
+            if (code[next] == code[ip] && regions.contains(regions.at(next), regions.at(ip))) {
+                break;
+            }
+        }
+        result[ip] = dead;
+    }
+    return result;
+}
+
+
+typedef std::array<KnownBits, 8> Env;
+
+// A unary op not yet emitted: NOT, or SHL_N/SHR_N by amount.
+struct Step {
+    Op op;
+    int amount;
+};
+
+// A stack entry. Pending values have not been emitted yet and have no side
+// effects, so they may be rewritten or dropped; committed values already sit
+// on the stack of the output block. Committed values form a prefix of the
+// stack. In both cases suffix holds unary ops still to be applied, and bits
+// what is known about the value with them applied. Known values are pending
+// constants.
+struct Value {
+    bool committed;
+    Block code;
+    std::vector<Step> suffix;
+    bool known;
+    uint64_t constant;
+    KnownBits bits;
+};
+
+Value pendingValue(const KnownBits& bits = KnownBits::unknown())
+{
+    return Value{false, Block(0), std::vector<Step>(), false, 0, bits};
+}
+
+Value pendingConstant(uint64_t constant)
+{
+    Value result = pendingValue(KnownBits::constant(constant));
+    result.code.emitLoadConst(constant);
+    result.known = true;
+    result.constant = constant;
+    return result;
+}
+
+Value committedValue(const KnownBits& bits = KnownBits::unknown())
+{
+    Value result = pendingValue(bits);
+    result.committed = true;
+    return result;
+}
+
+KnownBits knownStep(const Step& step, const KnownBits& value)
+{
+    switch (step.op) {
+    case Op::NOT:
+        return knownNot(value);
+    case Op::SHL_N:
+        return knownShl(value, step.amount);
+    default:
+        return knownShr(value, step.amount);
+    }
+}
+
+KnownBits knownBinary(Op op, const KnownBits& lhs, const KnownBits& rhs)
+{
+    switch (op) {
+    case Op::AND:
+        return knownAnd(lhs, rhs);
+    case Op::OR:
+        return knownOr(lhs, rhs);
+    case Op::XOR:
+        return knownXor(lhs, rhs);
+    default:
+        return knownPlus(lhs, rhs);
+    }
+}
+
+// What holds for every byte of value.
+KnownBits knownAnyByte(const KnownBits& value)
+{
+    KnownBits result = knownByte(value, 0);
+    for (int offset = 8; offset < 64; offset += 8) {
+        result = knownJoin(result, knownByte(value, offset));
+    }
+    return result;
+}
+
+Env knownJoin(const Env& lhs, const Env& rhs)
+{
+    Env result;
+    for (size_t n = 0; n < result.size(); ++n) {
+        result[n] = knownJoin(lhs[n], rhs[n]);
+    }
+    return result;
+}
+
+uint64_t applyStep(const Step& step, uint64_t value)
+{
+    switch (step.op) {
+    case Op::NOT:
+        return ~value;
+    case Op::SHL_N:
+        return value << step.amount;
+    default:
+        return value >> step.amount;
+    }
+}
+
+uint64_t applyBinary(Op op, uint64_t lhs, uint64_t rhs)
+{
+    switch (op) {
+    case Op::AND:
+        return lhs & rhs;
+    case Op::OR:
+        return lhs | rhs;
+    case Op::XOR:
+        return lhs ^ rhs;
+    default:
+        return lhs + rhs;
+    }
+}
+
+void emitSteps(const std::vector<Step>& steps, Block* const block)
+{
+    for (const auto& step : steps) {
+        switch (step.op) {
+        case Op::NOT:
+            block->emitNot();
+            break;
+        case Op::SHL_N:
+            block->emitShl(step.amount);
+            break;
+        default:
+            block->emitShr(step.amount);
+            break;
+        }
+    }
+}
+
+void emitBinary(Op op, Block* const block)
+{
+    switch (op) {
+    case Op::AND:
+        block->emitAnd();
+        break;
+    case Op::OR:
+        block->emitOr();
+        break;
+    case Op::XOR:
+        block->emitXor();
+        break;
+    default:
+        block->emitPlus();
+        break;
+    }
+}
+
+// Appends the code of a pending value.
+void materialize(const Value& value, Block* const block)
+{
+    block->emitBlock(value.code);
+    emitSteps(value.suffix, block);
+}
+
+
+class Optimizer {
+public:
+    Optimizer(const std::vector<Op>& code, const std::vector<bool>& deadStores, const Env& env)
+      : code_(code)
+      , deadStores_(deadStores)
+      , out_(0)
+      , env_(env)
+    { }
+
+    const Env& env() const { return env_; }
+
+    // Of the single value left by run().
+    const KnownBits& resultBits() const { return stack_.back().bits; }
+
+    // Nothing emitted yet and the result is a single pending value.
+    bool isPure() const
+    {
+        return out_.code().empty() && stack_.size() == 1 && !stack_.back().committed;
+    }
+
+    bool knownResult(uint64_t* const value) const
+    {
+        if (isPure() && stack_.back().known) {
+            *value = stack_.back().constant;
+            return true;
+        }
+        return false;
+    }
+
+    Block finish()
+    {
+        commitAll();
+        return out_;
+    }
+
+    void run(size_t begin, size_t end)
+    {
+        size_t ip = begin;
+        while (ip < end) {
+            const Op op = code_[ip];
+            switch (op) {
+            case Op::NOT:
+                unary(Step{Op::NOT, 0});
+                break;
+
+            case Op::SHL1:
+                unary(Step{Op::SHL_N, 1});
+                break;
+
+            case Op::SHR1:
+                unary(Step{Op::SHR_N, 1});
+                break;
+
+            case Op::SHR4:
+                unary(Step{Op::SHR_N, 4});
+                break;
+
+            case Op::SHR16:
+                unary(Step{Op::SHR_N, 16});
+                break;
+
+            case Op::SHL_N:
+            case Op::SHR_N:
+                unary(Step{op, static_cast<int>(code_[ip + 1])});
+                break;
+
+            case Op::AND:
+            case Op::OR:
+            case Op::XOR:
+            case Op::PLUS:
+                binary(op);
+                break;
+
+            case Op::UNFOLD:
+                unfold();
+                break;
+
+            case Op::STORE_ARG0:
+            case Op::STORE_ARG1:
+            case Op::STORE_ARG2:
+            case Op::STORE_ARG3:
+            case Op::STORE_ARG4:
+            case Op::STORE_ARG5:
+            case Op::STORE_ARG6:
+            case Op::STORE_ARG7:
+                storeArg(static_cast<int>(op) - static_cast<int>(Op::STORE_ARG0), deadStores_[ip]);
+                break;
+
+            case Op::LOAD_ARG0:
+            case Op::LOAD_ARG1:
+            case Op::LOAD_ARG2:
+            case Op::LOAD_ARG3:
+            case Op::LOAD_ARG4:
+            case Op::LOAD_ARG5:
+            case Op::LOAD_ARG6:
+            case Op::LOAD_ARG7:
+                loadArg(static_cast<int>(op) - static_cast<int>(Op::LOAD_ARG0));
+                break;
+
+            case Op::LOAD_0:
+            case Op::LOAD_1:
+            case Op::LOAD_2:
+            case Op::LOAD_3:
+            case Op::LOAD_4:
+            case Op::LOAD_5:
+            case Op::LOAD_6:
+            case Op::LOAD_7:
+                stack_.push_back(pendingConstant(static_cast<int>(op) - static_cast<int>(Op::LOAD_0)));
+                break;
+
+            case Op::LOAD_CONST:
+                stack_.push_back(pendingConstant(*(const uint64_t*)&code_[ip + 1]));
+                break;
+
+            case Op::DROP:
+                drop(pop());
+                break;
+
+            case Op::JNZ: {
+                const Branches branches = branchesAt(code_, ip, end);
+                if0(branches);
+                ip = branches.elseEnd;
+                continue;
+            }
+
+            case Op::JMP:
+            case Op::FOLD_NEXT:
+                throw Unstructured();
+
+            case Op::FOLD_BEGIN: {
+                const FoldBody body = foldBodyAt(code_, ip, end);
+                fold(body);
+                ip = body.end + opSize(Op::FOLD_NEXT);
+                continue;
+            }
+            }
+            ip += opSize(op);
+        }
+    }
+
+private:
+    Value pop()
+    {
+        Value result = std::move(stack_.back());
+        stack_.pop_back();
+        return result;
+    }
+
+    void commitAll()
+    {
+        for (auto& value : stack_) {
+            if (!value.committed) {
+                out_.emitBlock(value.code);
+                value.code = Block(0);
+                value.committed = true;
+                value.known = false;
+            }
+            emitSteps(value.suffix, &out_);
+            value.suffix.clear();
+        }
+    }
+
+    // Emits everything up to and including value, which is then consumed
+    // by the caller from the top of the output stack.
+    void commitWith(const Value& value)
+    {
+        stack_.push_back(value);
+        commitAll();
+        stack_.pop_back();
+    }
+
+    void drop(const Value& value)
+    {
+        if (value.committed) {
+            commitWith(value);
+            out_.emitDrop();
+        }
+    }
+
+    // Pushes the new top of the stack, replacing it by a constant when its
+    // bits are all known.
+    void push(Value value)
+    {
+        if (!value.known && value.bits.isConstant()) {
+            drop(value);
+            stack_.push_back(pendingConstant(value.bits.value()));
+        } else {
+            stack_.push_back(std::move(value));
+        }
+    }
+
+    void unary(const Step& step)
+    {
+        Value value = pop();
+        if (value.known) {
+            stack_.push_back(pendingConstant(applyStep(step, value.constant)));
+            return;
+        }
+        value.bits = knownStep(step, value.bits);
+        if (!value.suffix.empty()) {
+            Step& last = value.suffix.back();
+            if (step.op == Op::NOT && last.op == Op::NOT) {
+                value.suffix.pop_back();
+                push(std::move(value));
+                return;
+            }
+            if (step.op != Op::NOT && step.op == last.op && last.amount + step.amount < 64) {
+                last.amount += step.amount;
+                push(std::move(value));
+                return;
+            }
+        }
+        value.suffix.push_back(step);
+        push(std::move(value));
+    }
+
+    void binary(Op op)
+    {
+        Value rhs = pop();
+        Value lhs = pop();
+        if (lhs.known && rhs.known) {
+            stack_.push_back(pendingConstant(applyBinary(op, lhs.constant, rhs.constant)));
+            return;
+        }
+        const KnownBits bits = knownBinary(op, lhs.bits, rhs.bits);
+
+        // Known values are pending, so the constant operand can be dropped.
+        if (lhs.known || rhs.known) {
+            Value& other = lhs.known ? rhs : lhs;
+            const uint64_t constant = lhs.known ? lhs.constant : rhs.constant;
+            const uint64_t ones = ~uint64_t(0);
+            // Masks that keep every bit other may have set, and ors of bits
+            // it has set anyway.
+            if ((op == Op::AND && (constant | other.bits.zeros) == ones) ||
+                (op == Op::OR && (constant & ~other.bits.ones) == 0) ||
+                (op != Op::AND && constant == 0))
+            {
+                stack_.push_back(other);
+                return;
+            }
+            if (op == Op::XOR && constant == ones) {
+                stack_.push_back(other);
+                unary(Step{Op::NOT, 0});
+                return;
+            }
+        }
+
+        if (!lhs.committed && !rhs.committed) {
+            Value result = pendingValue(bits);
+            result.code = std::move(lhs.code);
+            emitSteps(lhs.suffix, &result.code);
+            materialize(rhs, &result.code);
+            emitBinary(op, &result.code);
+            push(std::move(result));
+            return;
+        }
+
+        stack_.push_back(lhs);
+        commitWith(rhs);
+        stack_.pop_back();
+        emitBinary(op, &out_);
+        push(committedValue(bits));
+    }
+
+    void unfold()
+    {
+        const Value value = pop();
+        if (value.known) {
+            for (int offset = 56; offset >= 0; offset -= 8) {
+                stack_.push_back(pendingConstant(0xff & (value.constant >> offset)));
+            }
+            return;
+        }
+        commitWith(value);
+        out_.emitUnfold();
+        for (int offset = 56; offset >= 0; offset -= 8) {
+            stack_.push_back(committedValue(knownByte(value.bits, offset)));
+        }
+    }
+
+    void storeArg(int n, bool dead)
+    {
+        const Value value = pop();
+        if (dead) {
+            drop(value);
+        } else {
+            commitWith(value);
+            out_.emitStoreArg(n);
+        }
+        env_[n] = value.bits;
+    }
+
+    void loadArg(int n)
+    {
+        if (env_[n].isConstant()) {
+            stack_.push_back(pendingConstant(env_[n].value()));
+        } else {
+            Value value = pendingValue(env_[n]);
+            value.code.emitLoadArg(n);
+            stack_.push_back(value);
+        }
+    }
+
+    void if0(const Branches& branches)
+    {
+        const Value condition = pop();
+        if (condition.bits.isZero() || condition.bits.isNonzero()) {
+            drop(condition);
+            if (condition.bits.isZero()) {
+                run(branches.ifBegin, branches.ifEnd);
+            } else {
+                run(branches.elseBegin, branches.elseEnd);
+            }
+            return;
+        }
+
+        Optimizer ifPart(code_, deadStores_, env_);
+        ifPart.run(branches.ifBegin, branches.ifEnd);
+        Optimizer elsePart(code_, deadStores_, env_);
+        elsePart.run(branches.elseBegin, branches.elseEnd);
+        env_ = knownJoin(ifPart.env(), elsePart.env());
+        const KnownBits bits = knownJoin(ifPart.resultBits(), elsePart.resultBits());
+
+        uint64_t ifValue = 0, elseValue = 0;
+        if (!condition.committed &&
+            ifPart.knownResult(&ifValue) && elsePart.knownResult(&elseValue) &&
+            ifValue == elseValue)
+        {
+            stack_.push_back(pendingConstant(ifValue));
+            return;
+        }
+
+        const bool pure = !condition.committed && ifPart.isPure() && elsePart.isPure();
+        const Block ifBlock = ifPart.finish();
+        const Block elseBlock = elsePart.finish();
+        if (pure) {
+            Value result = pendingValue(bits);
+            materialize(condition, &result.code);
+            result.code.emitIf0(ifBlock, elseBlock);
+            push(std::move(result));
+        } else {
+            commitWith(condition);
+            out_.emitIf0(ifBlock, elseBlock);
+            push(committedValue(bits));
+        }
+    }
+
+    // The arguments at the start of an iteration are what holds both before
+    // the first one and after any other, which is found by running the body
+    // until that stops changing. The loop ends after an iteration, so that
+    // is what holds after it.
+    void fold(const FoldBody& body)
+    {
+        const Value accumulator = pop();
+        const KnownBits byte = knownAnyByte(stack_.back().bits);
+        commitWith(accumulator);
+
+        Env head = env_;
+        head[body.n] = byte;
+        head[body.n + 1] = accumulator.bits;
+        for (;;) {
+            Optimizer iteration(code_, deadStores_, head);
+            iteration.run(body.begin, body.end);
+            Env next = iteration.env();
+            next[body.n] = byte;
+            next[body.n + 1] = iteration.resultBits();
+            next = knownJoin(head, next);
+            if (next == head) {
+                break;
+            }
+            head = next;
+        }
+
+        Optimizer bodyPart(code_, deadStores_, head);
+        bodyPart.run(body.begin, body.end);
+        const KnownBits bits = bodyPart.resultBits();
+        env_ = bodyPart.env();
+        out_.emitFold(body.n, bodyPart.finish());
+
+        stack_.pop_back();
+        push(committedValue(bits));
+    }
+
+    const std::vector<Op>& code_;
+    const std::vector<bool>& deadStores_;
+    Block out_;
+    std::vector<Value> stack_;
+    Env env_;
+};
+
+} // namespace
+
+
+Block optimize(const Block& block)
+{
+    require (block.initalStackSize() == 0, "optimize: Block is not runnable.");
+    require (block.stackSize() == 1, "optimize: Block incomplete.");
+
+    try {
+        const std::vector<Op>& code = block.code();
+        const Regions regions(code);
+        const std::vector<bool> deadStores = findDeadStores(code, regions);
+
+        Env env;
+        env.fill(KnownBits::unknown());
+        Optimizer optimizer(code, deadStores, env);
+        optimizer.run(0, code.size());
+        return optimizer.finish();
+
+    } catch (const Unstructured&) {
+        return block;
+    }
+}
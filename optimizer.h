@@ -0,0 +1,13 @@
+#pragma once
+
+#include "block.h"
+
+// Returns a block computing the same result as the given runnable block with
+// less code: constants are folded, shift runs become one wider shift,
+// identities such as (not (not x)) and (and x 0) are simplified, if0 with a
+// constant condition keeps only the taken branch, and stores to arguments
+// that are never read again are dropped. Jumps are re-encoded.
+//
+// Blocks whose jumps do not have the shape emitted by emitIf0 are returned
+// unchanged.
+Block optimize(const Block& block);
@@ -0,0 +1,455 @@
+#include "parser.h"
+#include "require.h"
+#include "stats.h"
+#include <initializer_list>
+
+
+namespace {
+
+enum class Keyword {
+    NONE,
+    NOT, SHL1, SHR1, SHR4, SHR16,
+    AND, OR, XOR, PLUS,
+    IF0, LAMBDA, FOLD
+};
+
+// Perfect on the keywords: a collision would be a duplicate case label in
+// keywordOf, so the compiler checks it.
+constexpr unsigned keywordHash(const char* s, size_t size)
+{
+    return size == 0 ? 0 :
+        (2u * static_cast<unsigned char>(s[0]) +
+         static_cast<unsigned char>(s[size < 3 ? size - 1 : 2]) +
+         static_cast<unsigned char>(s[size - 1])) % 32;
+}
+
+template <size_t N>
+constexpr unsigned keywordHash(const char (&s)[N])
+{
+    return keywordHash(s, N - 1);
+}
+
+Keyword keywordOf(StringRef token)
+{
+#define KEYWORD(name, keyword)                                                  \
+    case keywordHash(name):                                                     \
+        return token == StringRef(name, sizeof(name) - 1) ? keyword : Keyword::NONE;
+
+    switch (keywordHash(token.data(), token.size())) {
+    KEYWORD("not", Keyword::NOT)
+    KEYWORD("shl1", Keyword::SHL1)
+    KEYWORD("shr1", Keyword::SHR1)
+    KEYWORD("shr4", Keyword::SHR4)
+    KEYWORD("shr16", Keyword::SHR16)
+    KEYWORD("and", Keyword::AND)
+    KEYWORD("or", Keyword::OR)
+    KEYWORD("xor", Keyword::XOR)
+    KEYWORD("plus", Keyword::PLUS)
+    KEYWORD("if0", Keyword::IF0)
+    KEYWORD("lambda", Keyword::LAMBDA)
+    KEYWORD("fold", Keyword::FOLD)
+    default:
+        return Keyword::NONE;
+    }
+
+#undef KEYWORD
+}
+
+bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+bool isWordCharacter(char c)
+{
+    return isDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+int digitValue(char c)
+{
+    if (isDigit(c)) {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A' + 10;
+    }
+    return 64;
+}
+
+
+class Tokenizer {
+public:
+    explicit Tokenizer(StringRef text) : position_(text.begin()), end_(text.end()) { }
+
+    // Tokens are "(", ")" and words of [A-Za-z0-9_].
+    bool next(StringRef* const token)
+    {
+        while (position_ != end_ && isSpace(*position_)) {
+            ++position_;
+        }
+        if (position_ == end_) {
+            return false;
+        }
+
+        const char* const begin = position_;
+        if (*position_ == '(' || *position_ == ')') {
+            ++position_;
+        } else {
+            while (position_ != end_ && isWordCharacter(*position_)) {
+                ++position_;
+            }
+            if (position_ == begin) {
+                return false;
+            }
+        }
+        *token = StringRef(begin, position_ - begin);
+        return true;
+    }
+
+    bool next(char expected)
+    {
+        StringRef token;
+        return next(&token) && token.size() == 1 && token[0] == expected;
+    }
+
+private:
+    const char* position_;
+    const char* end_;
+};
+
+
+// Variables in scope; the one at index N lives in argument N. Lookup starts
+// from the innermost, so that fold variables shadow outer ones.
+class Variables {
+public:
+    Variables() : size_(0) { }
+
+    size_t size() const { return size_; }
+
+    bool push(StringRef name)
+    {
+        if (size_ == CAPACITY) {
+            return false;
+        }
+        names_[size_++] = name;
+        return true;
+    }
+
+    void pop(size_t count) { size_ -= count; }
+
+    int find(StringRef name) const
+    {
+        for (size_t index = size_; index-- > 0; ) {
+            if (names_[index] == name) {
+                return static_cast<int>(index);
+            }
+        }
+        return -1;
+    }
+
+private:
+    static const size_t CAPACITY = 8;
+
+    StringRef names_[CAPACITY];
+    size_t size_;
+};
+
+// What parseLambda hashes a term to. Chains of one commutative and
+// associative operator are hashed by the sum of the hashes of their operands,
+// so neither the order nor the nesting of the operands changes the result;
+// variables are hashed by argument, not by name.
+struct CanonicalTerm {
+    Keyword chain;                          // AND .. PLUS for a chain of that operator, else NONE
+    Fingerprint sum;                        // of the operands of the chain
+    Fingerprint hash;
+};
+
+// Two independent chains of the finalizer; cheaper than fingerprint() on a
+// handful of words, which a program hashes once per term.
+Fingerprint hashWords(std::initializer_list<uint64_t> words)
+{
+    uint64_t low = 0x243f6a8885a308d3UL;
+    uint64_t high = 0x13198a2e03707344UL;
+    for (uint64_t word : words) {
+        low = fmix(low ^ word);
+        high = fmix(high + (word ^ 0xa4093822299f31d0UL));
+    }
+    return Fingerprint{low, high};
+}
+
+// Leaves are tagged with keywords that no operator hashes with.
+void setLeaf(Keyword tag, uint64_t value, CanonicalTerm* const term)
+{
+    term->chain = Keyword::NONE;
+    term->hash = hashWords({static_cast<uint64_t>(tag), value});
+}
+
+void setChain(Keyword keyword, const CanonicalTerm& lhs, const CanonicalTerm& rhs, CanonicalTerm* const term)
+{
+    const Fingerprint& lhsPart = lhs.chain == keyword ? lhs.sum : lhs.hash;
+    const Fingerprint& rhsPart = rhs.chain == keyword ? rhs.sum : rhs.hash;
+    term->chain = keyword;
+    term->sum = Fingerprint{lhsPart.low + rhsPart.low, lhsPart.high + rhsPart.high};
+    term->hash = hashWords({static_cast<uint64_t>(keyword), term->sum.low, term->sum.high});
+}
+
+bool isIdentifier(StringRef token)
+{
+    return !isDigit(token[0]) && token != StringRef("(", 1) && token != StringRef(")", 1) &&
+           keywordOf(token) == Keyword::NONE;
+}
+
+// Sets *term unless it is null.
+bool readBlock(Tokenizer* const tokenizer, Variables* const variables, Block* const block,
+               CanonicalTerm* const term)
+{
+    StringRef token;
+    if (!tokenizer->next(&token)) {
+        return false;
+    }
+
+    const int variable = variables->find(token);
+    if (variable >= 0) {
+        block->emitLoadArg(variable);
+        if (term) {
+            setLeaf(Keyword::LAMBDA, variable, term);
+        }
+        return true;
+    }
+
+    uint64_t c;
+    if (toInteger(token, &c)) {
+        block->emitLoadConst(c);
+        if (term) {
+            setLeaf(Keyword::NONE, c, term);
+        }
+        return true;
+    }
+
+    if (token != StringRef("(", 1) || !tokenizer->next(&token)) {
+        return false;
+    }
+
+    const Keyword keyword = keywordOf(token);
+    switch (keyword) {
+    case Keyword::NOT:
+    case Keyword::SHL1:
+    case Keyword::SHR1:
+    case Keyword::SHR4:
+    case Keyword::SHR16: {
+        CanonicalTerm operand;
+        if (!readBlock(tokenizer, variables, block, term ? &operand : nullptr) || !tokenizer->next(')')) {
+            return false;
+        }
+        switch (keyword) {
+        case Keyword::NOT:   block->emitNot(); break;
+        case Keyword::SHL1:  block->emitShl1(); break;
+        case Keyword::SHR1:  block->emitShr1(); break;
+        case Keyword::SHR4:  block->emitShr4(); break;
+        default:             block->emitShr16(); break;
+        }
+        if (term) {
+            term->chain = Keyword::NONE;
+            term->hash = hashWords({static_cast<uint64_t>(keyword), operand.hash.low, operand.hash.high});
+        }
+        return true;
+    }
+
+    case Keyword::AND:
+    case Keyword::OR:
+    case Keyword::XOR:
+    case Keyword::PLUS: {
+        CanonicalTerm lhs, rhs;
+        if (!readBlock(tokenizer, variables, block, term ? &lhs : nullptr) ||
+            !readBlock(tokenizer, variables, block, term ? &rhs : nullptr) ||
+            !tokenizer->next(')'))
+        {
+            return false;
+        }
+        switch (keyword) {
+        case Keyword::AND:   block->emitAnd(); break;
+        case Keyword::OR:    block->emitOr(); break;
+        case Keyword::XOR:   block->emitXor(); break;
+        default:             block->emitPlus(); break;
+        }
+        if (term) {
+            setChain(keyword, lhs, rhs, term);
+        }
+        return true;
+    }
+
+    case Keyword::IF0: {
+        // The branches go straight into block; see Block::beginIf0.
+        CanonicalTerm condition, ifTerm, elseTerm;
+        if (!readBlock(tokenizer, variables, block, term ? &condition : nullptr)) {
+            return false;
+        }
+        const Block::Patch ifPatch = block->beginIf0();
+        if (!readBlock(tokenizer, variables, block, term ? &ifTerm : nullptr)) {
+            return false;
+        }
+        const Block::Patch elsePatch = block->elseIf0(ifPatch);
+        if (!readBlock(tokenizer, variables, block, term ? &elseTerm : nullptr) ||
+            !tokenizer->next(')'))
+        {
+            return false;
+        }
+        block->endIf0(elsePatch);
+        if (term) {
+            term->chain = Keyword::NONE;
+            term->hash = hashWords({static_cast<uint64_t>(keyword), condition.hash.low, condition.hash.high,
+                                    ifTerm.hash.low, ifTerm.hash.high, elseTerm.hash.low, elseTerm.hash.high});
+        }
+        return true;
+    }
+
+    case Keyword::FOLD: {
+        // "(fold integer accumulator (lambda (x y) block))"
+        // integer accumulator FOLD_BEGIN x $block FOLD_NEXT x
+        CanonicalTerm value, accumulator, body;
+        if (!readBlock(tokenizer, variables, block, term ? &value : nullptr) ||
+            !readBlock(tokenizer, variables, block, term ? &accumulator : nullptr))
+        {
+            return false;
+        }
+
+        StringRef leftArg, rightArg;
+        if (!tokenizer->next('(') ||
+            !tokenizer->next(&token) || keywordOf(token) != Keyword::LAMBDA ||
+            !tokenizer->next('(') ||
+            !tokenizer->next(&leftArg) || !isIdentifier(leftArg) ||
+            !tokenizer->next(&rightArg) || !isIdentifier(rightArg) ||
+            !tokenizer->next(')') ||
+            leftArg == rightArg)
+        {
+            return false;
+        }
+
+        const int leftArgN = variables->size();
+        if (!variables->push(leftArg) || !variables->push(rightArg)) {
+            return false;
+        }
+        const Block::Patch foldPatch = block->beginFold(leftArgN);
+        const bool parsed = readBlock(tokenizer, variables, block, term ? &body : nullptr);
+        variables->pop(2);
+        if (!parsed) {
+            return false;
+        }
+        block->endFold(foldPatch);
+        if (term) {
+            // The body refers to the lambda's variables by argument, so
+            // renaming them does not change its hash.
+            term->chain = Keyword::NONE;
+            term->hash = hashWords({static_cast<uint64_t>(keyword), value.hash.low, value.hash.high,
+                                    accumulator.hash.low, accumulator.hash.high, body.hash.low, body.hash.high});
+        }
+        return tokenizer->next(')') && tokenizer->next(')');
+    }
+
+    default:
+        return false;
+    }
+}
+
+bool readLambda(Tokenizer* const tokenizer, Block* const block, CanonicalTerm* const term)
+{
+    StringRef token;
+    if (!tokenizer->next('(') ||
+        !tokenizer->next(&token) || keywordOf(token) != Keyword::LAMBDA ||
+        !tokenizer->next('('))
+    {
+        return false;
+    }
+
+    Variables variables;
+    while (tokenizer->next(&token) && isIdentifier(token)) {
+        if (!variables.push(token)) {
+            return false;
+        }
+    }
+
+    return
+        token == StringRef(")", 1) &&
+        readBlock(tokenizer, &variables, block, term) &&
+        tokenizer->next(')');
+}
+
+Block parse(StringRef expression, CanonicalTerm* const term)
+{
+    ScopedTimer timer(StatsTimer::PARSE);
+    Block result(0);
+    // Unless most of its tokens are small constants, a program has fewer
+    // bytes of code than of text, so this is the only allocation.
+    result.reserve(expression.size());
+    Tokenizer tokenizer(expression);
+    StringRef rest;
+    require (readLambda(&tokenizer, &result, term) && !tokenizer.next(&rest), "Unabled to parse lambda expression.");
+
+    return result;
+}
+
+} // namespace
+
+
+bool toInteger(StringRef input, uint64_t* const result)
+{
+    const char* position = input.begin();
+    const char* const end = input.end();
+    while (position != end && isSpace(*position)) {
+        ++position;
+    }
+    bool negative = false;
+    if (position != end && (*position == '+' || *position == '-')) {
+        negative = *position == '-';
+        ++position;
+    }
+
+    int base = 10;
+    if (end - position > 1 && position[0] == '0' && (position[1] == 'x' || position[1] == 'X') &&
+        end - position > 2 && digitValue(position[2]) < 16)
+    {
+        base = 16;
+        position += 2;
+    } else if (position != end && *position == '0') {
+        base = 8;
+    }
+    if (position == end) {
+        return false;
+    }
+
+    uint64_t value = 0;
+    bool overflow = false;
+    for (; position != end; ++position) {
+        const int digit = digitValue(*position);
+        if (digit >= base) {
+            return false;
+        }
+        if (value > (UINT64_MAX - digit) / base) {
+            overflow = true;
+        }
+        value = value * base + digit;
+    }
+    *result = overflow ? UINT64_MAX : negative ? -value : value;
+    return true;
+}
+
+Block parseLambda(StringRef expression)
+{
+    return parse(expression, nullptr);
+}
+
+Block parseLambda(StringRef expression, Fingerprint* const canonical)
+{
+    CanonicalTerm term;
+    Block result = parse(expression, &term);
+    *canonical = term.hash;
+    return result;
+}
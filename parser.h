@@ -0,0 +1,47 @@
+#pragma once
+
+#include "block.h"
+#include "fingerprint.h"
+#include <cstring>
+#include <string>
+
+// Non-owning view of a character range; the parser works on slices of the
+// input buffer without copying them.
+class StringRef {
+public:
+    StringRef() : data_(nullptr), size_(0) { }
+    StringRef(const char* data, size_t size) : data_(data), size_(size) { }
+    StringRef(const char* string) : data_(string), size_(std::strlen(string)) { }
+    StringRef(const std::string& string) : data_(string.data()), size_(string.size()) { }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+    char operator[](size_t index) const { return data_[index]; }
+
+    std::string str() const { return std::string(data_, size_); }
+
+    bool operator==(StringRef other) const
+    {
+        return size_ == other.size_ && std::memcmp(data_, other.data_, size_) == 0;
+    }
+    bool operator!=(StringRef other) const { return !(*this == other); }
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+// Integer in C notation (decimal, 0x hexadecimal or 0 octal) covering the
+// whole input, with the results of strtoull for a sign and for overflow.
+bool toInteger(StringRef input, uint64_t* result);
+
+// Parses "(lambda (x ...) expression)". Throws when the text is not a valid
+// program.
+Block parseLambda(StringRef expression);
+// Also sets canonical to a hash of the program that does not change with
+// the order or nesting of the operands of and, or, xor and plus, nor with the
+// names of variables; such programs compute the same outputs.
+Block parseLambda(StringRef expression, Fingerprint* canonical);
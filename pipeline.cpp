@@ -0,0 +1,308 @@
+#include "pipeline.h"
+#include "stats.h"
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace {
+
+// Batches a worker may have queued before the reader moves on to the next.
+const size_t WORKER_QUEUE_CAPACITY = 4;
+// Batches per worker an ordered pipeline may have read but not written.
+const size_t REORDER_BATCHES = 2 * WORKER_QUEUE_CAPACITY;
+
+size_t roundUpToPowerOfTwo(size_t value)
+{
+    size_t result = 2;
+    while (result < value) {
+        result *= 2;
+    }
+    return result;
+}
+
+// Waits on event until ready() holds, counting the times it slept.
+template <class Ready>
+void await(EventCount* const event, const Ready& ready)
+{
+    const size_t sleeps = event->wait(ready);
+    if (sleeps > 0) {
+        addStat(StatsCounter::QUEUE_WAITS, sleeps);
+    }
+}
+
+void pinToCpu(std::thread* const thread, size_t index)
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    if (::sched_getaffinity(0, sizeof(cpus), &cpus) != 0 || CPU_COUNT(&cpus) == 0) {
+        return;
+    }
+    // The index-th CPU this process may run on.
+    size_t remaining = index % CPU_COUNT(&cpus);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &cpus) && remaining-- == 0) {
+            cpu_set_t target;
+            CPU_ZERO(&target);
+            CPU_SET(cpu, &target);
+            ::pthread_setaffinity_np(thread->native_handle(), sizeof(target), &target);
+            return;
+        }
+    }
+#else
+    (void)thread;
+    (void)index;
+#endif
+}
+
+} // namespace
+
+
+const size_t Pipeline::BATCH_BYTES;
+const size_t Pipeline::BATCH_ITEMS;
+
+size_t Pipeline::hardwareThreads()
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    if (::sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0) {
+        return CPU_COUNT(&cpus);
+    }
+#endif
+    const size_t result = std::thread::hardware_concurrency();
+    return result > 0 ? result : 1;
+}
+
+Pipeline::Pipeline(size_t workerCount, bool pin, bool ordered)
+  : workerCount_(workerCount)
+  , pin_(pin)
+  , ordered_(ordered)
+  , reorderWindow_(workerCount * REORDER_BATCHES)
+  , readerDone_(false)
+  , workersRunning_(0)
+  , written_(0)
+{
+    require (workerCount > 0, "Pipeline: At least one worker is needed.");
+    for (size_t index = 0; index < workerCount; ++index) {
+        workerQueues_.emplace_back(new BoundedQueue<BatchPtr>(WORKER_QUEUE_CAPACITY, &dealt_, &taken_));
+    }
+    writerQueue_.reset(new BoundedQueue<BatchPtr>(roundUpToPowerOfTwo(workerCount * WORKER_QUEUE_CAPACITY),
+                                                  &finished_, &collected_));
+}
+
+void Pipeline::run(ChunkedInput* const input, const ProcessorFactory& factory,
+                   std::ostream& output, std::ostream& errors)
+{
+    run([input](BatchPtr* const batch) {
+            StringRef chunk;
+            if (!input->nextChunk(&chunk)) {
+                return false;
+            }
+            batch->reset(new Batch());
+            (*batch)->text = chunk;
+            (*batch)->offset = input->offsetOf(chunk);
+            return true;
+        },
+        textProcessor(factory), output, errors);
+}
+
+void Pipeline::run(std::istream& input, const ProcessorFactory& factory,
+                   std::ostream& output, std::ostream& errors)
+{
+    // The partial last line of a read is carried over to the next batch.
+    std::string carry;
+    uint64_t position = 0;                  // bytes read so far
+    run([&input, &carry, &position](BatchPtr* const batch) {
+            if (!input && carry.empty()) {
+                return false;
+            }
+            batch->reset(new Batch());
+            (*batch)->offset = position - carry.size();
+            std::string& storage = (*batch)->storage;
+            storage.swap(carry);
+            // Lines longer than a batch make it grow until they end.
+            for (size_t lineEnd = std::string::npos; input && lineEnd == std::string::npos; ) {
+                const size_t size = storage.size();
+                storage.resize(size + BATCH_BYTES);
+                input.read(&storage[size], BATCH_BYTES);
+                storage.resize(size + input.gcount());
+                position += input.gcount();
+                lineEnd = storage.rfind('\n');
+                if (input && lineEnd != std::string::npos) {
+                    carry.assign(storage, lineEnd + 1, std::string::npos);
+                    storage.resize(lineEnd + 1);
+                }
+            }
+            (*batch)->text = StringRef(storage);
+            return true;
+        },
+        textProcessor(factory), output, errors);
+}
+
+void Pipeline::run(size_t count, const IndexProcessorFactory& factory, std::ostream& output, std::ostream& errors)
+{
+    size_t next = 0;
+    run([count, &next](BatchPtr* const batch) {
+            if (next == count) {
+                return false;
+            }
+            batch->reset(new Batch());
+            (*batch)->first = next;
+            next = std::min(count, next + BATCH_ITEMS);
+            (*batch)->last = next;
+            return true;
+        },
+        [&factory]() -> BatchProcessor {
+            const IndexProcessor process = factory();
+            return [process](Batch* const batch) {
+                for (size_t index = batch->first; index < batch->last; ++index) {
+                    process(index, &batch->output, &batch->errors);
+                }
+            };
+        },
+        output, errors);
+}
+
+std::function<Pipeline::BatchProcessor()> Pipeline::textProcessor(const ProcessorFactory& factory)
+{
+    return [&factory]() -> BatchProcessor {
+        const Processor process = factory();
+        return [process](Batch* const batch) {
+            StringRef text = batch->text;
+            for (StringRef program; popProgram(&text, &program); ) {
+                process(program, batch->offset + (program.data() - batch->text.data()), &batch->output, &batch->errors);
+            }
+        };
+    };
+}
+
+void Pipeline::run(const std::function<bool(BatchPtr*)>& read, const std::function<BatchProcessor()>& factory,
+                   std::ostream& output, std::ostream& errors)
+{
+    readerDone_ = false;
+    workersRunning_ = workerCount_;
+    written_ = 0;
+
+    std::vector<std::thread> threads;
+    threads.emplace_back(&Pipeline::readerMain, this, std::cref(read));
+    threads.emplace_back(&Pipeline::writerMain, this, std::ref(output), std::ref(errors));
+    for (size_t index = 0; index < workerCount_; ++index) {
+        threads.emplace_back(&Pipeline::workerMain, this, index, std::cref(factory));
+        if (pin_) {
+            pinToCpu(&threads.back(), index);
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void Pipeline::readerMain(const std::function<bool(BatchPtr*)>& read)
+{
+    size_t next = 0;
+    size_t sequence = 0;
+    for (BatchPtr batch; ; ++sequence) {
+        // The writer holds every batch read before this one that it has not
+        // written yet, so the wait bounds its buffer.
+        if (ordered_) {
+            await(&moved_, [this, sequence]() {
+                return sequence - written_.load(std::memory_order_acquire) < reorderWindow_;
+            });
+        }
+        if (!read(&batch)) {
+            break;
+        }
+        batch->sequence = sequence;
+        // Deal round robin, skipping workers that are still busy.
+        await(&taken_, [this, &next, &batch]() {
+            for (size_t tries = 0; tries < workerCount_; ++tries, next = (next + 1) % workerCount_) {
+                if (workerQueues_[next]->tryPush(std::move(batch))) {
+                    return true;
+                }
+            }
+            return false;
+        });
+        next = (next + 1) % workerCount_;
+    }
+    readerDone_.store(true, std::memory_order_release);
+    dealt_.notifyAll();
+}
+
+// Own queue first, then the others.
+bool Pipeline::takeBatch(size_t index, BatchPtr* const batch)
+{
+    for (size_t offset = 0; offset < workerCount_; ++offset) {
+        if (workerQueues_[(index + offset) % workerCount_]->tryPop(batch)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Pipeline::workerMain(size_t index, const std::function<BatchProcessor()>& factory)
+{
+    const BatchProcessor process = factory();
+    for (;;) {
+        BatchPtr batch;
+        await(&dealt_, [this, index, &batch]() {
+            // Batches pushed before the reader finished are visible once it
+            // has.
+            const bool done = readerDone_.load(std::memory_order_acquire);
+            return takeBatch(index, &batch) || done;
+        });
+        if (!batch) {
+            break;
+        }
+
+        process(batch.get());
+        await(&collected_, [this, &batch]() { return writerQueue_->tryPush(std::move(batch)); });
+    }
+    if (workersRunning_.fetch_sub(1, std::memory_order_release) == 1) {
+        finished_.notifyAll();
+    }
+}
+
+void Pipeline::writerMain(std::ostream& output, std::ostream& errors)
+{
+    // Batches that finished ahead of their turn when ordered, by sequence
+    // modulo the window.
+    std::vector<BatchPtr> pending(ordered_ ? reorderWindow_ : 0);
+    size_t written = 0;
+    for (;;) {
+        BatchPtr batch;
+        await(&finished_, [this, &batch]() {
+            const bool done = workersRunning_.load(std::memory_order_acquire) == 0;
+            return writerQueue_->tryPop(&batch) || done;
+        });
+        if (!batch) {
+            break;
+        }
+        if (!ordered_) {
+            write(*batch, output, errors);
+            continue;
+        }
+        pending[batch->sequence % reorderWindow_] = std::move(batch);
+        // Writes every batch that is now next in turn.
+        while (pending[written % reorderWindow_]) {
+            const BatchPtr next = std::move(pending[written % reorderWindow_]);
+            write(*next, output, errors);
+            written_.store(++written, std::memory_order_release);
+            moved_.notifyOne();
+        }
+    }
+    output.flush();
+}
+
+void Pipeline::write(const Batch& batch, std::ostream& output, std::ostream& errors)
+{
+    ScopedTimer timer(StatsTimer::WRITE);
+    addStat(StatsCounter::BATCHES);
+    output.write(batch.output.data(), batch.output.size());
+    errors.write(batch.errors.data(), batch.errors.size());
+}
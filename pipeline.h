@@ -0,0 +1,94 @@
+#pragma once
+
+#include "input.h"
+#include "queue.h"
+#include <atomic>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Reader, eval workers and writer connected by lock-free queues.
+//
+// The reader cuts the corpus into batches of whole lines and deals them out
+// to the workers' queues; a worker whose queue runs dry steals from the
+// others. Workers append their results to the batch, which then goes to the
+// writer, so no stage shares a lock with another. A stage with nothing to do
+// sleeps on an EventCount until the queue it waits for changes. Output order follows batch
+// completion, as with the threads it replaces, unless the pipeline is ordered:
+// then the writer holds back the batches that finish early and writes them in
+// input order, and the reader stays a few batches per worker ahead of it.
+class Pipeline {
+public:
+    // Appends the result of program, which starts offset bytes into the
+    // input, to output, or a message to errors.
+    typedef std::function<void(StringRef program, uint64_t offset, std::string* output, std::string* errors)> Processor;
+    // Called once on each worker thread, for per-thread state.
+    typedef std::function<Processor()> ProcessorFactory;
+
+    // Same for sources of numbered items, such as a Corpus.
+    typedef std::function<void(size_t index, std::string* output, std::string* errors)> IndexProcessor;
+    typedef std::function<IndexProcessor()> IndexProcessorFactory;
+
+    // Bytes of input per batch read from a stream.
+    static const size_t BATCH_BYTES = size_t(64) << 10;
+    // Items per batch of numbered items.
+    static const size_t BATCH_ITEMS = 256;
+
+    // Threads the machine runs at once; never 0.
+    static size_t hardwareThreads();
+
+    // pin binds worker N to CPU N (modulo the CPU count) where supported.
+    Pipeline(size_t workerCount, bool pin, bool ordered = false);
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    void run(ChunkedInput* input, const ProcessorFactory& factory, std::ostream& output, std::ostream& errors);
+    void run(std::istream& input, const ProcessorFactory& factory, std::ostream& output, std::ostream& errors);
+    // Items 0 .. count - 1.
+    void run(size_t count, const IndexProcessorFactory& factory, std::ostream& output, std::ostream& errors);
+
+private:
+    struct Batch {
+        std::string storage;                // the lines, unless text points into a mapped file
+        StringRef text;
+        uint64_t offset;                    // of text in the input
+        size_t sequence;                    // of the batch in the input
+        size_t first;                       // items [first, last) when numbered
+        size_t last;
+        std::string output;
+        std::string errors;
+    };
+    typedef std::unique_ptr<Batch> BatchPtr;
+    typedef std::function<void(Batch*)> BatchProcessor;
+
+    static std::function<BatchProcessor()> textProcessor(const ProcessorFactory& factory);
+    void run(const std::function<bool(BatchPtr*)>& read, const std::function<BatchProcessor()>& factory,
+             std::ostream& output, std::ostream& errors);
+    void readerMain(const std::function<bool(BatchPtr*)>& read);
+    void workerMain(size_t index, const std::function<BatchProcessor()>& factory);
+    void writerMain(std::ostream& output, std::ostream& errors);
+    static void write(const Batch& batch, std::ostream& output, std::ostream& errors);
+    bool takeBatch(size_t index, BatchPtr* batch);
+
+    const size_t workerCount_;
+    const bool pin_;
+    const bool ordered_;
+    // Batches that may be read but not yet written when ordered.
+    const size_t reorderWindow_;
+    // Notified on pushes to and pops from any worker queue, and on pushes to
+    // and pops from the writer queue; dealt_ also when the reader is done,
+    // finished_ when the workers are.
+    EventCount dealt_;
+    EventCount taken_;
+    EventCount finished_;
+    EventCount collected_;
+    EventCount moved_;                      // notified as written_ grows
+    std::vector<std::unique_ptr<BoundedQueue<BatchPtr>>> workerQueues_;
+    std::unique_ptr<BoundedQueue<BatchPtr>> writerQueue_;
+    std::atomic<bool> readerDone_;
+    std::atomic<size_t> workersRunning_;
+    std::atomic<size_t> written_;           // batches written so far
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "require.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Lets threads wait for a condition that others make true without a lock
+// (an event count): a waiter checks the condition a few times, yielding in
+// between, and then sleeps until notified. Notifying costs a fence and a
+// load while nobody sleeps.
+class EventCount {
+public:
+    // Checks of the condition before a waiter goes to sleep.
+    static const size_t SPIN_COUNT = 64;
+
+    EventCount()
+      : waiters_(0)
+      , epoch_(0)
+    { }
+
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    // Returns once ready() holds, which is called without a lock after every
+    // notification; the number of times the caller slept.
+    template <typename Ready>
+    size_t wait(const Ready& ready)
+    {
+        for (size_t spin = 0; spin < SPIN_COUNT; ++spin) {
+            if (ready()) {
+                return 0;
+            }
+            std::this_thread::yield();
+        }
+        for (size_t sleeps = 0; ; ++sleeps) {
+            // Announced before the last check, so that a notifier either
+            // sees the waiter or the waiter sees what it changed.
+            waiters_.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const size_t epoch = epoch_.load(std::memory_order_acquire);
+            if (ready()) {
+                waiters_.fetch_sub(1, std::memory_order_relaxed);
+                return sleeps;
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (epoch_.load(std::memory_order_relaxed) == epoch) {
+                    condition_.wait(lock);
+                }
+            }
+            waiters_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Called after the change that may make a condition true.
+    void notifyOne() { notify(false); }
+    void notifyAll() { notify(true); }
+
+private:
+    void notify(bool all)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        epoch_.fetch_add(1, std::memory_order_release);
+        if (all) {
+            condition_.notify_all();
+        } else {
+            condition_.notify_one();
+        }
+    }
+
+    std::atomic<size_t> waiters_;
+    std::atomic<size_t> epoch_;             // advanced by notifications with waiters
+    std::mutex mutex_;
+    std::condition_variable condition_;
+};
+
+// Bounded multi-producer multi-consumer queue without locks (D. Vyukov's
+// sequence-numbered ring). Every cell carries the position it expects next:
+// equal to the tail when it can be written, to head + 1 when it can be read.
+template <typename T>
+class BoundedQueue {
+public:
+    // capacity is a power of two. pushed and popped, unless null, are
+    // notified after every push and pop, so that threads can wait on them for
+    // the queue to change; several queues may share them.
+    explicit BoundedQueue(size_t capacity, EventCount* pushed = nullptr, EventCount* popped = nullptr)
+      : cells_(new Cell[capacity])
+      , mask_(capacity - 1)
+      , pushed_(pushed)
+      , popped_(popped)
+      , head_(0)
+      , tail_(0)
+    {
+        require (capacity >= 2 && (capacity & mask_) == 0, "BoundedQueue: Capacity must be a power of two.");
+        for (size_t index = 0; index < capacity; ++index) {
+            cells_[index].sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // False, leaving value alone, when the queue is full.
+    bool tryPush(T&& value)
+    {
+        size_t position = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[position & mask_];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    if (pushed_) {
+                        pushed_->notifyOne();
+                    }
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // False when the queue is empty.
+    bool tryPop(T* const value)
+    {
+        size_t position = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[position & mask_];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0) {
+                if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    *value = std::move(cell.value);
+                    cell.sequence.store(position + mask_ + 1, std::memory_order_release);
+                    if (popped_) {
+                        popped_->notifyOne();
+                    }
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    // Producers and consumers work on different cache lines.
+    static const size_t CACHE_LINE = 64;
+
+    const std::unique_ptr<Cell[]> cells_;
+    const size_t mask_;
+    EventCount* const pushed_;
+    EventCount* const popped_;
+    char padding0_[CACHE_LINE];
+    std::atomic<size_t> head_;
+    char padding1_[CACHE_LINE];
+    std::atomic<size_t> tail_;
+    char padding2_[CACHE_LINE];
+};
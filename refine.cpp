@@ -0,0 +1,144 @@
+#include "refine.h"
+#include "require.h"
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+
+namespace {
+
+// Programs a thread claims at a time.
+const size_t CHUNK_PROGRAMS = 64;
+
+// Programs order[first, last) that agree on the inputs run so far.
+struct Group {
+    size_t first;
+    size_t last;
+};
+
+bool isSmaller(const std::string& lhs, const std::string& rhs)
+{
+    if (lhs.size() != rhs.size()) {
+        return lhs.size() < rhs.size();
+    }
+    return lhs < rhs;
+}
+
+} // namespace
+
+
+Refiner::Refiner(std::vector<uint64_t> inputs, size_t firstRound, size_t threads)
+  : inputs_(std::move(inputs))
+  , firstRound_(firstRound)
+  , threads_(threads)
+{
+    require (firstRound > 0, "Refiner: The first round needs inputs.");
+    require (threads > 0, "Refiner: At least one thread is needed.");
+}
+
+void Refiner::add(StringRef program)
+{
+    Block block = parseLambda(program);
+    programs_.push_back(Program{program.str(), std::move(block)});
+    addStat(StatsCounter::PROGRAMS);
+}
+
+std::vector<Refiner::Class> Refiner::run() const
+{
+    std::vector<Class> result;
+    std::vector<size_t> order(programs_.size());
+    for (size_t index = 0; index < order.size(); ++index) {
+        order[index] = index;
+    }
+    std::vector<Group> groups;
+    if (!order.empty()) {
+        groups.push_back(Group{0, order.size()});
+    }
+
+    std::vector<size_t> active;                     // programs of the open groups, group by group
+    std::vector<Row> rows;                          // row N for active[N]
+    std::vector<Group> open;
+    for (size_t begin = 0, round = firstRound_; !groups.empty(); round = std::min(2 * round, inputs_.size())) {
+        // A group is a class once it holds one program or has run on every
+        // input.
+        open.clear();
+        for (const Group& group : groups) {
+            if (group.last - group.first > 1 && begin < inputs_.size()) {
+                open.push_back(group);
+                continue;
+            }
+            Class entry = {group.last - group.first, begin, programs_[order[group.first]].text};
+            for (size_t index = group.first + 1; index < group.last; ++index) {
+                const std::string& text = programs_[order[index]].text;
+                if (isSmaller(text, entry.representative)) {
+                    entry.representative = text;
+                }
+            }
+            result.push_back(std::move(entry));
+        }
+        groups.clear();
+        if (open.empty()) {
+            break;
+        }
+
+        const size_t end = std::min(inputs_.size(), begin + round);
+        active.clear();
+        for (const Group& group : open) {
+            active.insert(active.end(), order.begin() + group.first, order.begin() + group.last);
+        }
+        evaluate(active, begin, end, &rows);
+
+        // Splits every open group into runs of equal outputs on this round.
+        auto row = rows.begin();
+        for (const Group& group : open) {
+            const auto rowEnd = row + (group.last - group.first);
+            std::sort(row, rowEnd, [](const Row& lhs, const Row& rhs) { return lhs.outputs < rhs.outputs; });
+            for (size_t first = group.first; row != rowEnd; ) {
+                const Fingerprint outputs = row->outputs;
+                size_t last = first;
+                for (; row != rowEnd && row->outputs == outputs; ++row, ++last) {
+                    order[last] = row->program;
+                }
+                groups.push_back(Group{first, last});
+                first = last;
+            }
+        }
+        begin = end;
+    }
+
+    std::sort(result.begin(), result.end(), [](const Class& lhs, const Class& rhs) {
+        return isSmaller(lhs.representative, rhs.representative);
+    });
+    return result;
+}
+
+void Refiner::evaluate(const std::vector<size_t>& active, size_t begin, size_t end,
+                       std::vector<Row>* const rows) const
+{
+    const size_t width = end - begin;
+    rows->resize(active.size());
+    std::atomic<size_t> next(0);
+    const auto work = [this, &active, begin, width, rows, &next]() {
+        std::vector<uint64_t> outputs(width);
+        for (size_t first; (first = next.fetch_add(CHUNK_PROGRAMS)) < active.size(); ) {
+            const size_t last = std::min(active.size(), first + CHUNK_PROGRAMS);
+            for (size_t index = first; index < last; ++index) {
+                programs_[active[index]].block.executeBatch(&inputs_[begin], width, outputs.data());
+                (*rows)[index] = Row{fingerprint(outputs.data(), width), active[index]};
+            }
+            addStat(StatsCounter::REFINE_RUNS, (last - first) * width);
+        }
+    };
+
+    // Late rounds often have too few programs to be worth a thread.
+    const size_t threadCount = std::min(threads_, (active.size() + CHUNK_PROGRAMS - 1) / CHUNK_PROGRAMS);
+    std::vector<std::thread> threads;
+    for (size_t index = 1; index < threadCount; ++index) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
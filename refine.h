@@ -0,0 +1,61 @@
+#pragma once
+
+#include "block.h"
+#include "fingerprint.h"
+#include "parser.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Classes of programs with equal outputs, found by progressive refinement.
+//
+// Every program first runs on a short prefix of the inputs, and programs
+// are grouped by their outputs on it. Only the groups of two or more then
+// run on the next inputs, twice as many each round, and split by those
+// outputs in turn, until every group is a single program or the inputs run
+// out. A program runs on as many inputs as it takes to tell it apart from
+// the others, not on all of them. Outputs are compared by fingerprint, as
+// by ClassTable, so that no round keeps them.
+class Refiner {
+public:
+    struct Class {
+        size_t size;
+        size_t inputs;                      // the members ran on inputs[0, inputs)
+        std::string representative;         // shortest, then lexicographically first
+    };
+
+    // firstRound > 0 inputs run in the first round; threads > 0 evaluate.
+    Refiner(std::vector<uint64_t> inputs, size_t firstRound, size_t threads);
+
+    Refiner(const Refiner&) = delete;
+    Refiner& operator=(const Refiner&) = delete;
+
+    // Throws when program does not parse.
+    void add(StringRef program);
+
+    size_t size() const { return programs_.size(); }
+
+    // Groups the programs added so far; the classes of two or more programs
+    // ran on all inputs. Ordered by representative.
+    std::vector<Class> run() const;
+
+private:
+    struct Program {
+        std::string text;
+        Block block;
+    };
+
+    // Fingerprint of the outputs of a program on the inputs of a round.
+    struct Row {
+        Fingerprint outputs;
+        size_t program;
+    };
+
+    // Runs programs_[active[N]] on inputs_[begin, end) into (*rows)[N].
+    void evaluate(const std::vector<size_t>& active, size_t begin, size_t end, std::vector<Row>* rows) const;
+
+    const std::vector<uint64_t> inputs_;
+    const size_t firstRound_;
+    const size_t threads_;
+    std::vector<Program> programs_;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Binary results written by --output=binary, meant to be mmapped: a header
+// followed by one fixed-size record per program, in the byte order of the
+// writing machine. Records follow the order of the text output.
+struct ResultFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+};
+
+struct ResultRecord {
+    uint64_t fingerprintLow;
+    uint64_t fingerprintHigh;
+    uint64_t offset;                        // of the program in the input
+    uint64_t size;                          // of the program text
+};
+
+const char RESULT_FILE_MAGIC[8] = {'B', 'V', 'R', 'E', 'S', 'U', 'L', 'T'};
+const uint32_t RESULT_FILE_VERSION = 1;
+
+inline ResultFileHeader resultFileHeader()
+{
+    ResultFileHeader result;
+    std::memcpy(result.magic, RESULT_FILE_MAGIC, sizeof(result.magic));
+    result.version = RESULT_FILE_VERSION;
+    result.recordSize = sizeof(ResultRecord);
+    return result;
+}
@@ -0,0 +1,490 @@
+#include "sliced.h"
+#include "require.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+
+namespace {
+
+const size_t PLANES = 64;
+const size_t LANES = 64;
+
+// Planes [width, PLANES) are zero, whatever they hold.
+struct Planes {
+    uint64_t plane[PLANES];
+    size_t width;
+};
+
+// Points past the top of the stack.
+typedef Planes* SlicedStack;
+
+size_t bitWidth(uint64_t value)
+{
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+void widen(Planes* const value, size_t width)
+{
+    for (size_t i = value->width; i < width; ++i) {
+        value->plane[i] = 0;
+    }
+    value->width = std::max(value->width, width);
+}
+
+void copyPlanes(const Planes& from, Planes* const to)
+{
+    std::copy(from.plane, from.plane + from.width, to->plane);
+    to->width = from.width;
+}
+
+void loadConst(Planes* const value, uint64_t c)
+{
+    value->width = bitWidth(c);
+    for (size_t i = 0; i < value->width; ++i) {
+        value->plane[i] = 0 - ((c >> i) & 1);
+    }
+}
+
+// The low byte of value, shifted down by offset bits.
+void loadByte(const Planes& value, size_t offset, Planes* const result)
+{
+    result->width = value.width > offset ? std::min<size_t>(8, value.width - offset) : 0;
+    std::copy(value.plane + offset, value.plane + offset + result->width, result->plane);
+}
+
+void slicedNot(SlicedStack* const stack)
+{
+    Planes* const a = &(*stack)[-1];
+    widen(a, PLANES);
+    for (size_t i = 0; i < PLANES; ++i) {
+        a->plane[i] = ~a->plane[i];
+    }
+}
+
+void slicedShl(Planes* const a, size_t shift)
+{
+    if (a->width == 0) {
+        return;
+    }
+    const size_t width = std::min(PLANES, a->width + shift);
+    for (size_t i = width; i-- > shift; ) {
+        a->plane[i] = a->plane[i - shift];
+    }
+    std::fill(a->plane, a->plane + std::min(shift, width), 0);
+    a->width = width;
+}
+
+void slicedShr(Planes* const a, size_t shift)
+{
+    if (a->width <= shift) {
+        a->width = 0;
+        return;
+    }
+    a->width -= shift;
+    for (size_t i = 0; i < a->width; ++i) {
+        a->plane[i] = a->plane[i + shift];
+    }
+}
+
+void slicedAnd(SlicedStack* const stack)
+{
+    Planes* const a = &(*stack)[-2];
+    const Planes* const b = &(*stack)[-1];
+    a->width = std::min(a->width, b->width);
+    for (size_t i = 0; i < a->width; ++i) {
+        a->plane[i] &= b->plane[i];
+    }
+    --*stack;
+}
+
+void slicedOr(SlicedStack* const stack)
+{
+    Planes* const a = &(*stack)[-2];
+    const Planes* const b = &(*stack)[-1];
+    widen(a, b->width);
+    for (size_t i = 0; i < b->width; ++i) {
+        a->plane[i] |= b->plane[i];
+    }
+    --*stack;
+}
+
+void slicedXor(SlicedStack* const stack)
+{
+    Planes* const a = &(*stack)[-2];
+    const Planes* const b = &(*stack)[-1];
+    widen(a, b->width);
+    for (size_t i = 0; i < b->width; ++i) {
+        a->plane[i] ^= b->plane[i];
+    }
+    --*stack;
+}
+
+// Ripple carry; the sum grows by a plane only when the carry out is nonzero.
+void slicedPlus(SlicedStack* const stack)
+{
+    Planes* const a = &(*stack)[-2];
+    Planes* const b = &(*stack)[-1];
+    const size_t width = std::max(a->width, b->width);
+    widen(a, width);
+    widen(b, width);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < width; ++i) {
+        const uint64_t x = a->plane[i];
+        const uint64_t y = b->plane[i];
+        a->plane[i] = x ^ y ^ carry;
+        carry = (x & y) | ((x ^ y) & carry);
+    }
+    if (carry != 0 && width < PLANES) {
+        a->plane[width] = carry;
+        a->width = width + 1;
+    }
+    --*stack;
+}
+
+void slicedUnfold(SlicedStack* const stack)
+{
+    Planes value;
+    copyPlanes((*stack)[-1], &value);
+    --*stack;
+    for (int offset = 56; offset >= 0; offset -= 8) {
+        loadByte(value, offset, (*stack)++);
+    }
+}
+
+// Stores value into the lanes of arg set in mask.
+void storeMasked(const Planes& value, uint64_t mask, Planes* const arg)
+{
+    if (mask == ~uint64_t(0)) {
+        copyPlanes(value, arg);
+        return;
+    }
+    const size_t width = std::max(value.width, arg->width);
+    widen(arg, width);
+    for (size_t i = 0; i < width; ++i) {
+        const uint64_t plane = i < value.width ? value.plane[i] : 0;
+        arg->plane[i] = (plane & mask) | (arg->plane[i] & ~mask);
+    }
+}
+
+void slicedStoreArg(SlicedStack* const stack, uint64_t mask, Planes* const arg)
+{
+    storeMasked((*stack)[-1], mask, arg);
+    --*stack;
+}
+
+// Pops the condition and returns the lanes where it is zero.
+uint64_t slicedPopZeroMask(SlicedStack* const stack)
+{
+    const Planes& a = *--*stack;
+    uint64_t nonzero = 0;
+    for (size_t i = 0; i < a.width; ++i) {
+        nonzero |= a.plane[i];
+    }
+    return ~nonzero;
+}
+
+// Replaces [.., ifValue, elseValue] by the per lane choice between them.
+void slicedSelect(SlicedStack* const stack, uint64_t ifMask)
+{
+    Planes* const a = &(*stack)[-2];
+    Planes* const b = &(*stack)[-1];
+    const size_t width = std::max(a->width, b->width);
+    widen(a, width);
+    widen(b, width);
+    for (size_t i = 0; i < width; ++i) {
+        a->plane[i] = (a->plane[i] & ifMask) | (b->plane[i] & ~ifMask);
+    }
+    --*stack;
+}
+
+void slicedFoldBegin(SlicedStack* const stack, uint64_t mask, Planes* const args)
+{
+    slicedStoreArg(stack, mask, &args[1]);
+    Planes* const value = &(*stack)[-1];
+    Planes byte;
+    loadByte(*value, 0, &byte);
+    storeMasked(byte, mask, &args[0]);
+    slicedShr(value, 8);
+    loadConst((*stack)++, 7);
+}
+
+// The counter is the same in every lane, so any lane tells its value.
+bool slicedFoldNext(SlicedStack* const stack, uint64_t mask, Planes* const args)
+{
+    Planes* const top = *stack;
+    uint64_t counter = 0;
+    for (size_t i = 0; i < top[-2].width; ++i) {
+        counter |= (top[-2].plane[i] & 1) << i;
+    }
+    if (counter == 0) {
+        copyPlanes(top[-1], &top[-3]);
+        *stack -= 2;
+        return false;
+    }
+    slicedStoreArg(stack, mask, &args[1]);
+    Planes byte;
+    loadByte(top[-3], 0, &byte);
+    storeMasked(byte, mask, &args[0]);
+    slicedShr(&top[-3], 8);
+    loadConst(&top[-2], counter - 1);
+    return true;
+}
+
+uint16_t jumpShift(const Op* code, size_t ip)
+{
+    return *(const uint16_t*)&code[ip + 1];
+}
+
+// Executes code[begin, end) like executeBatchRange; mask holds the live lanes.
+void executeSlicedRange(const Op* code, size_t begin, size_t end,
+                        uint64_t mask, Planes* const args, SlicedStack* const stack)
+{
+    size_t ip = begin;
+    while (ip < end) {
+        switch (code[ip]) {
+        case Op::NOT:
+            slicedNot(stack);
+            ++ip;
+            break;
+
+        case Op::SHL1:
+            slicedShl(&(*stack)[-1], 1);
+            ++ip;
+            break;
+
+        case Op::SHR1:
+            slicedShr(&(*stack)[-1], 1);
+            ++ip;
+            break;
+
+        case Op::SHR4:
+            slicedShr(&(*stack)[-1], 4);
+            ++ip;
+            break;
+
+        case Op::SHR16:
+            slicedShr(&(*stack)[-1], 16);
+            ++ip;
+            break;
+
+        case Op::AND:
+            slicedAnd(stack);
+            ++ip;
+            break;
+
+        case Op::OR:
+            slicedOr(stack);
+            ++ip;
+            break;
+
+        case Op::XOR:
+            slicedXor(stack);
+            ++ip;
+            break;
+
+        case Op::PLUS:
+            slicedPlus(stack);
+            ++ip;
+            break;
+
+        case Op::UNFOLD:
+            slicedUnfold(stack);
+            ++ip;
+            break;
+
+        case Op::STORE_ARG0:
+        case Op::STORE_ARG1:
+        case Op::STORE_ARG2:
+        case Op::STORE_ARG3:
+        case Op::STORE_ARG4:
+        case Op::STORE_ARG5:
+        case Op::STORE_ARG6:
+        case Op::STORE_ARG7:
+            slicedStoreArg(stack, mask, &args[static_cast<int>(code[ip]) - static_cast<int>(Op::STORE_ARG0)]);
+            ++ip;
+            break;
+
+        case Op::LOAD_ARG0:
+        case Op::LOAD_ARG1:
+        case Op::LOAD_ARG2:
+        case Op::LOAD_ARG3:
+        case Op::LOAD_ARG4:
+        case Op::LOAD_ARG5:
+        case Op::LOAD_ARG6:
+        case Op::LOAD_ARG7:
+            copyPlanes(args[static_cast<int>(code[ip]) - static_cast<int>(Op::LOAD_ARG0)], (*stack)++);
+            ++ip;
+            break;
+
+        case Op::LOAD_0:
+        case Op::LOAD_1:
+        case Op::LOAD_2:
+        case Op::LOAD_3:
+        case Op::LOAD_4:
+        case Op::LOAD_5:
+        case Op::LOAD_6:
+        case Op::LOAD_7:
+            loadConst((*stack)++, static_cast<int>(code[ip]) - static_cast<int>(Op::LOAD_0));
+            ++ip;
+            break;
+
+        case Op::LOAD_CONST:
+            loadConst((*stack)++, *(const uint64_t*)&code[ip + 1]);
+            ip += 9;
+            break;
+
+        case Op::SHL_N:
+            slicedShl(&(*stack)[-1], static_cast<size_t>(code[ip + 1]));
+            ip += 2;
+            break;
+
+        case Op::SHR_N:
+            slicedShr(&(*stack)[-1], static_cast<size_t>(code[ip + 1]));
+            ip += 2;
+            break;
+
+        case Op::DROP:
+            --*stack;
+            ++ip;
+            break;
+
+        case Op::JNZ: {
+            const size_t ifBegin = ip + 3;
+            const size_t ifEnd = ip + jumpShift(code, ip);
+            require (ifEnd + 3 <= end && code[ifEnd] == Op::JMP,
+                     "executeSliced: Unstructured control flow.");
+            const size_t elseBegin = ifEnd + 3;
+            const size_t elseEnd = elseBegin + jumpShift(code, ifEnd);
+            require (elseEnd <= end, "executeSliced: Unstructured control flow.");
+
+            const uint64_t zero = slicedPopZeroMask(stack);
+            if ((mask & zero) != 0) {
+                executeSlicedRange(code, ifBegin, ifEnd, mask & zero, args, stack);
+            } else {
+                (*stack)++->width = 0;
+            }
+            if ((mask & ~zero) != 0) {
+                executeSlicedRange(code, elseBegin, elseEnd, mask & ~zero, args, stack);
+            } else {
+                (*stack)++->width = 0;
+            }
+            slicedSelect(stack, zero);
+            ip = elseEnd;
+            break;
+        }
+
+        case Op::JMP:
+            require (false, "executeSliced: Unstructured control flow.");
+            break;
+
+        case Op::FOLD_BEGIN:
+            slicedFoldBegin(stack, mask, &args[static_cast<int>(code[ip + 1])]);
+            ip += 4;
+            break;
+
+        case Op::FOLD_NEXT:
+            if (slicedFoldNext(stack, mask, &args[static_cast<int>(code[ip + 1])])) {
+                ip -= jumpShift(code, ip + 1);
+            } else {
+                ip += 4;
+            }
+            break;
+        }
+    }
+}
+
+} // namespace
+
+
+void transpose64(uint64_t* const rows)
+{
+    // Swaps the off-diagonal blocks of ever smaller squares: 32x32, then
+    // 16x16 and so on down to single bits.
+    uint64_t mask = 0x00000000ffffffffUL;
+    for (size_t size = 32; size != 0; size >>= 1, mask ^= mask << size) {
+        for (size_t row = 0; row < 64; row = ((row | size) + 1) & ~size) {
+            const uint64_t swapped = ((rows[row] >> size) ^ rows[row | size]) & mask;
+            rows[row] ^= swapped << size;
+            rows[row | size] ^= swapped;
+        }
+    }
+}
+
+SlicedInputs::SlicedInputs(const uint64_t* const* inputs, size_t argc, size_t n)
+  : argc_(argc)
+  , size_(n)
+{
+    require (argc <= 8, "SlicedInputs: Unsupported argc.");
+    const size_t groups = (n + LANES - 1) / LANES;
+    planes_.resize(groups * argc * PLANES);
+    widths_.resize(groups * argc);
+    for (size_t group = 0; group < groups; ++group) {
+        const size_t offset = group * LANES;
+        const size_t width = std::min(LANES, n - offset);
+        for (size_t arg = 0; arg < argc; ++arg) {
+            uint64_t* const planes = &planes_[(group * argc + arg) * PLANES];
+            uint64_t any = 0;
+            if (inputs[arg]) {
+                for (size_t lane = 0; lane < width; ++lane) {
+                    planes[lane] = inputs[arg][offset + lane];
+                    any |= planes[lane];
+                }
+            }
+            transpose64(planes);
+            widths_[group * argc + arg] = bitWidth(any);
+        }
+    }
+}
+
+void executeSliced(const Block& block, const uint64_t* inputs, size_t n, uint64_t* out)
+{
+    executeSliced(block, SlicedInputs(&inputs, 1, n), out);
+}
+
+void executeSliced(const Block& block, const SlicedInputs& inputs, uint64_t* out)
+{
+    require (block.initalStackSize() == 0, "executeSliced: Block is not runnable.");
+    require (block.stackSize() == 1, "executeSliced: Block incomplete.");
+    // Both branches of an if0 run, one result on top of the other.
+    inputs.execute(BlockRef(block.code().data(), block.code().size(), block.maxStackSize(), BlockRef::TRUSTED),
+                   block.maxBranchStackSize(), out);
+}
+
+void executeSliced(const BlockRef& block, const SlicedInputs& inputs, uint64_t* out)
+{
+    // maxStackSize() does not bound the stack with both branches of an if0
+    // live, and a BlockRef from a corpus is only checked against it path by
+    // path, so the bound comes from the code.
+    inputs.execute(block, Block::maxBranchStackSize(block.code(), block.size(), 0), out);
+}
+
+void SlicedInputs::execute(const BlockRef& block, size_t stackSize, uint64_t* const out) const
+{
+    // Left uninitialized; values are written before they are read.
+    const std::unique_ptr<Planes[]> stack(new Planes[stackSize]);
+    for (size_t offset = 0, group = 0; offset < size_; offset += LANES, ++group) {
+        Planes args[8];
+        for (size_t arg = 0; arg < 8; ++arg) {
+            args[arg].width = 0;
+            if (arg < argc_) {
+                const size_t index = group * argc_ + arg;
+                args[arg].width = widths_[index];
+                std::copy(&planes_[index * PLANES], &planes_[index * PLANES] + args[arg].width,
+                          args[arg].plane);
+            }
+        }
+
+        SlicedStack top = stack.get();
+        executeSlicedRange(block.code(), 0, block.size(), ~uint64_t(0), args, &top);
+        Planes& result = stack[0];
+        const size_t width = std::min(LANES, size_ - offset);
+        if (result.width == 0) {
+            std::fill(out + offset, out + offset + width, 0);
+            continue;
+        }
+        widen(&result, PLANES);
+        transpose64(result.plane);
+        std::copy(result.plane, result.plane + width, out + offset);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "block.h"
+#include <vector>
+
+// Bit-sliced evaluation of a block on 64 inputs at a time.
+//
+// A value of 64 lanes is held as 64 bit planes: bit L of plane b is bit b of
+// lane L. Bitwise ops work plane by plane, shifts renumber planes and plus is
+// a ripple carry over them; if0 runs both branches under a one-word lane
+// mask, as executeBatch does with lane masks. Inputs are transposed into
+// planes once per 64 lanes and results transposed back.
+//
+// Every value also carries the number of low planes that may be nonzero, and
+// ops only touch those: a byte of fold, a constant or the result of a right
+// shift costs a few planes instead of 64.
+
+// Input columns transposed into planes once, for running any number of
+// blocks on them; argv = {inputs[0][i], .., inputs[argc - 1][i]}, and a null
+// column stands for zeros.
+class SlicedInputs {
+public:
+    SlicedInputs(const uint64_t* const* inputs, size_t argc, size_t n);
+
+    size_t size() const { return size_; }
+
+private:
+    friend void executeSliced(const BlockRef& block, const SlicedInputs& inputs, uint64_t* out);
+    friend void executeSliced(const Block& block, const SlicedInputs& inputs, uint64_t* out);
+
+    // Runs block with a stack of stackSize values.
+    void execute(const BlockRef& block, size_t stackSize, uint64_t* out) const;
+
+    size_t argc_;
+    size_t size_;
+    std::vector<uint64_t> planes_;          // 64 planes per argument per group of 64 lanes
+    std::vector<size_t> widths_;            // planes that may be nonzero, per argument per group
+};
+
+// Stores the results of block on every input into out[0..inputs.size()),
+// like executeBatch.
+void executeSliced(const BlockRef& block, const SlicedInputs& inputs, uint64_t* out);
+void executeSliced(const Block& block, const SlicedInputs& inputs, uint64_t* out);
+// Same as Block::executeBatch.
+void executeSliced(const Block& block, const uint64_t* inputs, size_t n, uint64_t* out);
+
+// Transposes the 64x64 bit matrix rows in place: bit j of rows[i] trades
+// places with bit i of rows[j].
+void transpose64(uint64_t* rows);
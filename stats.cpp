@@ -0,0 +1,368 @@
+#include "stats.h"
+#include "require.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+
+
+namespace {
+
+// Latency buckets: exact below 4 ns, then 4 per power of two, which bounds
+// the error of a percentile to 25%.
+const size_t SUB_BUCKET_BITS = 2;
+const size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+const size_t BUCKET_COUNT = 64 * SUB_BUCKETS;
+
+const size_t COUNTER_COUNT = static_cast<size_t>(StatsCounter::COUNT);
+const size_t TIMER_COUNT = static_cast<size_t>(StatsTimer::COUNT);
+const size_t OP_COUNT = static_cast<size_t>(Op::FOLD_NEXT) + 1;
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> total;
+};
+
+// Written by its thread only; the atomics are for concurrent readers.
+struct ThreadStats {
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+    Histogram timers[TIMER_COUNT];
+    std::atomic<uint64_t> opcodes[OP_COUNT];
+    std::atomic<bool> exited;               // set as the thread exits
+};
+
+std::atomic<bool> g_enabled(false);
+
+void markExited(void* stats)
+{
+    static_cast<ThreadStats*>(stats)->exited.store(true, std::memory_order_relaxed);
+}
+
+// Slots of threads that have exited are kept until resetStats(), so their
+// counts survive; the rest are freed on exit.
+struct Registry {
+    Registry()
+    {
+        require (::pthread_key_create(&exitKey, markExited) == 0, "Registry: Unable to create a thread key.");
+    }
+
+    ~Registry()
+    {
+        // Threads that outlive the registry record nothing from now on.
+        g_enabled.store(false, std::memory_order_relaxed);
+        ::pthread_key_delete(exitKey);
+        for (ThreadStats* stats : threads) {
+            delete stats;
+        }
+    }
+
+    std::mutex mutex;                       // guards threads
+    std::vector<ThreadStats*> threads;
+    pthread_key_t exitKey;                  // calls markExited for the slot of an exiting thread
+};
+
+Registry& registry()
+{
+    static Registry result;
+    return result;
+}
+
+// __thread rather than thread_local, which g++ 4.6 lacks.
+__thread ThreadStats* t_stats = nullptr;
+
+ThreadStats& threadStats()
+{
+    if (!t_stats) {
+        // Value-initialized, so every slot starts at 0.
+        t_stats = new ThreadStats();
+        Registry& stats = registry();
+        ::pthread_setspecific(stats.exitKey, t_stats);
+        std::lock_guard<std::mutex> lock(stats.mutex);
+        stats.threads.push_back(t_stats);
+    }
+    return *t_stats;
+}
+
+// Only the owning thread writes a slot, so no read-modify-write is needed.
+void bump(std::atomic<uint64_t>* slot, uint64_t count)
+{
+    slot->store(slot->load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+size_t bucketOf(uint64_t nanoseconds)
+{
+    if (nanoseconds < SUB_BUCKETS) {
+        return nanoseconds;
+    }
+    const size_t exponent = 63 - __builtin_clzll(nanoseconds);
+    const size_t sub = (nanoseconds >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t bucketUpperBound(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    const size_t shift = bucket / SUB_BUCKETS - 1;
+    const uint64_t lower = uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+// Sum of one slot over all threads.
+template <class Slot>
+uint64_t sum(Slot slot)
+{
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    uint64_t result = 0;
+    for (ThreadStats* stats : registry().threads) {
+        result += slot(stats)->load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+// Buckets of one timer summed over all threads.
+std::vector<uint64_t> histogramOf(StatsTimer timer)
+{
+    std::vector<uint64_t> result(BUCKET_COUNT);
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    for (ThreadStats* stats : registry().threads) {
+        const Histogram& histogram = stats->timers[static_cast<size_t>(timer)];
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+            result[bucket] += histogram.buckets[bucket].load(std::memory_order_relaxed);
+        }
+    }
+    return result;
+}
+
+void writeJsonString(const char* value, std::ostream& output)
+{
+    // Names are identifiers; nothing to escape.
+    output << '"' << value << '"';
+}
+
+} // namespace
+
+
+const char* statsCounterName(StatsCounter counter)
+{
+    static const char* const NAMES[] = {
+        "programs", "constant_programs", "stored_programs", "duplicate_programs", "rejected_programs",
+        "refine_runs", "parse_errors", "batches", "queue_waits", "lock_waits"
+    };
+    static_assert(sizeof(NAMES) / sizeof(NAMES[0]) == COUNTER_COUNT, "statsCounterName: Names are missing.");
+    return NAMES[static_cast<size_t>(counter)];
+}
+
+const char* statsTimerName(StatsTimer timer)
+{
+    static const char* const NAMES[] = {
+        "parse", "eval", "output", "write", "lock_wait"
+    };
+    static_assert(sizeof(NAMES) / sizeof(NAMES[0]) == TIMER_COUNT, "statsTimerName: Names are missing.");
+    return NAMES[static_cast<size_t>(timer)];
+}
+
+void enableStats()
+{
+    g_enabled.store(true, std::memory_order_relaxed);
+}
+
+void disableStats()
+{
+    g_enabled.store(false, std::memory_order_relaxed);
+}
+
+bool statsEnabled()
+{
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void resetStats()
+{
+    Registry& stats = registry();
+    std::lock_guard<std::mutex> lock(stats.mutex);
+    // Slots that would only hold zeros are freed: those of exited threads
+    // and that of the calling thread, which makes a new one when it records.
+    if (t_stats) {
+        ::pthread_setspecific(stats.exitKey, nullptr);
+        t_stats->exited.store(true, std::memory_order_relaxed);
+        t_stats = nullptr;
+    }
+    const auto exited = std::partition(stats.threads.begin(), stats.threads.end(), [](ThreadStats* slot) {
+        return !slot->exited.load(std::memory_order_relaxed);
+    });
+    for (auto slot = exited; slot != stats.threads.end(); ++slot) {
+        delete *slot;
+    }
+    stats.threads.erase(exited, stats.threads.end());
+
+    for (ThreadStats* slot : stats.threads) {
+        for (auto& counter : slot->counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+        for (auto& histogram : slot->timers) {
+            for (auto& bucket : histogram.buckets) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            histogram.total.store(0, std::memory_order_relaxed);
+        }
+        for (auto& count : slot->opcodes) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void addStat(StatsCounter counter, uint64_t count)
+{
+    if (statsEnabled()) {
+        bump(&threadStats().counters[static_cast<size_t>(counter)], count);
+    }
+}
+
+void recordTime(StatsTimer timer, uint64_t nanoseconds)
+{
+    if (statsEnabled()) {
+        Histogram& histogram = threadStats().timers[static_cast<size_t>(timer)];
+        bump(&histogram.buckets[bucketOf(nanoseconds)], 1);
+        bump(&histogram.total, nanoseconds);
+    }
+}
+
+void countOpcode(Op op)
+{
+    if (statsEnabled()) {
+        bump(&threadStats().opcodes[static_cast<size_t>(op)], 1);
+    }
+}
+
+uint64_t statValue(StatsCounter counter)
+{
+    return sum([counter](ThreadStats* stats) { return &stats->counters[static_cast<size_t>(counter)]; });
+}
+
+uint64_t timerCount(StatsTimer timer)
+{
+    const std::vector<uint64_t> buckets = histogramOf(timer);
+    return std::accumulate(buckets.begin(), buckets.end(), uint64_t(0));
+}
+
+uint64_t timerTotal(StatsTimer timer)
+{
+    return sum([timer](ThreadStats* stats) { return &stats->timers[static_cast<size_t>(timer)].total; });
+}
+
+uint64_t timerPercentile(StatsTimer timer, double fraction)
+{
+    const std::vector<uint64_t> buckets = histogramOf(timer);
+    const uint64_t count = std::accumulate(buckets.begin(), buckets.end(), uint64_t(0));
+    if (count == 0) {
+        return 0;
+    }
+
+    // The rank of the sample, counting from 1.
+    const uint64_t rank = std::min(count, std::max<uint64_t>(1, std::ceil(fraction * count)));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; ; ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            return bucketUpperBound(bucket);
+        }
+    }
+}
+
+uint64_t opcodeCount(Op op)
+{
+    return sum([op](ThreadStats* stats) { return &stats->opcodes[static_cast<size_t>(op)]; });
+}
+
+void writeStatsJson(std::ostream& output)
+{
+    size_t threads;
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        threads = registry().threads.size();
+    }
+    output << "{\"threads\":" << threads << ",\"counters\":{";
+    for (size_t index = 0; index < COUNTER_COUNT; ++index) {
+        const StatsCounter counter = static_cast<StatsCounter>(index);
+        output << (index > 0 ? "," : "");
+        writeJsonString(statsCounterName(counter), output);
+        output << ':' << statValue(counter);
+    }
+    output << "},\"timers\":{";
+    for (size_t index = 0; index < TIMER_COUNT; ++index) {
+        const StatsTimer timer = static_cast<StatsTimer>(index);
+        output << (index > 0 ? "," : "");
+        writeJsonString(statsTimerName(timer), output);
+        output << ":{\"count\":" << timerCount(timer)
+               << ",\"total_ns\":" << timerTotal(timer)
+               << ",\"p50_ns\":" << timerPercentile(timer, 0.5)
+               << ",\"p99_ns\":" << timerPercentile(timer, 0.99) << '}';
+    }
+    // Empty unless built with BV_COUNT_OPCODES.
+    output << "},\"opcodes\":{";
+    bool first = true;
+    for (size_t index = 0; index < OP_COUNT; ++index) {
+        const Op op = static_cast<Op>(index);
+        const uint64_t count = opcodeCount(op);
+        if (count > 0) {
+            output << (first ? "" : ",");
+            writeJsonString(opName(op), output);
+            output << ':' << count;
+            first = false;
+        }
+    }
+    output << "}}\n";
+    output.flush();
+}
+
+
+StatsDumper::StatsDumper(const std::string& path)
+  : path_(path)
+  , stopping_(false)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    require (::pthread_sigmask(SIG_BLOCK, &signals, nullptr) == 0, "StatsDumper: Unable to block SIGUSR1.");
+    thread_ = std::thread(&StatsDumper::signalMain, this);
+}
+
+StatsDumper::~StatsDumper()
+{
+    stopping_ = true;
+    ::pthread_kill(thread_.native_handle(), SIGUSR1);
+    thread_.join();
+    dump();
+}
+
+void StatsDumper::dump()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (path_.empty()) {
+        writeStatsJson(std::cerr);
+    } else {
+        std::ofstream file(path_, std::ios::trunc);
+        writeStatsJson(file);
+    }
+}
+
+void StatsDumper::signalMain()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    for (;;) {
+        int signal = 0;
+        if (::sigwait(&signals, &signal) != 0 || stopping_) {
+            return;
+        }
+        dump();
+    }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "block.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// In-process instrumentation: event counters, latency histograms and opcode
+// execution counts.
+//
+// Every thread records into its own slots, which only it writes, so
+// recording takes no lock and no atomic read-modify-write; readers sum the
+// slots of all threads that recorded since the last resetStats(), running
+// or not. Nothing is recorded until enableStats().
+
+enum class StatsCounter {
+    PROGRAMS,                               // evaluated
+    CONSTANT_PROGRAMS,                      // of those, proven constant and not run
+    STORED_PROGRAMS,                        // of those, with outputs saved by --store
+    DUPLICATE_PROGRAMS,                     // of those, equivalent to one evaluated before
+    REJECTED_PROGRAMS,                      // by --target; not among the programs
+    REFINE_RUNS,                            // runs of a program on one input by --refine
+    PARSE_ERRORS,
+    BATCHES,                                // handed to the writer
+    QUEUE_WAITS,                            // sleeps on a full or empty pipeline queue
+    LOCK_WAITS,                             // contended mutex acquisitions
+    COUNT
+};
+
+enum class StatsTimer {
+    PARSE,                                  // per program
+    EVAL,                                   // per program, all inputs
+    OUTPUT,                                 // per program: hashing and formatting
+    WRITE,                                  // per batch
+    LOCK_WAIT,                              // per contended acquisition
+    COUNT
+};
+
+const char* statsCounterName(StatsCounter counter);
+const char* statsTimerName(StatsTimer timer);
+
+void enableStats();
+void disableStats();
+bool statsEnabled();
+// Zeroes every slot and forgets the threads that have exited; only while no
+// other thread records.
+void resetStats();
+
+void addStat(StatsCounter counter, uint64_t count = 1);
+void recordTime(StatsTimer timer, uint64_t nanoseconds);
+// Only called by code built with BV_COUNT_OPCODES; see SConstruct.
+void countOpcode(Op op);
+
+// Sums over all threads.
+uint64_t statValue(StatsCounter counter);
+uint64_t timerCount(StatsTimer timer);
+uint64_t timerTotal(StatsTimer timer);
+// Upper bound of the histogram bucket holding the given fraction of the
+// samples, in nanoseconds; 0 without samples.
+uint64_t timerPercentile(StatsTimer timer, double fraction);
+uint64_t opcodeCount(Op op);
+
+// One JSON object with all of the above, and the number of threads that
+// recorded since the last resetStats().
+void writeStatsJson(std::ostream& output);
+
+// Records its lifetime into a timer, if stats are enabled.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(StatsTimer timer)
+      : timer_(timer)
+      , enabled_(statsEnabled())
+    {
+        if (enabled_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopedTimer()
+    {
+        if (enabled_) {
+            const auto elapsed = std::chrono::steady_clock::now() - start_;
+            recordTime(timer_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const StatsTimer timer_;
+    const bool enabled_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// std::lock_guard that accounts for the time spent waiting on mutex. An
+// uncontended acquisition costs one try_lock and records nothing.
+template <class Mutex>
+class TimedLock {
+public:
+    explicit TimedLock(Mutex& mutex)
+      : mutex_(mutex)
+    {
+        if (!mutex_.try_lock()) {
+            ScopedTimer timer(StatsTimer::LOCK_WAIT);
+            if (statsEnabled()) {
+                addStat(StatsCounter::LOCK_WAITS);
+            }
+            mutex_.lock();
+        }
+    }
+
+    ~TimedLock() { mutex_.unlock(); }
+
+    TimedLock(const TimedLock&) = delete;
+    TimedLock& operator=(const TimedLock&) = delete;
+
+private:
+    Mutex& mutex_;
+};
+
+// Writes the stats as JSON to a file, or to stderr when path is empty, each
+// time the process receives SIGUSR1, and once more on destruction. Must be
+// created before any other thread, which all inherit SIGUSR1 blocked.
+class StatsDumper {
+public:
+    explicit StatsDumper(const std::string& path);
+    ~StatsDumper();
+
+    StatsDumper(const StatsDumper&) = delete;
+    StatsDumper& operator=(const StatsDumper&) = delete;
+
+    void dump();
+
+private:
+    void signalMain();
+
+    const std::string path_;
+    std::mutex mutex_;                      // serializes dumps
+    std::atomic<bool> stopping_;
+    std::thread thread_;
+};
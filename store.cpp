@@ -0,0 +1,192 @@
+#include "store.h"
+#include "require.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <unordered_map>
+
+
+namespace {
+
+const char STORE_FILE_MAGIC[8] = {'B', 'V', 'S', 'T', 'O', 'R', 'E', '\0'};
+const uint32_t STORE_FILE_VERSION = 1;
+
+bool isBefore(const StoreIndexEntry& lhs, const StoreIndexEntry& rhs)
+{
+    return lhs.keyHigh != rhs.keyHigh ? lhs.keyHigh < rhs.keyHigh : lhs.keyLow < rhs.keyLow;
+}
+
+StoreFileHeader storeFileHeader(size_t inputCount, size_t programCount)
+{
+    StoreFileHeader result;
+    std::memcpy(result.magic, STORE_FILE_MAGIC, sizeof(result.magic));
+    result.version = STORE_FILE_VERSION;
+    result.reserved = 0;
+    result.inputCount = inputCount;
+    result.programCount = programCount;
+    return result;
+}
+
+} // namespace
+
+
+Fingerprint programKey(const Op* const code, size_t size)
+{
+    // The size leads, so that code ending in NOT, which is 0, does not hash
+    // like the padding of a shorter one.
+    std::vector<uint64_t> words(1 + (size + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+    words[0] = size;
+    std::memcpy(&words[1], code, size);
+    return fingerprint(words.data(), words.size());
+}
+
+
+const size_t ResultStore::MISSING;
+
+ResultStore::ResultStore(const std::string& path)
+  : file_(path)
+{
+    const StringRef text = file_.text();
+    StoreFileHeader header;
+    require (text.size() >= sizeof(header), "ResultStore: " + path + " is not a result store.");
+    std::memcpy(&header, text.data(), sizeof(header));
+    require (std::memcmp(header.magic, STORE_FILE_MAGIC, sizeof(header.magic)) == 0,
+             "ResultStore: " + path + " is not a result store.");
+    require (header.version == STORE_FILE_VERSION, "ResultStore: Unsupported version of " + path + ".");
+
+    // Bounded one by one, so that the products below cannot overflow.
+    const size_t words = (text.size() - sizeof(header)) / sizeof(uint64_t);
+    require (header.inputCount <= words && header.programCount <= words,
+             "ResultStore: Truncated " + path + ".");
+    inputCount_ = header.inputCount;
+    programCount_ = header.programCount;
+    require (text.size() == sizeof(header) + sizeof(uint64_t) * (inputCount_ + inputCount_ * programCount_) +
+                            sizeof(StoreIndexEntry) * programCount_,
+             "ResultStore: Truncated " + path + ".");
+
+    inputs_ = reinterpret_cast<const uint64_t*>(text.data() + sizeof(header));
+    rows_ = inputs_ + inputCount_;
+    index_ = reinterpret_cast<const StoreIndexEntry*>(rows_ + inputCount_ * programCount_);
+    for (size_t entry = 0; entry < programCount_; ++entry) {
+        require (index_[entry].row < programCount_ && (entry == 0 || !isBefore(index_[entry], index_[entry - 1])),
+                 "ResultStore: Invalid index in " + path + ".");
+    }
+}
+
+std::vector<size_t> ResultStore::columnsOf(const std::vector<uint64_t>& inputs) const
+{
+    std::unordered_map<uint64_t, size_t> columns;
+    for (size_t column = 0; column < inputCount_; ++column) {
+        columns.emplace(inputs_[column], column);
+    }
+    std::vector<size_t> result;
+    result.reserve(inputs.size());
+    for (uint64_t input : inputs) {
+        const auto found = columns.find(input);
+        result.push_back(found == columns.end() ? MISSING : found->second);
+    }
+    return result;
+}
+
+const uint64_t* ResultStore::find(const Fingerprint& key) const
+{
+    const StoreIndexEntry wanted = {key.low, key.high, 0};
+    const StoreIndexEntry* const end = index_ + programCount_;
+    const StoreIndexEntry* const found = std::lower_bound(index_, end, wanted, isBefore);
+    if (found == end || found->keyLow != key.low || found->keyHigh != key.high) {
+        return nullptr;
+    }
+    return rows_ + inputCount_ * found->row;
+}
+
+
+ResultStoreWriter::Shard::Shard(const std::string& path, size_t inputCount)
+  : path_(path)
+  , inputCount_(inputCount)
+  , file_(path_, std::ios::binary | std::ios::trunc)
+{
+    require (file_.is_open(), "ResultStoreWriter: Unable to create " + path_ + ".");
+}
+
+void ResultStoreWriter::Shard::add(const Fingerprint& key, const uint64_t* const outputs)
+{
+    file_.write(reinterpret_cast<const char*>(outputs), sizeof(uint64_t) * inputCount_);
+    index_.push_back(StoreIndexEntry{key.low, key.high, index_.size()});
+}
+
+
+ResultStoreWriter::ResultStoreWriter(const std::string& path, const std::vector<uint64_t>& inputs)
+  : path_(path)
+  , temporaryPath_(path + ".tmp")
+  , inputCount_(inputs.size())
+  , file_(temporaryPath_, std::ios::binary | std::ios::trunc)
+  , committed_(false)
+{
+    require (file_.is_open(), "ResultStoreWriter: Unable to create " + temporaryPath_ + ".");
+    // The program count is filled in by commit().
+    const StoreFileHeader header = storeFileHeader(inputCount_, 0);
+    file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file_.write(reinterpret_cast<const char*>(inputs.data()), sizeof(uint64_t) * inputs.size());
+}
+
+ResultStoreWriter::~ResultStoreWriter()
+{
+    for (const auto& shard : shards_) {
+        shard->file_.close();
+        ::unlink(shard->path_.c_str());
+    }
+    if (!committed_) {
+        file_.close();
+        ::unlink(temporaryPath_.c_str());
+    }
+}
+
+ResultStoreWriter::Shard* ResultStoreWriter::shard()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    require (!committed_, "ResultStoreWriter: Already committed.");
+    const std::string path = temporaryPath_ + "." + std::to_string(shards_.size());
+    shards_.emplace_back(new Shard(path, inputCount_));
+    return shards_.back().get();
+}
+
+void ResultStoreWriter::add(const Fingerprint& key, const uint64_t* const outputs)
+{
+    file_.write(reinterpret_cast<const char*>(outputs), sizeof(uint64_t) * inputCount_);
+    index_.push_back(StoreIndexEntry{key.low, key.high, index_.size()});
+}
+
+void ResultStoreWriter::commit()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    require (!committed_, "ResultStoreWriter: Already committed.");
+    for (const auto& shard : shards_) {
+        shard->file_.close();
+        require (!shard->file_.fail(), "ResultStoreWriter: Unable to write " + shard->path_ + ".");
+        if (shard->index_.empty()) {
+            continue;
+        }
+        // The rows of the shard follow those already in the file.
+        std::ifstream rows(shard->path_, std::ios::binary);
+        file_ << rows.rdbuf();
+        const size_t first = index_.size();
+        for (StoreIndexEntry entry : shard->index_) {
+            entry.row += first;
+            index_.push_back(entry);
+        }
+    }
+
+    // Stable, so that the first of equal keys is found; their rows are equal
+    // anyway.
+    std::stable_sort(index_.begin(), index_.end(), isBefore);
+    file_.write(reinterpret_cast<const char*>(index_.data()), sizeof(StoreIndexEntry) * index_.size());
+    const StoreFileHeader header = storeFileHeader(inputCount_, index_.size());
+    file_.seekp(0);
+    file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file_.close();
+    require (!file_.fail(), "ResultStoreWriter: Unable to write " + temporaryPath_ + ".");
+    require (std::rename(temporaryPath_.c_str(), path_.c_str()) == 0,
+             "ResultStoreWriter: Unable to replace " + path_ + ".");
+    committed_ = true;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "block.h"
+#include "fingerprint.h"
+#include "input.h"
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Outputs saved by one run for the next, so that a run whose input vector
+// has grown only evaluates the new inputs.
+//
+// The file is a StoreFileHeader, the inputs, one row of outputs per program
+// in the order they were added and an index of the rows sorted by program
+// key. Numbers are in the byte order of the writing machine; the file is
+// mapped, never read into memory.
+struct StoreFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t inputCount;
+    uint64_t programCount;
+};
+
+struct StoreIndexEntry {
+    uint64_t keyLow;
+    uint64_t keyHigh;
+    uint64_t row;
+};
+
+// Fingerprint of the code of a program, which the store is keyed by.
+Fingerprint programKey(const Op* code, size_t size);
+
+class ResultStore {
+public:
+    // Column of an input the store has no outputs for.
+    static const size_t MISSING = ~size_t(0);
+
+    // Throws unless the file is a store whose rows and index lie within the
+    // file.
+    explicit ResultStore(const std::string& path);
+
+    ResultStore(const ResultStore&) = delete;
+    ResultStore& operator=(const ResultStore&) = delete;
+
+    size_t inputCount() const { return inputCount_; }
+    const uint64_t* inputs() const { return inputs_; }
+    size_t size() const { return programCount_; }
+
+    // The column of each of inputs in the rows, or MISSING.
+    std::vector<size_t> columnsOf(const std::vector<uint64_t>& inputs) const;
+
+    // The outputs on inputs() of the program with key, or null.
+    const uint64_t* find(const Fingerprint& key) const;
+
+private:
+    const MappedFile file_;
+    size_t inputCount_;
+    size_t programCount_;
+    const uint64_t* inputs_;
+    const uint64_t* rows_;
+    const StoreIndexEntry* index_;
+};
+
+// Saves outputs as a ResultStore. The rows go to a temporary file next to
+// path, which replaces path on commit(), so path may be the store the run
+// reads from. Threads add rows to shards of their own, so that they do not
+// contend for the file; commit() appends the shards to it.
+class ResultStoreWriter {
+public:
+    // Rows of one thread, in a temporary file of their own.
+    class Shard {
+    public:
+        Shard(const Shard&) = delete;
+        Shard& operator=(const Shard&) = delete;
+
+        // outputs has one value per input.
+        void add(const Fingerprint& key, const uint64_t* outputs);
+
+    private:
+        friend class ResultStoreWriter;
+
+        Shard(const std::string& path, size_t inputCount);
+
+        const std::string path_;
+        const size_t inputCount_;
+        std::ofstream file_;
+        std::vector<StoreIndexEntry> index_; // rows are numbered within the shard
+    };
+
+    ResultStoreWriter(const std::string& path, const std::vector<uint64_t>& inputs);
+    // Removes the temporary files, and the store unless committed.
+    ~ResultStoreWriter();
+
+    ResultStoreWriter(const ResultStoreWriter&) = delete;
+    ResultStoreWriter& operator=(const ResultStoreWriter&) = delete;
+
+    // A new shard, owned by the writer; it may be called by many threads at
+    // once, but each shard is added to by one thread at a time.
+    Shard* shard();
+
+    // Same as shard()->add() for a writer used by one thread.
+    void add(const Fingerprint& key, const uint64_t* outputs);
+
+    // Appends the shards, writes the index and moves the file to path. No
+    // rows may be added meanwhile.
+    void commit();
+
+private:
+    const std::string path_;
+    const std::string temporaryPath_;
+    const size_t inputCount_;
+    std::ofstream file_;
+    std::vector<StoreIndexEntry> index_;
+    std::mutex mutex_;                      // guards shards_
+    std::vector<std::unique_ptr<Shard>> shards_;
+    bool committed_;
+};
@@ -0,0 +1,60 @@
+#include "target.h"
+#include "require.h"
+#include <algorithm>
+
+
+Target::Target(const std::vector<uint64_t>& inputs, const std::vector<uint64_t>& outputs)
+  : inputs_(inputs)
+  , outputs_(outputs)
+  , rejections_(new std::atomic<uint64_t>[inputs.size()])
+{
+    require (inputs.size() == outputs.size(), "Target: Expected one output per input.");
+    for (size_t index = 0; index < inputs.size(); ++index) {
+        rejections_[index] = 0;
+    }
+}
+
+void Target::addRejections(std::vector<uint64_t>* const counts)
+{
+    for (size_t index = 0; index < counts->size(); ++index) {
+        if ((*counts)[index] != 0) {
+            rejections_[index].fetch_add((*counts)[index], std::memory_order_relaxed);
+            (*counts)[index] = 0;
+        }
+    }
+}
+
+void Target::order(std::vector<size_t>* const result) const
+{
+    std::vector<uint64_t> rejections(size());
+    result->resize(size());
+    for (size_t index = 0; index < size(); ++index) {
+        rejections[index] = rejections_[index].load(std::memory_order_relaxed);
+        (*result)[index] = index;
+    }
+    std::stable_sort(result->begin(), result->end(), [&rejections](size_t lhs, size_t rhs) {
+        return rejections[lhs] > rejections[rhs];
+    });
+}
+
+
+const size_t TargetMatcher::REORDER_INTERVAL;
+
+TargetMatcher::TargetMatcher(Target* const target)
+  : target_(target)
+  , rejections_(target->size(), 0)
+  , programs_(0)
+{
+    target_->order(&order_);
+}
+
+TargetMatcher::~TargetMatcher()
+{
+    target_->addRejections(&rejections_);
+}
+
+void TargetMatcher::reorder()
+{
+    target_->addRejections(&rejections_);
+    target_->order(&order_);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "block.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Outputs a program must compute on the inputs to be reported by --target,
+// shared by the eval workers. Each input counts the programs it rejected,
+// so that workers try the most discriminating inputs first.
+class Target {
+public:
+    // outputs[N] is expected on inputs[N].
+    Target(const std::vector<uint64_t>& inputs, const std::vector<uint64_t>& outputs);
+
+    Target(const Target&) = delete;
+    Target& operator=(const Target&) = delete;
+
+    size_t size() const { return inputs_.size(); }
+    const std::vector<uint64_t>& inputs() const { return inputs_; }
+    const std::vector<uint64_t>& outputs() const { return outputs_; }
+
+    // Adds (*counts)[N] to the rejections of input N and zeroes counts.
+    void addRejections(std::vector<uint64_t>* counts);
+
+    // Indices of the inputs, those with the most rejections first; ties
+    // keep the order of the inputs.
+    void order(std::vector<size_t>* result) const;
+
+private:
+    const std::vector<uint64_t> inputs_;
+    const std::vector<uint64_t> outputs_;
+    std::unique_ptr<std::atomic<uint64_t>[]> rejections_;
+};
+
+// Per-thread side of a Target: runs programs input by input in the shared
+// order, and counts rejections locally so that the shared counters are only
+// touched every REORDER_INTERVAL programs.
+class TargetMatcher {
+public:
+    static const size_t REORDER_INTERVAL = 256;
+
+    explicit TargetMatcher(Target* target);
+    ~TargetMatcher();
+
+    TargetMatcher(const TargetMatcher&) = delete;
+    TargetMatcher& operator=(const TargetMatcher&) = delete;
+
+    // True when block computes every expected output; returns at the first
+    // it does not. Block or BlockRef.
+    template <class Code>
+    bool matches(const Code& block, ExecutionContext* context)
+    {
+        if (++programs_ % REORDER_INTERVAL == 0) {
+            reorder();
+        }
+        const std::vector<uint64_t>& inputs = target_->inputs();
+        const std::vector<uint64_t>& outputs = target_->outputs();
+        for (size_t index : order_) {
+            if (block.execute(&inputs[index], 1, context) != outputs[index]) {
+                ++rejections_[index];
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    void reorder();
+
+    Target* const target_;
+    std::vector<size_t> order_;
+    std::vector<uint64_t> rejections_;      // since the last reorder()
+    size_t programs_;
+};
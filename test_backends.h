@@ -0,0 +1,79 @@
+#pragma once
+
+#include "block.h"
+#include "require.h"
+
+// Checks and fixtures shared by the tests of the backends that compile a
+// Block: each checks its own block against the interpreter.
+namespace internal {
+namespace {
+
+// Backend is constructed from block and executes arguments as Block does;
+// x and ~x cover a spread of both arguments.
+template <class Backend>
+void requireSameAsInterpreter(const Block& block, const char* message)
+{
+    const Backend backend(block);
+    for (uint64_t i = 0; i < 64; ++i) {
+        const uint64_t value = i * 0x9e3779b97f4a7c15UL;
+        require (backend.execute({value, ~value}) == block.execute({value, ~value}), message);
+    }
+}
+
+// (if0 (and x 1) <unfold x into arguments 0 .. 7, then plus of 2 and 5>
+// elseBlock): the if branch overwrites the arguments elseBlock may read.
+Block if0WithUnfoldBlock(const Block& elseBlock)
+{
+    Block ifBlock(0);
+    ifBlock.emitLoadArg(0);
+    ifBlock.emitUnfold();
+    for (int i = 0; i < 8; ++i) {
+        ifBlock.emitStoreArg(i);
+    }
+    ifBlock.emitLoadArg(2);
+    ifBlock.emitLoadArg(5);
+    ifBlock.emitPlus();
+
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitLoadConst(1);
+    block.emitAnd();
+    block.emitIf0(ifBlock, elseBlock);
+    return block;
+}
+
+// Nested fold with an if0 in the inner body, over x and (not x); reads
+// argument 0 only.
+Block nestedFoldBlock()
+{
+    Block ifBlock(0);
+    ifBlock.emitLoadArg(4);
+    ifBlock.emitLoadArg(3);
+    ifBlock.emitPlus();
+
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(4);
+    elseBlock.emitShl1();
+
+    Block inner(0);
+    inner.emitLoadArg(3);
+    inner.emitLoadConst(1);
+    inner.emitAnd();
+    inner.emitIf0(ifBlock, elseBlock);
+
+    Block outer(0);
+    outer.emitLoadArg(1);
+    outer.emitLoadArg(2);
+    outer.emitFold(3, inner);
+    outer.emitLoadArg(0);
+    outer.emitXor();
+
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitLoadArg(0);
+    block.emitNot();
+    block.emitFold(1, outer);
+    return block;
+}
+
+} } // namespace internal::
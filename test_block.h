@@ -178,6 +178,197 @@ void test_if0()
              "IF0 is broken.");
 }
 
+void test_execute_batch()
+{
+    Block ifBlock(0);
+    ifBlock.emitLoadArg(0);
+    ifBlock.emitUnfold();
+    for (int i = 0; i < 8; ++i) {
+        ifBlock.emitStoreArg(i);
+    }
+    ifBlock.emitLoadArg(3);
+    ifBlock.emitLoadArg(6);
+    ifBlock.emitPlus();
+
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(0);
+    elseBlock.emitShr4();
+    elseBlock.emitNot();
+
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitLoadConst(1);
+    block.emitAnd();
+    block.emitIf0(ifBlock, elseBlock);
+    block.emitLoadArg(0);
+    block.emitXor();
+
+    std::vector<uint64_t> inputs;
+    for (uint64_t i = 0; i < 100; ++i) {
+        inputs.push_back(i * 0x9e3779b97f4a7c15UL);
+    }
+    std::vector<uint64_t> outputs(inputs.size());
+    block.executeBatch(inputs.data(), inputs.size(), outputs.data());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        require (outputs[i] == block.execute({inputs[i]}), "EXECUTE_BATCH is broken.");
+    }
+}
+
+void test_execution_context()
+{
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitUnfold();
+    for (int i = 0; i < 7; ++i) {
+        block.emitPlus();
+    }
+    require (block.maxStackSize() == 8, "MAX_STACK_SIZE is broken.");
+
+    // Deeper than the inline stack of the context.
+    Block deep(0);
+    for (int i = 0; i < 100; ++i) {
+        deep.emitLoadArg(i % 3);
+    }
+    for (int i = 0; i < 99; ++i) {
+        deep.emitXor();
+    }
+    require (deep.maxStackSize() == 100, "MAX_STACK_SIZE is broken.");
+
+    ExecutionContext context;
+    for (uint64_t i = 0; i < 16; ++i) {
+        const uint64_t argv[] = {i * 0x0101010101010101UL, i, 7};
+        require (block.execute(argv, 1, &context) == 8 * i, "EXECUTION_CONTEXT is broken.");
+        require (deep.execute(argv, 3, &context) == (i ^ 7), "EXECUTION_CONTEXT is broken.");
+    }
+}
+
+void test_fold()
+{
+    // Sum of the bytes of arg0.
+    Block sum(0);
+    sum.emitLoadArg(1);
+    sum.emitLoadArg(2);
+    sum.emitPlus();
+
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitLoadConst(0);
+    block.emitFold(1, sum);
+    require (block.maxStackSize() == 4, "FOLD is broken.");
+    require (block.execute({0x0706050403020100UL}) == 28, "FOLD is broken.");
+
+    // Bytes are visited lowest first.
+    Block shift(0);
+    shift.emitLoadArg(2);
+    shift.emitShl(8);
+    shift.emitLoadArg(1);
+    shift.emitOr();
+
+    Block reverse(0);
+    reverse.emitLoadArg(0);
+    reverse.emitLoadConst(0);
+    reverse.emitFold(1, shift);
+    require (reverse.execute({0x0706050403020100UL}) == 0x0001020304050607UL, "FOLD is broken.");
+
+    std::vector<uint64_t> inputs;
+    for (uint64_t i = 0; i < 40; ++i) {
+        inputs.push_back(i * 0x9e3779b97f4a7c15UL);
+    }
+    std::vector<uint64_t> outputs(inputs.size());
+    reverse.executeBatch(inputs.data(), inputs.size(), outputs.data());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        require (outputs[i] == reverse.execute({inputs[i]}), "FOLD is broken.");
+    }
+}
+
+void test_patches()
+{
+    // fold(x, if0(x & 1, x, fold(y, z, y + z)), (y z) -> if0(y, z, not z))
+    // emitted in place matches the nested blocks of emitIf0 and emitFold.
+    Block inner(0);
+    inner.emitLoadArg(1);
+    inner.emitLoadArg(2);
+    inner.emitPlus();
+
+    Block ifBlock(0);
+    ifBlock.emitLoadArg(0);
+
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(1);
+    elseBlock.emitLoadArg(2);
+    elseBlock.emitFold(1, inner);
+
+    Block bodyIf(0);
+    bodyIf.emitLoadArg(2);
+    Block bodyElse(0);
+    bodyElse.emitLoadArg(2);
+    bodyElse.emitNot();
+    Block body(0);
+    body.emitLoadArg(1);
+    body.emitIf0(bodyIf, bodyElse);
+
+    Block nested(0);
+    nested.emitLoadArg(0);
+    nested.emitLoadArg(0);
+    nested.emitLoadConst(1);
+    nested.emitAnd();
+    nested.emitIf0(ifBlock, elseBlock);
+    nested.emitFold(1, body);
+
+    Block patched(0);
+    patched.emitLoadArg(0);
+    patched.emitLoadArg(0);
+    patched.emitLoadConst(1);
+    patched.emitAnd();
+    const Block::Patch ifPatch = patched.beginIf0();
+    patched.emitLoadArg(0);
+    const Block::Patch elsePatch = patched.elseIf0(ifPatch);
+    patched.emitLoadArg(1);
+    patched.emitLoadArg(2);
+    const Block::Patch innerPatch = patched.beginFold(1);
+    patched.emitLoadArg(1);
+    patched.emitLoadArg(2);
+    patched.emitPlus();
+    patched.endFold(innerPatch);
+    patched.endIf0(elsePatch);
+    const Block::Patch foldPatch = patched.beginFold(1);
+    patched.emitLoadArg(1);
+    const Block::Patch bodyPatch = patched.beginIf0();
+    patched.emitLoadArg(2);
+    const Block::Patch bodyElsePatch = patched.elseIf0(bodyPatch);
+    patched.emitLoadArg(2);
+    patched.emitNot();
+    patched.endIf0(bodyElsePatch);
+    patched.endFold(foldPatch);
+
+    require (patched.code() == nested.code() && patched.stackSize() == 1 &&
+             patched.maxStackSize() == nested.maxStackSize(),
+             "PATCHES differ from nested blocks.");
+
+    // Branches and bodies cannot pop what was below them.
+    const auto throws = [](void (*emit)(Block*)) {
+        Block block(0);
+        block.emitLoadArg(0);
+        block.emitLoadArg(0);
+        try {
+            emit(&block);
+        } catch (const std::exception&) {
+            return true;
+        }
+        return false;
+    };
+    require (throws([](Block* block) { block->beginIf0(); block->emitNot(); }) &&
+             throws([](Block* block) { block->beginIf0(); block->emitLoadArg(0); block->emitPlus(); }) &&
+             throws([](Block* block) { block->beginFold(1); block->emitLoadArg(0); block->emitAnd(); }) &&
+             throws([](Block* block) { block->elseIf0(block->beginIf0()); }) &&
+             throws([](Block* block) {
+                 const Block::Patch patch = block->beginIf0();
+                 block->emitLoadArg(0);
+                 block->endIf0(patch);
+             }),
+             "PATCHES accept inconsistent code.");
+}
+
 } } // namespace internal::
 
 
@@ -199,6 +390,10 @@ inline void test_block()
         test_loadarg();
         test_loadconst();
         test_if0();
+        test_execute_batch();
+        test_execution_context();
+        test_fold();
+        test_patches();
 
     } catch(const std::exception& ex) {
         std::cerr << "Exception: " << ex.what() << std::endl;
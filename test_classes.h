@@ -0,0 +1,82 @@
+#pragma once
+
+#include "classes.h"
+#include "require.h"
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace internal {
+namespace {
+
+void test_classes_representative()
+{
+    ClassTable table;
+    table.add(Fingerprint{7, 0}, "(lambda (x) (plus x x))");
+    table.add(Fingerprint{1, 0}, "(lambda (x) 1)");
+    table.add(Fingerprint{7, 0}, "(lambda (x) (shl1 x))");
+    table.add(Fingerprint{7, 0}, "(lambda (x) (and x (plus x x)))");
+    table.add(Fingerprint{7, 0}, "(lambda (y) (shl1 y))");
+
+    const auto classes = table.classes();
+    require (classes.size() == 2 &&
+             classes[0].fingerprint == Fingerprint{1, 0} && classes[0].size == 1 &&
+             classes[1].fingerprint == Fingerprint{7, 0} && classes[1].size == 4 &&
+             classes[1].representative == "(lambda (x) (shl1 x))",
+             "CLASSES representative is broken");
+}
+
+void test_classes_threads()
+{
+    ClassTable table;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; ++thread) {
+        threads.emplace_back([&table, thread]() {
+            for (uint64_t index = 0; index < 10000; ++index) {
+                table.add(Fingerprint{index % 100, 0}, "(lambda (x) " + std::to_string(thread * 10000 + index) + ")");
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const auto classes = table.classes();
+    require (classes.size() == 100, "CLASSES loses classes");
+    for (uint64_t index = 0; index < classes.size(); ++index) {
+        require (classes[index].fingerprint == Fingerprint{index, 0} && classes[index].size == 400 &&
+                 classes[index].representative == "(lambda (x) " + std::to_string(index) + ")",
+                 "CLASSES is broken with threads");
+    }
+}
+
+void test_canonical_table()
+{
+    CanonicalTable table;
+    Fingerprint outputs;
+    require (!table.find(Fingerprint{1, 2}, &outputs), "CANONICAL_TABLE finds unknown programs");
+    table.add(Fingerprint{1, 2}, Fingerprint{3, 4});
+    table.add(Fingerprint{1, 2}, Fingerprint{5, 6});
+    require (table.find(Fingerprint{1, 2}, &outputs) && outputs == Fingerprint{3, 4} &&
+             !table.find(Fingerprint{2, 1}, &outputs),
+             "CANONICAL_TABLE is broken");
+}
+
+} } // namespace internal::
+
+
+inline void test_classes()
+{
+    using namespace internal;
+    try {
+        test_classes_representative();
+        test_classes_threads();
+        test_canonical_table();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "corpus.h"
+#include "parser.h"
+#include "require.h"
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace internal {
+namespace {
+
+// A file that is removed with the object.
+class TemporaryFile {
+public:
+    explicit TemporaryFile(const std::string& contents)
+    {
+        char path[] = "/tmp/bv_corpus_XXXXXX";
+        const int fd = ::mkstemp(path);
+        require (fd >= 0, "TemporaryFile: Unable to create file.");
+        ::close(fd);
+        path_ = path;
+        std::ofstream(path_, std::ios::binary).write(contents.data(), contents.size());
+    }
+
+    ~TemporaryFile() { ::unlink(path_.c_str()); }
+
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+};
+
+template <typename Function>
+bool throws(Function function)
+{
+    try {
+        function();
+    } catch (const std::exception&) {
+        return true;
+    }
+    return false;
+}
+
+std::string corpusHeader()
+{
+    const CorpusFileHeader header = corpusFileHeader();
+    return std::string(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void test_corpus_roundtrip()
+{
+    const std::vector<std::string> programs = {
+        "(lambda (x) (plus x 1))",
+        "(lambda (x) (if0 (and x 1) (shl1 x) (not x)))",
+        "(lambda (x) (fold x 0 (lambda (y z) (xor y z))))",
+    };
+    std::string contents = corpusHeader();
+    for (const auto& program : programs) {
+        appendCorpusEntry(parseLambda(program), program, &contents);
+        require (contents.size() % 8 == 0, "CORPUS entries are not aligned");
+    }
+    const TemporaryFile file(contents);
+
+    const Corpus corpus(file.path());
+    require (corpus.size() == programs.size(), "CORPUS loses entries");
+    ExecutionContext context;
+    for (size_t index = 0; index < programs.size(); ++index) {
+        require (corpus.program(index) == programs[index] &&
+                 StringRef(contents.data() + corpus.programOffset(index), programs[index].size()) == programs[index],
+                 "CORPUS program text is broken");
+        const Block expected = parseLambda(programs[index]);
+        for (uint64_t input : {0UL, 1UL, 0x0123456789abcdefUL}) {
+            require (corpus.block(index).execute(&input, 1, &context) == expected.execute({input}),
+                     "CORPUS code is broken");
+        }
+    }
+}
+
+void test_corpus_invalid()
+{
+    const std::string program = "(lambda (x) (plus x 1))";
+    std::string entry;
+    appendCorpusEntry(parseLambda(program), program, &entry);
+
+    {
+        const TemporaryFile file("BVRESULT" + entry);
+        require (throws([&file]() { Corpus corpus(file.path()); }), "CORPUS accepts a foreign file");
+    }
+    {
+        const TemporaryFile file(corpusHeader() + entry.substr(0, entry.size() - 8));
+        require (throws([&file]() { Corpus corpus(file.path()); }), "CORPUS accepts a truncated entry");
+    }
+    {
+        // Drop the PLUS: the code leaves two values on the stack.
+        std::string broken = entry;
+        CorpusEntry header;
+        std::memcpy(&header, broken.data(), sizeof(header));
+        --header.codeSize;
+        std::memcpy(&broken[0], &header, sizeof(header));
+        const TemporaryFile file(corpusHeader() + broken);
+        const Corpus corpus(file.path());
+        require (corpus.size() == 1 && throws([&corpus]() { corpus.block(0); }), "CORPUS runs invalid code");
+    }
+}
+
+} } // namespace internal::
+
+
+inline void test_corpus()
+{
+    using namespace internal;
+    try {
+        test_corpus_roundtrip();
+        test_corpus_invalid();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
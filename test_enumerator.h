@@ -0,0 +1,54 @@
+#pragma once
+
+#include "enumerator.h"
+#include "require.h"
+#include <exception>
+#include <iostream>
+#include <set>
+
+namespace internal {
+namespace {
+
+void test_enumerate_not()
+{
+    // 0 1 x (not 0) (not 1) (not x); (not (not t)) is t again.
+    Enumerator enumerator({0, 1, 0xff}, {"not"});
+    std::vector<std::string> programs;
+    enumerator.run(10, [&programs](const std::string& program, const std::vector<uint64_t>&) {
+        programs.push_back(program);
+    });
+    require (programs.size() == 6, "ENUMERATE not is broken.");
+    require (programs[2] == "(lambda (x) x)" && programs[5] == "(lambda (x) (not x))",
+             "ENUMERATE not is broken.");
+}
+
+void test_enumerate_distinct()
+{
+    Enumerator enumerator({0, 1, 2, 0x8000000000000000UL, 0x123456789abcdefUL},
+                          {"shl1", "shr1", "and", "plus", "if0"});
+    std::set<std::vector<uint64_t>> seen;
+    size_t count = 0;
+    enumerator.run(6, [&](const std::string& program, const std::vector<uint64_t>& outputs) {
+        require (seen.insert(outputs).second, "ENUMERATE pruning is broken.");
+        // Same outputs as the smaller (shl1 x).
+        require (program.find("(plus x x)") == std::string::npos, "ENUMERATE pruning is broken.");
+        ++count;
+    });
+    require (count > 10, "ENUMERATE is broken.");
+}
+
+} } // namespace internal::
+
+
+inline void test_enumerator()
+{
+    using namespace internal;
+    try {
+        test_enumerate_not();
+        test_enumerate_distinct();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
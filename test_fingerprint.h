@@ -0,0 +1,67 @@
+#pragma once
+
+#include "fingerprint.h"
+#include "require.h"
+#include <exception>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace internal {
+namespace {
+
+void test_fingerprint_distinct()
+{
+    std::vector<uint64_t> values;
+    for (uint64_t index = 0; index < 13; ++index) {
+        values.push_back((index + 1) * 0x9e3779b97f4a7c15UL);
+    }
+    const Fingerprint base = fingerprint(values.data(), values.size());
+    require (fingerprint(values.data(), values.size()) == base, "FINGERPRINT is not deterministic");
+
+    // Every single bit flip, every prefix and swapping neighbours give new fingerprints.
+    std::set<Fingerprint> seen = {base};
+    for (size_t index = 0; index < values.size(); ++index) {
+        for (int bit = 0; bit < 64; ++bit) {
+            std::vector<uint64_t> flipped = values;
+            flipped[index] ^= uint64_t(1) << bit;
+            require (seen.insert(fingerprint(flipped.data(), flipped.size())).second, "FINGERPRINT misses a bit flip");
+        }
+        require (seen.insert(fingerprint(values.data(), index)).second, "FINGERPRINT ignores the length");
+        if (index + 1 < values.size()) {
+            std::vector<uint64_t> swapped = values;
+            std::swap(swapped[index], swapped[index + 1]);
+            require (seen.insert(fingerprint(swapped.data(), swapped.size())).second, "FINGERPRINT ignores the order");
+        }
+    }
+
+    // Zeros of different lengths.
+    const std::vector<uint64_t> zeros(9, 0);
+    for (size_t size = 1; size <= zeros.size(); ++size) {
+        require (seen.insert(fingerprint(zeros.data(), size)).second, "FINGERPRINT collides on zeros");
+    }
+}
+
+void test_fingerprint_hex()
+{
+    std::string text;
+    appendHex(Fingerprint{0x0123456789abcdefUL, 0xfedcba9876543210UL}, &text);
+    require (text == "fedcba98765432100123456789abcdef", "FINGERPRINT hex is broken");
+}
+
+} } // namespace internal::
+
+
+inline void test_fingerprint()
+{
+    using namespace internal;
+    try {
+        test_fingerprint_distinct();
+        test_fingerprint_hex();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
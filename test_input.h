@@ -0,0 +1,88 @@
+#pragma once
+
+#include "input.h"
+#include "require.h"
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace internal {
+namespace {
+
+std::vector<std::string> readPrograms(ChunkedInput* const input)
+{
+    std::vector<std::string> result;
+    for (StringRef chunk; input->nextChunk(&chunk); ) {
+        for (StringRef program; popProgram(&chunk, &program); ) {
+            result.push_back(program.str());
+        }
+    }
+    return result;
+}
+
+void test_pop_program()
+{
+    const std::string text =
+        "(lambda (x) x)\n"
+        "\n"
+        "   \n"
+        "123\t(lambda (x) (not x))  \r\n"
+        "(lambda (x) 1)";
+    StringRef rest(text);
+    StringRef program;
+    require (popProgram(&rest, &program) && program == "(lambda (x) x)" &&
+             popProgram(&rest, &program) && program == "(lambda (x) (not x))" &&
+             popProgram(&rest, &program) && program == "(lambda (x) 1)" &&
+             !popProgram(&rest, &program) && rest.empty(),
+             "INPUT popProgram is broken");
+}
+
+void test_chunked_input()
+{
+    std::string text;
+    std::vector<std::string> expected;
+    for (int index = 0; index < 100; ++index) {
+        expected.push_back("(lambda (x) " + std::to_string(index) + ")");
+        text += expected.back() + '\n';
+    }
+
+    for (size_t chunkSize : {1, 7, 16, 100, 1 << 20}) {
+        ChunkedInput input(text, chunkSize);
+        require (readPrograms(&input) == expected, "INPUT chunks lose or split lines");
+    }
+
+    ChunkedInput input(text, 1);
+    require (input.chunkCount() == 100, "INPUT does not split at every newline");
+
+    ChunkedInput empty(StringRef(), 16);
+    require (readPrograms(&empty).empty(), "INPUT empty text is broken");
+}
+
+void test_mapped_file()
+{
+    bool failed = false;
+    try {
+        MappedFile file("/nonexistent/bv/input");
+    } catch (const std::exception&) {
+        failed = true;
+    }
+    require (failed, "INPUT maps a missing file");
+}
+
+} } // namespace internal::
+
+
+inline void test_input()
+{
+    using namespace internal;
+    try {
+        test_pop_program();
+        test_chunked_input();
+        test_mapped_file();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
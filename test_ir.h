@@ -0,0 +1,83 @@
+#pragma once
+
+#include "block.h"
+#include "ir.h"
+#include "require.h"
+#include "test_backends.h"
+#include <exception>
+#include <iostream>
+
+namespace internal {
+namespace {
+
+void test_ir_ops()
+{
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitLoadArg(1);
+    block.emitLoadArg(0);
+    block.emitShr16();
+    block.emitPlus();
+    block.emitXor();
+    block.emitLoadConst(0x00ff00ff00ff00ffUL);
+    block.emitOr();
+    block.emitShl1();
+    block.emitLoadArg(1);
+    block.emitShr4();
+    block.emitNot();
+    block.emitAnd();
+    block.emitShr1();
+    requireSameAsInterpreter<IrBlock>(block, "IR ops are broken.");
+}
+
+void test_ir_store_aliased()
+{
+    // Slots that alias an argument must keep the old value after a store.
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitLoadArg(1);
+    block.emitLoadArg(0);
+    block.emitStoreArg(1);
+    block.emitLoadArg(1);
+    block.emitStoreArg(0);
+    block.emitXor();
+    block.emitLoadArg(0);
+    block.emitPlus();
+    requireSameAsInterpreter<IrBlock>(block, "IR store is broken.");
+}
+
+void test_ir_if0()
+{
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(1);
+
+    // The if0 joins a value below it.
+    Block block(0);
+    block.emitLoadArg(1);
+    block.emitBlock(if0WithUnfoldBlock(elseBlock));
+    block.emitXor();
+    requireSameAsInterpreter<IrBlock>(block, "IR if0 is broken.");
+}
+
+void test_ir_fold()
+{
+    requireSameAsInterpreter<IrBlock>(nestedFoldBlock(), "IR fold is broken.");
+}
+
+} } // namespace internal::
+
+
+inline void test_ir()
+{
+    using namespace internal;
+    try {
+        test_ir_ops();
+        test_ir_store_aliased();
+        test_ir_if0();
+        test_ir_fold();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "block.h"
+#include "jit.h"
+#include "require.h"
+#include "test_backends.h"
+#include <exception>
+#include <iostream>
+
+namespace internal {
+namespace {
+
+void test_jit_ops()
+{
+    typedef void (Block::*Emit)();
+    const Emit unary[] = {
+        &Block::emitNot, &Block::emitShl1, &Block::emitShr1, &Block::emitShr4, &Block::emitShr16
+    };
+    const Emit binary[] = {
+        &Block::emitAnd, &Block::emitOr, &Block::emitXor, &Block::emitPlus
+    };
+    for (const auto emit : unary) {
+        Block block(0);
+        block.emitLoadArg(0);
+        (block.*emit)();
+        requireSameAsInterpreter<NativeBlock>(block, "JIT unary op is broken.");
+    }
+    for (const auto emit : binary) {
+        Block block(0);
+        block.emitLoadArg(0);
+        block.emitLoadConst(0x0123456789abcdefUL);
+        block.emitXor();
+        block.emitLoadArg(1);
+        (block.*emit)();
+        requireSameAsInterpreter<NativeBlock>(block, "JIT binary op is broken.");
+    }
+}
+
+void test_jit_spill()
+{
+    // Deep enough to spill stack slots into the frame.
+    Block block(0);
+    for (int i = 0; i < 12; ++i) {
+        block.emitLoadArg(i % 2);
+        block.emitLoadConst(i * 0x1111111111UL);
+        block.emitPlus();
+        block.emitShl1();
+    }
+    block.emitUnfold();
+    for (int i = 0; i < 18; ++i) {
+        block.emitXor();
+        block.emitNot();
+    }
+    requireSameAsInterpreter<NativeBlock>(block, "JIT spill is broken.");
+}
+
+void test_jit_if0()
+{
+    Block elseBlock(0);
+    elseBlock.emitLoadConst(0x0f0f0f0f0f0f0f0fUL);
+    requireSameAsInterpreter<NativeBlock>(if0WithUnfoldBlock(elseBlock), "JIT if0 is broken.");
+}
+
+void test_jit_fold()
+{
+    Block block(0);
+    // Enough values below the fold to move its loop state into spill slots.
+    for (int i = 0; i < 8; ++i) {
+        block.emitLoadConst(i);
+    }
+    block.emitBlock(nestedFoldBlock());
+    for (int i = 0; i < 8; ++i) {
+        block.emitPlus();
+    }
+    requireSameAsInterpreter<NativeBlock>(block, "JIT fold is broken.");
+}
+
+} } // namespace internal::
+
+
+inline void test_jit()
+{
+    using namespace internal;
+    if (!NativeBlock::isSupported()) {
+        return;
+    }
+    try {
+        test_jit_ops();
+        test_jit_spill();
+        test_jit_if0();
+        test_jit_fold();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "block.h"
+#include "knownbits.h"
+#include "parser.h"
+#include "require.h"
+#include <exception>
+#include <iostream>
+#include <random>
+
+namespace internal {
+namespace {
+
+// Known bits of value with the bits in mask known.
+KnownBits partlyKnown(uint64_t value, uint64_t mask)
+{
+    return KnownBits{~value & mask, value & mask};
+}
+
+bool holdsFor(const KnownBits& bits, uint64_t value)
+{
+    return (value & bits.zeros) == 0 && (value & bits.ones) == bits.ones && (bits.zeros & bits.ones) == 0;
+}
+
+void test_known_bits_ops()
+{
+    std::mt19937_64 random(19);
+    for (int i = 0; i < 10000; ++i) {
+        const uint64_t x = random();
+        const uint64_t y = random() >> (random() % 64);
+        // Sparse and dense masks alike.
+        const uint64_t xMask = i % 3 == 0 ? random() & random() : random() | random();
+        const uint64_t yMask = i % 5 == 0 ? ~uint64_t(0) : random();
+        const KnownBits a = partlyKnown(x, xMask);
+        const KnownBits b = partlyKnown(y, yMask);
+        const int shift = 1 + random() % 63;
+
+        require (holdsFor(knownNot(a), ~x), "KNOWNBITS not is broken.");
+        require (holdsFor(knownShl(a, shift), x << shift), "KNOWNBITS shl is broken.");
+        require (holdsFor(knownShr(a, shift), x >> shift), "KNOWNBITS shr is broken.");
+        require (holdsFor(knownAnd(a, b), x & y), "KNOWNBITS and is broken.");
+        require (holdsFor(knownOr(a, b), x | y), "KNOWNBITS or is broken.");
+        require (holdsFor(knownXor(a, b), x ^ y), "KNOWNBITS xor is broken.");
+        require (holdsFor(knownPlus(a, b), x + y), "KNOWNBITS plus is broken.");
+        require (holdsFor(knownByte(a, shift / 8 * 8), 0xff & (x >> (shift / 8 * 8))), "KNOWNBITS byte is broken.");
+        require (holdsFor(knownJoin(a, b), x) && holdsFor(knownJoin(a, b), y), "KNOWNBITS join is broken.");
+    }
+
+    require (knownPlus(KnownBits::constant(0x0fffffffffffffffUL), KnownBits::constant(1)) ==
+             KnownBits::constant(0x1000000000000000UL), "KNOWNBITS plus of constants is broken.");
+    // Low bits known zero on both sides add without carries.
+    const KnownBits sum = knownPlus(KnownBits{0xff, 0}, KnownBits{0xff, 0});
+    require ((sum.zeros & 0xff) == 0xff, "KNOWNBITS plus loses known carries.");
+}
+
+void requireKnownResult(const char* program, bool constant, uint64_t value, const char* message)
+{
+    const Block block = parseLambda(program);
+    const KnownBits bits = knownResult(block, 1);
+    require (bits.isConstant() == constant && (!constant || bits.value() == value), message);
+    for (uint64_t i = 0; i < 64; ++i) {
+        const uint64_t input = i * 0x9e3779b97f4a7c15UL;
+        require (holdsFor(bits, block.execute({input})), message);
+    }
+}
+
+void test_known_result()
+{
+    requireKnownResult("(lambda (x) (shr16 (shr16 (shr16 (shr16 x)))))", true, 0,
+                       "KNOWNRESULT shifted out value is broken.");
+    requireKnownResult("(lambda (x) (and (shr16 (shr16 (shr16 x))) 65536))", true, 0,
+                       "KNOWNRESULT mask is broken.");
+    requireKnownResult("(lambda (x) (if0 (or x 1) x 5))", true, 5,
+                       "KNOWNRESULT nonzero condition is broken.");
+    requireKnownResult("(lambda (x) (if0 (and x 0) 1 x))", true, 1,
+                       "KNOWNRESULT zero condition is broken.");
+    requireKnownResult("(lambda (x) (if0 x (and (or x 1) 1) 1))", true, 1,
+                       "KNOWNRESULT join is broken.");
+    requireKnownResult("(lambda (x) (fold x 0 (lambda (y z) (shr16 (plus y z)))))", true, 0,
+                       "KNOWNRESULT fold is broken.");
+    requireKnownResult("(lambda (x) (fold x 0 (lambda (y z) (or y z))))", false, 0,
+                       "KNOWNRESULT fold is too optimistic.");
+    requireKnownResult("(lambda (x) (shr1 (fold x 0 (lambda (y z) (and y 1)))))", true, 0,
+                       "KNOWNRESULT fold byte is broken.");
+    requireKnownResult("(lambda (x) (plus x 1))", false, 0,
+                       "KNOWNRESULT is too optimistic.");
+}
+
+} } // namespace internal::
+
+
+inline void test_knownbits()
+{
+    using namespace internal;
+    try {
+        test_known_bits_ops();
+        test_known_result();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "block.h"
+#include "memo.h"
+#include "require.h"
+#include <exception>
+#include <iostream>
+
+namespace internal {
+namespace {
+
+std::vector<uint64_t> memoInputs()
+{
+    std::vector<uint64_t> result;
+    for (uint64_t i = 0; i < 40; ++i) {
+        result.push_back(i * 0x9e3779b97f4a7c15UL);
+    }
+    return result;
+}
+
+void requireMemoSameAsBatch(TermCache* const cache, const Block& block, const char* message)
+{
+    const std::vector<uint64_t> inputs = memoInputs();
+    std::vector<uint64_t> expected(inputs.size());
+    block.executeBatch(inputs.data(), inputs.size(), expected.data());
+    std::vector<uint64_t> outputs;
+    cache->evaluate(block, &outputs);
+    require (outputs == expected, message);
+}
+
+void test_memo_shared_subterms()
+{
+    TermCache cache(memoInputs(), 1 << 20, 1000);
+
+    // (shr16 (not x))
+    Block common(0);
+    common.emitLoadArg(0);
+    common.emitNot();
+    common.emitShr16();
+    requireMemoSameAsBatch(&cache, common, "MEMO is broken.");
+    require (cache.termCount() == 3, "MEMO term count is broken.");
+
+    // (plus (shr16 (not x)) 7) shares three terms with the above.
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitNot();
+    block.emitShr(16);
+    block.emitLoadConst(7);
+    block.emitPlus();
+    requireMemoSameAsBatch(&cache, block, "MEMO is broken.");
+    require (cache.termCount() == 5, "MEMO term count is broken.");
+
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(0);
+    elseBlock.emitShl1();
+
+    Block if0(0);
+    if0.emitLoadArg(0);
+    if0.emitLoadConst(1);
+    if0.emitAnd();
+    if0.emitIf0(block, elseBlock);
+    requireMemoSameAsBatch(&cache, if0, "MEMO if0 is broken.");
+}
+
+void test_memo_fold()
+{
+    // Fills up immediately: values are recomputed from the terms.
+    for (size_t maxValueBytes : { size_t(1) << 20, size_t(0) }) {
+        TermCache cache(memoInputs(), maxValueBytes, 1000);
+
+        Block body(0);
+        body.emitLoadArg(2);
+        body.emitShl(8);
+        body.emitLoadArg(1);
+        body.emitLoadArg(0);
+        body.emitXor();
+        body.emitOr();
+
+        Block block(0);
+        block.emitLoadArg(0);
+        block.emitNot();
+        block.emitLoadConst(3);
+        block.emitFold(1, body);
+        requireMemoSameAsBatch(&cache, block, "MEMO fold is broken.");
+
+        // Not a closed term: evaluated directly.
+        Block unfold(0);
+        unfold.emitLoadArg(0);
+        unfold.emitUnfold();
+        for (int i = 0; i < 7; ++i) {
+            unfold.emitPlus();
+        }
+        requireMemoSameAsBatch(&cache, unfold, "MEMO unfold is broken.");
+    }
+}
+
+void test_memo_max_terms()
+{
+    TermCache cache(memoInputs(), 1 << 20, 4);
+
+    // (plus (not x) 7) takes all four terms.
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitNot();
+    block.emitLoadConst(7);
+    block.emitPlus();
+    requireMemoSameAsBatch(&cache, block, "MEMO is broken.");
+    require (cache.termCount() == 4, "MEMO term count is broken.");
+
+    // New terms are turned down, inside and above the known ones.
+    for (uint64_t constant = 8; constant < 20; ++constant) {
+        Block other(0);
+        other.emitLoadArg(0);
+        other.emitNot();
+        other.emitLoadConst(constant);
+        other.emitXor();
+        other.emitBlock(block);
+        other.emitAnd();
+        requireMemoSameAsBatch(&cache, other, "MEMO past the term cap is broken.");
+    }
+    requireMemoSameAsBatch(&cache, block, "MEMO past the term cap is broken.");
+    require (cache.termCount() == 4, "MEMO makes terms past the cap.");
+}
+
+} } // namespace internal::
+
+
+inline void test_memo()
+{
+    using namespace internal;
+    try {
+        test_memo_shared_subterms();
+        test_memo_fold();
+        test_memo_max_terms();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "block.h"
+#include "optimizer.h"
+#include "require.h"
+#include <exception>
+#include <iostream>
+
+namespace internal {
+namespace {
+
+// Checks that optimize keeps the semantics and shrinks the code to at most
+// maxSize bytes.
+void requireOptimized(const Block& block, size_t maxSize, const char* message)
+{
+    const Block optimized = optimize(block);
+    require (optimized.code().size() <= maxSize, message);
+    for (uint64_t i = 0; i < 64; ++i) {
+        const uint64_t value = i * 0x9e3779b97f4a7c15UL;
+        require (optimized.execute({value, ~value}) == block.execute({value, ~value}), message);
+    }
+}
+
+void test_optimize_not_not()
+{
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitNot();
+    block.emitNot();
+    requireOptimized(block, 1, "OPTIMIZE not-not is broken.");
+}
+
+void test_optimize_shifts()
+{
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitShr4();
+    block.emitShr4();
+    block.emitShr1();
+    block.emitShl1();
+    block.emitShl1();
+    requireOptimized(block, 5, "OPTIMIZE shifts are broken.");
+
+    Block shiftedOut(0);
+    shiftedOut.emitLoadArg(0);
+    for (int i = 0; i < 4; ++i) {
+        shiftedOut.emitShr16();
+    }
+    requireOptimized(shiftedOut, 1, "OPTIMIZE shifted out value is broken.");
+}
+
+void test_optimize_constants()
+{
+    Block block(0);
+    block.emitLoadConst(0x1234);
+    block.emitNot();
+    block.emitLoadConst(5);
+    block.emitPlus();
+    block.emitLoadArg(0);
+    block.emitLoadConst(0);
+    block.emitAnd();
+    block.emitOr();
+    block.emitLoadArg(1);
+    block.emitLoadConst(~uint64_t(0));
+    block.emitXor();
+    block.emitXor();
+    requireOptimized(block, 12, "OPTIMIZE constants are broken.");
+}
+
+void test_optimize_if0()
+{
+    Block ifBlock(0);
+    ifBlock.emitLoadArg(0);
+    ifBlock.emitShr4();
+
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(1);
+
+    Block block(0);
+    block.emitLoadConst(0);
+    block.emitIf0(ifBlock, elseBlock);
+    requireOptimized(block, 2, "OPTIMIZE constant if0 is broken.");
+
+    Block live(0);
+    live.emitLoadArg(0);
+    live.emitLoadConst(1);
+    live.emitAnd();
+    live.emitIf0(ifBlock, elseBlock);
+    live.emitNot();
+    live.emitNot();
+    requireOptimized(live, live.code().size() - 2, "OPTIMIZE if0 is broken.");
+}
+
+void test_optimize_dead_stores()
+{
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitShr4();
+    block.emitStoreArg(1);
+    block.emitLoadArg(0);
+    block.emitNot();
+    block.emitStoreArg(1);
+    block.emitLoadArg(1);
+    block.emitLoadArg(0);
+    block.emitStoreArg(2);
+    requireOptimized(block, block.code().size() - 5, "OPTIMIZE dead stores are broken.");
+
+    // Shaped like an unrolled fold whose body ignores the byte.
+    Block fold(0);
+    fold.emitLoadArg(0);
+    fold.emitUnfold();
+    fold.emitLoadConst(0);
+    for (int i = 0; i < 8; ++i) {
+        fold.emitStoreArg(2);
+        fold.emitStoreArg(1);
+        fold.emitLoadArg(2);
+        fold.emitShl1();
+        fold.emitLoadArg(0);
+        fold.emitXor();
+    }
+    requireOptimized(fold, fold.code().size(), "OPTIMIZE dead stores in fold are broken.");
+}
+
+void test_optimize_known_bits()
+{
+    Block ifBlock(0);
+    ifBlock.emitLoadArg(0);
+    ifBlock.emitShr4();
+
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(1);
+
+    Block nonzero(0);
+    nonzero.emitLoadArg(0);
+    nonzero.emitLoadConst(1);
+    nonzero.emitOr();
+    nonzero.emitIf0(ifBlock, elseBlock);
+    requireOptimized(nonzero, 1, "OPTIMIZE if0 with a nonzero condition is broken.");
+
+    Block mask(0);
+    mask.emitLoadArg(0);
+    mask.emitShr16();
+    mask.emitShr16();
+    mask.emitLoadConst(0xffffffff);
+    mask.emitAnd();
+    requireOptimized(mask, 3, "OPTIMIZE redundant mask is broken.");
+
+    // The accumulator only ever holds bits of bytes.
+    Block body(0);
+    body.emitLoadArg(2);
+    body.emitLoadArg(1);
+    body.emitOr();
+
+    Block fold(0);
+    fold.emitLoadArg(0);
+    fold.emitLoadConst(0);
+    fold.emitFold(1, body);
+    const size_t foldSize = fold.code().size();
+    fold.emitLoadConst(0xff);
+    fold.emitAnd();
+    requireOptimized(fold, foldSize, "OPTIMIZE known bits of fold are broken.");
+}
+
+} } // namespace internal::
+
+
+inline void test_optimizer()
+{
+    using namespace internal;
+    try {
+        test_optimize_not_not();
+        test_optimize_shifts();
+        test_optimize_constants();
+        test_optimize_if0();
+        test_optimize_dead_stores();
+        test_optimize_known_bits();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
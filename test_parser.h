@@ -0,0 +1,280 @@
+#pragma once
+
+#include "parser.h"
+#include "require.h"
+#include <exception>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace internal {
+namespace {
+
+void test_read_not()
+{
+    const auto block = parseLambda("(lambda (x) (not x))");
+    require (block.execute({0x0000000000000000UL}) == 0xffffffffffffffffUL &&
+             block.execute({0xffffffffffffffffUL}) == 0x0000000000000000UL,
+             "READ_NOT is broken");
+}
+
+void test_read_shl1()
+{
+    const auto block = parseLambda("(lambda (x) (shl1 x))");
+    require (block.execute({0x0000000000000000UL}) == 0x0000000000000000UL &&
+             block.execute({0xffffffffffffffffUL}) == 0xfffffffffffffffeUL,
+             "READ_SHL1 is broken");
+}
+
+void test_read_shr1()
+{
+    const auto block = parseLambda("(lambda (x) (shr1 x))");
+    require (block.execute({0x0000000000000000UL}) == 0x0000000000000000UL &&
+             block.execute({0xffffffffffffffffUL}) == 0x7fffffffffffffffUL,
+             "READ_SHR1 is broken");
+}
+
+void test_read_shr4()
+{
+    const auto block = parseLambda("(lambda (x) (shr4 x))");
+    require (block.execute({0x0000000000000000UL}) == 0x0000000000000000UL &&
+             block.execute({0xffffffffffffffffUL}) == 0x0fffffffffffffffUL,
+             "READ_SHR4 is broken");
+}
+
+void test_read_shr16()
+{
+    const auto block = parseLambda("(lambda (x) (shr16 x))");
+    require (block.execute({0x0000000000000000UL}) == 0x0000000000000000UL &&
+             block.execute({0xffffffffffffffffUL}) == 0x0000ffffffffffffUL,
+             "READ_SHR16 is broken");
+}
+
+void test_read_and()
+{
+    const auto block = parseLambda("(lambda (x y) (and x y))");
+    require (block.execute({0x0000000000000000UL, 0x0000000000000000UL}) == 0x0000000000000000UL &&
+             block.execute({0x0000000000000000UL, 0xffffffffffffffffUL}) == 0x0000000000000000UL &&
+             block.execute({0xffffffffffffffffUL, 0x0000000000000000UL}) == 0x0000000000000000UL &&
+             block.execute({0xffffffffffffffffUL, 0xffffffffffffffffUL}) == 0xffffffffffffffffUL,
+             "READ_AND is broken");
+}
+
+void test_read_or()
+{
+    const auto block = parseLambda("(lambda (x y) (or x y))");
+    require (block.execute({0x0000000000000000UL, 0x0000000000000000UL}) == 0x0000000000000000UL &&
+             block.execute({0x0000000000000000UL, 0xffffffffffffffffUL}) == 0xffffffffffffffffUL &&
+             block.execute({0xffffffffffffffffUL, 0x0000000000000000UL}) == 0xffffffffffffffffUL &&
+             block.execute({0xffffffffffffffffUL, 0xffffffffffffffffUL}) == 0xffffffffffffffffUL,
+             "READ_OR is broken");
+}
+
+void test_read_xor()
+{
+    const auto block = parseLambda("(lambda (x y) (xor x y))");
+    require (block.execute({0x0000000000000000UL, 0x0000000000000000UL}) == 0x0000000000000000UL &&
+             block.execute({0x0000000000000000UL, 0xffffffffffffffffUL}) == 0xffffffffffffffffUL &&
+             block.execute({0xffffffffffffffffUL, 0x0000000000000000UL}) == 0xffffffffffffffffUL &&
+             block.execute({0xffffffffffffffffUL, 0xffffffffffffffffUL}) == 0x0000000000000000UL,
+             "READ_XOR is broken");
+}
+
+
+void test_read_plus()
+{
+    const auto block = parseLambda("(lambda (x y) (plus x y))");
+    require (block.execute({0x1111111111111111UL, 0x1111111111111111UL}) == 0x2222222222222222UL &&
+             block.execute({0x2222222222222222UL, 0x2222222222222222UL}) == 0x4444444444444444UL &&
+             block.execute({0x4444444444444444UL, 0x4444444444444444UL}) == 0x8888888888888888UL &&
+             block.execute({0x8888888888888888UL, 0x8888888888888888UL}) == 0x1111111111111110UL &&
+             block.execute({0xffffffffffffffffUL, 0x0000000000000001UL}) == 0x0000000000000000UL,
+             "READ_PLUS is broken");
+}
+
+void test_read_loadarg()
+{
+    const std::map<std::string, int> variables = {
+        {"(lambda (x y z) x)", 0},
+        {"(lambda (x y z) y)", 1},
+        {"(lambda (x y z) z)", 2},
+    };
+    for (const auto& var : variables) {
+        const auto block = parseLambda(var.first);
+        require (block.execute({0, 1, 2}) == static_cast<uint64_t>(var.second), "READ_ARG is broken");
+    }
+}
+
+void test_read_c()
+{
+    for (uint64_t i = 0; i < 10; ++i) {
+        std::ostringstream buf;
+        buf << "(lambda () " << i << ")";
+        const auto block = parseLambda(buf.str());
+        require (block.execute({}) == i, "READ_CONST is broken");
+    }
+}
+
+void test_read_if0()
+{
+    const auto block = parseLambda("(lambda (x) (and 0xffffffff87654321 (if0 x 0xf0f0f0f0f0f0f0f0 0x0f0f0f0f0f0f0f0f)))");
+    require (block.execute({0}) == 0xf0f0f0f080604020 &&
+             block.execute({1}) == 0x0f0f0f0f07050301,
+             "READ_IF0 is broken");
+}
+
+void test_read_fold()
+{
+    {
+        const auto block = parseLambda(
+                    "(lambda (x)"
+                    "  (fold x 0"
+                    "    (lambda (x y)"
+                    "      (or x"
+                    "        (shl1"
+                    "          (shl1"
+                    "            (shl1"
+                    "              (shl1 y)"
+                    "            )"
+                    "          )"
+                    "        )"
+                    "      )"
+                    "    )"
+                    "  )"
+                    ")");
+        require (block.execute({0x0706050403020100UL}) == 0x01234567, "READ_FOLD is broken");
+    }
+    {
+        const auto block = parseLambda(
+                    "(lambda (x)"
+                    "  (fold x 0"
+                    "    (lambda (x y)"
+                    "      (if0 x (plus 1 y) y)"
+                    "    )"
+                    "  )"
+                    ")");
+        require (block.execute({0x0101010101010101UL}) == 0, "READ_FOLD is broken");
+        require (block.execute({0x0100010001000100UL}) == 4, "READ_FOLD is broken");
+        require (block.execute({0x0100010001000100UL}) == 4, "READ_FOLD is broken");
+        require (block.execute({0x0000000000000000UL}) == 8, "READ_FOLD is broken");
+    }
+}
+
+void test_read_fold_shadowing()
+{
+    // The body's x is the fold byte, the outer y is unreachable.
+    const auto block = parseLambda("(lambda (y x) (fold x y (lambda (x y) (plus x y))))");
+    require (block.execute({100, 0x0101010101010101UL}) == 108, "READ_FOLD shadowing is broken");
+}
+
+void test_read_keywords()
+{
+    const char* const programs[] = {
+        "(lambda (lambda) lambda)",
+        "(lambda (x) (fold x))",
+        "(lambda (x) (nota x))",
+        "(lambda (x) (shr x))",
+        "(lambda (x) (shr2 x))",
+        "(lambda (x) (an x x))",
+        "(lambda (x) x) x",
+        "(lambda (x) (not x)",
+        "(lambda (x) (not x$))",
+        "(lambda (x) (if0 x x))",
+        "(lambda (x) (fold x 0 (lambda (y y) y)))",
+    };
+    for (const char* program : programs) {
+        bool failed = false;
+        try {
+            parseLambda(program);
+        } catch (const std::exception&) {
+            failed = true;
+        }
+        require (failed, "READ accepts an invalid program");
+    }
+
+    const auto block = parseLambda("(lambda (nota shr) (xor nota shr))");
+    require (block.execute({5, 3}) == 6, "READ identifiers are broken");
+}
+
+Fingerprint canonicalOf(const char* program)
+{
+    Fingerprint result;
+    parseLambda(program, &result);
+    return result;
+}
+
+void test_read_canonical()
+{
+    const char* const same[][2] = {
+        {"(lambda (x) (plus x 1))", "(lambda (x) (plus 1 x))"},
+        {"(lambda (x) (and (or x 1) (shl1 x)))", "(lambda (y) (and (shl1 y) (or 1 y)))"},
+        {"(lambda (x) (xor x (xor 1 (shr4 x))))", "(lambda (x) (xor (xor (shr4 x) x) 1))"},
+        {"(lambda (x) (plus (plus x x) (plus 1 x)))", "(lambda (x) (plus x (plus x (plus x 1))))"},
+        {"(lambda (x) (fold x 0 (lambda (y z) (or y z))))", "(lambda (x) (fold x 0 (lambda (z y) (or y z))))"},
+    };
+    for (const auto& pair : same) {
+        require (canonicalOf(pair[0]) == canonicalOf(pair[1]), "READ_CANONICAL misses equivalent programs");
+    }
+
+    const char* const different[][2] = {
+        {"(lambda (x) (shl1 x))", "(lambda (x) (shr1 x))"},
+        {"(lambda (x) (plus x x))", "(lambda (x) (plus x (plus x x)))"},
+        {"(lambda (x) (plus x (and x 1)))", "(lambda (x) (and x (plus x 1)))"},
+        {"(lambda (x) (and x (and x 1)))", "(lambda (x) (and x (or x 1)))"},
+        {"(lambda (x) (if0 x 1 2))", "(lambda (x) (if0 x 2 1))"},
+        {"(lambda (x) (fold x 0 (lambda (y z) y)))", "(lambda (x) (fold x 0 (lambda (y z) z)))"},
+        {"(lambda (x) (fold x 0 (lambda (y z) x)))", "(lambda (x) (fold 0 x (lambda (y z) x)))"},
+        {"(lambda (x) 0)", "(lambda (x) x)"},
+    };
+    for (const auto& pair : different) {
+        require (canonicalOf(pair[0]) != canonicalOf(pair[1]), "READ_CANONICAL merges different programs");
+    }
+}
+
+void test_to_integer()
+{
+    uint64_t value = 0;
+    require (toInteger("0", &value) && value == 0 &&
+             toInteger("42", &value) && value == 42 &&
+             toInteger("0x1F", &value) && value == 31 &&
+             toInteger("017", &value) && value == 15 &&
+             toInteger("-1", &value) && value == 0xffffffffffffffffUL &&
+             toInteger("18446744073709551615", &value) && value == 0xffffffffffffffffUL &&
+             toInteger("18446744073709551616", &value) && value == 0xffffffffffffffffUL,
+             "TO_INTEGER is broken");
+    require (!toInteger("", &value) && !toInteger("x", &value) && !toInteger("0x", &value) &&
+             !toInteger("08", &value) && !toInteger("12a", &value),
+             "TO_INTEGER accepts garbage");
+}
+
+} } // namespace internal::
+
+
+inline void test_parser()
+{
+    using namespace internal;
+    try {
+        test_read_not();
+        test_read_shl1();
+        test_read_shr1();
+        test_read_shr4();
+        test_read_shr16();
+        test_read_and();
+        test_read_or();
+        test_read_xor();
+        test_read_plus();
+        test_read_loadarg();
+        test_read_c();
+        test_read_if0();
+        test_read_fold();
+        test_read_fold_shadowing();
+        test_read_keywords();
+        test_read_canonical();
+        test_to_integer();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "pipeline.h"
+#include "queue.h"
+#include "require.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace internal {
+namespace {
+
+void test_bounded_queue()
+{
+    BoundedQueue<int> queue(4);
+    int value = 0;
+    require (!queue.tryPop(&value), "QUEUE pops from an empty queue");
+    for (int index = 0; index < 4; ++index) {
+        require (queue.tryPush(int(index)), "QUEUE rejects a push below capacity");
+    }
+    require (!queue.tryPush(4), "QUEUE pushes beyond capacity");
+    for (int index = 0; index < 4; ++index) {
+        require (queue.tryPop(&value) && value == index, "QUEUE is not FIFO");
+    }
+    require (!queue.tryPop(&value), "QUEUE pops from an empty queue");
+}
+
+void test_bounded_queue_threads()
+{
+    const int COUNT = 100000;
+    BoundedQueue<int> queue(64);
+    std::atomic<long> sum(0);
+    std::atomic<int> popped(0);
+
+    std::vector<std::thread> threads;
+    for (int producer = 0; producer < 2; ++producer) {
+        threads.emplace_back([&queue, producer]() {
+            for (int value = producer; value < COUNT; value += 2) {
+                while (!queue.tryPush(int(value))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (int consumer = 0; consumer < 2; ++consumer) {
+        threads.emplace_back([&queue, &sum, &popped]() {
+            int value;
+            while (popped.load() < COUNT) {
+                if (queue.tryPop(&value)) {
+                    sum += value;
+                    ++popped;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    require (sum == long(COUNT) * (COUNT - 1) / 2, "QUEUE loses or repeats values");
+}
+
+void test_event_count()
+{
+    EventCount pushed, popped;
+    BoundedQueue<int> queue(2, &pushed, &popped);
+    int value = 0;
+    require (pushed.wait([&queue]() { return queue.tryPush(1); }) == 0, "EVENTCOUNT sleeps on a true condition");
+
+    // A consumer that finds the queue empty sleeps until the push wakes it.
+    size_t sleeps = 0;
+    std::thread consumer([&queue, &pushed, &value, &sleeps]() {
+        require (queue.tryPop(&value) && value == 1, "EVENTCOUNT test queue is broken");
+        sleeps = pushed.wait([&queue, &value]() { return queue.tryPop(&value); });
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    require (queue.tryPush(2), "EVENTCOUNT test queue is broken");
+    consumer.join();
+    require (value == 2 && sleeps > 0, "EVENTCOUNT does not sleep or wake");
+
+    // notifyAll wakes every waiter for a condition outside the queue.
+    std::atomic<bool> done(false);
+    std::vector<std::thread> waiters;
+    for (int index = 0; index < 3; ++index) {
+        waiters.emplace_back([&popped, &done]() { popped.wait([&done]() { return done.load(); }); });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    done = true;
+    popped.notifyAll();
+    for (auto& waiter : waiters) {
+        waiter.join();
+    }
+}
+
+std::vector<std::string> sortedLines(const std::string& text)
+{
+    std::vector<std::string> result;
+    std::istringstream lines(text);
+    for (std::string line; std::getline(lines, line); ) {
+        result.push_back(line);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+void test_pipeline_run()
+{
+    std::string text;
+    std::vector<std::string> expected;
+    for (int index = 0; index < 5000; ++index) {
+        text += "  (lambda (x) " + std::to_string(index) + ")\n";
+        expected.push_back("(lambda (x) " + std::to_string(index) + ")!");
+    }
+    text += "(bad";
+    std::sort(expected.begin(), expected.end());
+
+    const Pipeline::ProcessorFactory factory = [&text]() -> Pipeline::Processor {
+        return [&text](StringRef program, uint64_t offset, std::string* output, std::string* errors) {
+            require (StringRef(text.data() + offset, program.size()) == program, "PIPELINE offset is broken");
+            std::string* const target = program == "(bad" ? errors : output;
+            target->append(program.data(), program.size());
+            target->append("!\n");
+        };
+    };
+
+    Pipeline pipeline(3, false);
+    {
+        std::istringstream input(text);
+        std::ostringstream output, errors;
+        pipeline.run(input, factory, output, errors);
+        require (sortedLines(output.str()) == expected && errors.str() == "(bad!\n",
+                 "PIPELINE on a stream is broken");
+    }
+    {
+        ChunkedInput input(text, 100);
+        std::ostringstream output, errors;
+        pipeline.run(&input, factory, output, errors);
+        require (sortedLines(output.str()) == expected && errors.str() == "(bad!\n",
+                 "PIPELINE on chunks is broken");
+    }
+}
+
+void test_pipeline_ordered()
+{
+    std::string text, expected;
+    for (int index = 0; index < 5000; ++index) {
+        const std::string program = "(lambda (x) " + std::to_string(index) + ")\n";
+        text += program;
+        expected += program;
+    }
+
+    // Later batches finish first unless held back.
+    const Pipeline::ProcessorFactory factory = []() -> Pipeline::Processor {
+        return [](StringRef program, uint64_t offset, std::string* output, std::string*) {
+            if (offset < 1000) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            output->append(program.data(), program.size());
+            output->push_back('\n');
+        };
+    };
+
+    Pipeline pipeline(3, false, true);
+    {
+        std::istringstream input(text);
+        std::ostringstream output, errors;
+        pipeline.run(input, factory, output, errors);
+        require (output.str() == expected, "PIPELINE on a stream is out of order");
+    }
+    {
+        ChunkedInput input(text, 100);
+        std::ostringstream output, errors;
+        pipeline.run(&input, factory, output, errors);
+        require (output.str() == expected, "PIPELINE on chunks is out of order");
+    }
+    {
+        const Pipeline::IndexProcessorFactory indexFactory = []() -> Pipeline::IndexProcessor {
+            return [](size_t index, std::string* output, std::string*) {
+                output->append("(lambda (x) " + std::to_string(index) + ")\n");
+            };
+        };
+        std::ostringstream output, errors;
+        pipeline.run(5000, indexFactory, output, errors);
+        require (output.str() == expected, "PIPELINE on items is out of order");
+    }
+}
+
+} } // namespace internal::
+
+
+inline void test_pipeline()
+{
+    using namespace internal;
+    try {
+        test_bounded_queue();
+        test_bounded_queue_threads();
+        test_event_count();
+        test_pipeline_run();
+        test_pipeline_ordered();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "refine.h"
+#include "require.h"
+#include <exception>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace internal {
+namespace {
+
+void test_refine_classes()
+{
+    const std::vector<uint64_t> inputs = {0, 1, 2, 3, 0x100, 0xff00, 0x8000000000000000, 0xffffffffffffffff, 5};
+    Refiner refiner(inputs, 2, 1);
+    refiner.add("(lambda (x) (plus x x))");
+    refiner.add("(lambda (x) (shl1 x))");
+    refiner.add("(lambda (y) (shl1 y))");
+    refiner.add("(lambda (x) 0)");
+    refiner.add("(lambda (x) (and x 0))");
+    refiner.add("(lambda (x) x)");
+    // Agrees with x on every input but the last.
+    refiner.add("(lambda (x) (if0 (xor x 5) 4 x))");
+
+    const auto classes = refiner.run();
+    require (classes.size() == 4 &&
+             classes[0].representative == "(lambda (x) 0)" && classes[0].size == 2 &&
+             classes[0].inputs == inputs.size() &&
+             classes[1].representative == "(lambda (x) x)" && classes[1].size == 1 &&
+             classes[1].inputs == inputs.size() &&
+             classes[2].representative == "(lambda (x) (shl1 x))" && classes[2].size == 3 &&
+             classes[2].inputs == inputs.size() &&
+             classes[3].representative == "(lambda (x) (if0 (xor x 5) 4 x))" && classes[3].size == 1,
+             "REFINE classes are broken");
+
+    bool threw = false;
+    try {
+        refiner.add("(lambda (x) (x");
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    require (threw && refiner.size() == 7, "REFINE accepts broken programs");
+}
+
+void test_refine_early()
+{
+    // Distinct constants are told apart by the first round.
+    const std::vector<uint64_t> inputs(100, 7);
+    Refiner refiner(inputs, 1, 1);
+    for (int index = 0; index < 10; ++index) {
+        refiner.add("(lambda (x) " + std::to_string(index) + ")");
+    }
+    const auto classes = refiner.run();
+    require (classes.size() == 10, "REFINE loses classes");
+    for (const auto& entry : classes) {
+        require (entry.size == 1 && entry.inputs == 1, "REFINE runs told apart programs on");
+    }
+}
+
+void test_refine_threads()
+{
+    std::vector<uint64_t> inputs;
+    for (uint64_t value = 0; value < 40; ++value) {
+        inputs.push_back(value * 0x0123456789abcdefUL);
+    }
+    const char* const shapes[] = {
+        "(lambda (x) (and x %))", "(lambda (x) (or (shr4 x) %))", "(lambda (x) (xor x %))",
+        "(lambda (x) (fold x % (lambda (y z) (plus y z))))", "(lambda (x) (if0 (and x %) 1 (shr16 x)))"
+    };
+    Refiner single(inputs, 3, 1);
+    Refiner parallel(inputs, 3, 4);
+    for (const char* shape : shapes) {
+        for (int constant = 0; constant < 300; ++constant) {
+            std::string program = shape;
+            program.replace(program.find('%'), 1, std::to_string(constant % 40));
+            single.add(program);
+            parallel.add(program);
+        }
+    }
+
+    // The same classes as grouping by all outputs at once.
+    std::map<std::vector<uint64_t>, size_t> expected;
+    for (const char* shape : shapes) {
+        for (int constant = 0; constant < 300; ++constant) {
+            std::string program = shape;
+            program.replace(program.find('%'), 1, std::to_string(constant % 40));
+            const Block block = parseLambda(program);
+            std::vector<uint64_t> outputs(inputs.size());
+            block.executeBatch(inputs.data(), inputs.size(), outputs.data());
+            ++expected[outputs];
+        }
+    }
+
+    const auto classes = single.run();
+    const auto parallelClasses = parallel.run();
+    require (classes.size() == expected.size() && parallelClasses.size() == classes.size(),
+             "REFINE with threads is broken");
+    size_t programs = 0;
+    for (size_t index = 0; index < classes.size(); ++index) {
+        require (classes[index].representative == parallelClasses[index].representative &&
+                 classes[index].size == parallelClasses[index].size &&
+                 classes[index].inputs == parallelClasses[index].inputs,
+                 "REFINE with threads is broken");
+        programs += classes[index].size;
+    }
+    require (programs == 1500, "REFINE loses programs");
+}
+
+} } // namespace internal::
+
+
+inline void test_refine()
+{
+    using namespace internal;
+    try {
+        test_refine_classes();
+        test_refine_early();
+        test_refine_threads();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "block.h"
+#include "require.h"
+#include "sliced.h"
+#include "test_backends.h"
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+namespace internal {
+namespace {
+
+// 200 inputs leave the last group of 64 lanes partly empty; small values
+// keep the planes narrow.
+void requireSlicedSameAsInterpreter(const Block& block, const char* message)
+{
+    std::vector<uint64_t> inputs;
+    for (uint64_t i = 0; i < 200; ++i) {
+        inputs.push_back(i < 100 ? i * 0x9e3779b97f4a7c15UL : i % 37);
+    }
+    std::vector<uint64_t> out(inputs.size());
+    executeSliced(block, inputs.data(), inputs.size(), out.data());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        require (out[i] == block.execute({inputs[i]}), message);
+    }
+}
+
+void test_transpose64()
+{
+    uint64_t rows[64];
+    for (uint64_t i = 0; i < 64; ++i) {
+        rows[i] = (i + 1) * 0x9e3779b97f4a7c15UL;
+    }
+    uint64_t transposed[64];
+    std::copy(rows, rows + 64, transposed);
+    transpose64(transposed);
+    for (size_t i = 0; i < 64; ++i) {
+        for (size_t j = 0; j < 64; ++j) {
+            require (((rows[i] >> j) & 1) == ((transposed[j] >> i) & 1), "SLICED transpose is broken.");
+        }
+    }
+}
+
+void test_sliced_ops()
+{
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitLoadArg(0);
+    block.emitShr16();
+    block.emitPlus();
+    block.emitLoadConst(0x00ff00ff00ff00ffUL);
+    block.emitXor();
+    block.emitShl1();
+    block.emitLoadArg(0);
+    block.emitShr4();
+    block.emitNot();
+    block.emitAnd();
+    block.emitShr1();
+    block.emitLoadConst(0x8000000000000001UL);
+    block.emitOr();
+    block.emitLoadArg(0);
+    block.emitNot();
+    block.emitPlus();
+    requireSlicedSameAsInterpreter(block, "SLICED ops are broken.");
+
+    // Carries out of narrow values widen them.
+    Block carry(0);
+    carry.emitLoadArg(0);
+    carry.emitLoadConst(0xff);
+    carry.emitAnd();
+    carry.emitLoadConst(1);
+    carry.emitPlus();
+    carry.emitShl(40);
+    carry.emitLoadArg(0);
+    carry.emitShr(60);
+    carry.emitPlus();
+    requireSlicedSameAsInterpreter(carry, "SLICED plus is broken.");
+}
+
+void test_sliced_if0()
+{
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(0);
+    elseBlock.emitNot();
+
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitBlock(if0WithUnfoldBlock(elseBlock));
+    block.emitXor();
+    requireSlicedSameAsInterpreter(block, "SLICED if0 is broken.");
+}
+
+void test_sliced_if0_deep_else()
+{
+    // (if0 x 1 (plus x (plus x 2))): lanes disagree, so the else branch runs
+    // on top of the result of the if branch and needs one slot more than any
+    // single path.
+    Block ifBlock(0);
+    ifBlock.emitLoadConst(1);
+
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(0);
+    elseBlock.emitLoadArg(0);
+    elseBlock.emitLoadConst(2);
+    elseBlock.emitPlus();
+    elseBlock.emitPlus();
+
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitIf0(ifBlock, elseBlock);
+    require (block.maxBranchStackSize() == 4 && block.maxStackSize() >= 3,
+             "SLICED if0 stack bound is broken.");
+    require (Block::maxBranchStackSize(block.code().data(), block.code().size(), 0) == 4,
+             "SLICED if0 stack bound of code is broken.");
+    // The else result lands on the if result only at the end of the branch.
+    Block shallow(0);
+    shallow.emitLoadArg(0);
+    shallow.emitIf0(ifBlock, ifBlock);
+    require (shallow.maxBranchStackSize() == 2 &&
+             Block::maxBranchStackSize(shallow.code().data(), shallow.code().size(), 0) == 2,
+             "SLICED shallow if0 stack bound is broken.");
+    requireSlicedSameAsInterpreter(block, "SLICED if0 with a deep else is broken.");
+
+    // The same code appended raw, as the corpus and the optimizer do.
+    Block copy(0);
+    copy.emitCode(block.code().data(), block.code().size());
+    require (copy.maxBranchStackSize() == 4, "SLICED if0 stack bound of emitCode is broken.");
+    requireSlicedSameAsInterpreter(copy, "SLICED if0 with a deep else is broken after emitCode.");
+
+    const uint64_t inputs[] = {0, 1, 0, 2};
+    uint64_t out[4];
+    executeSliced(block, inputs, 4, out);
+    require (out[0] == 1 && out[1] == 4 && out[2] == 1 && out[3] == 6, "SLICED if0 with a deep else is broken.");
+
+    // A corpus entry only promises the deepest single path; the sliced stack
+    // must not be sized from that.
+    const uint64_t* const column = inputs;
+    const BlockRef ref(block.code().data(), block.code().size(), 3);
+    std::fill(out, out + 4, 0);
+    executeSliced(ref, SlicedInputs(&column, 1, 4), out);
+    require (out[0] == 1 && out[1] == 4 && out[2] == 1 && out[3] == 6, "SLICED if0 on a BlockRef is broken.");
+}
+
+void test_sliced_fold()
+{
+    requireSlicedSameAsInterpreter(nestedFoldBlock(), "SLICED fold is broken.");
+}
+
+} } // namespace internal::
+
+
+inline void test_sliced()
+{
+    using namespace internal;
+    try {
+        test_transpose64();
+        test_sliced_ops();
+        test_sliced_if0();
+        test_sliced_if0_deep_else();
+        test_sliced_fold();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
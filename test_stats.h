@@ -0,0 +1,129 @@
+#pragma once
+
+#include "require.h"
+#include "stats.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace internal {
+namespace {
+
+void test_stats_disabled()
+{
+    addStat(StatsCounter::PROGRAMS);
+    recordTime(StatsTimer::EVAL, 100);
+    require (statValue(StatsCounter::PROGRAMS) == 0 && timerCount(StatsTimer::EVAL) == 0,
+             "STATS records while disabled");
+}
+
+void test_stats_percentiles()
+{
+    // A single sample lands in a bucket at most 25% wider than itself.
+    const uint64_t values[] = {0, 1, 3, 4, 5, 7, 8, 9, 100, 1000, 123456789, std::numeric_limits<uint64_t>::max()};
+    for (uint64_t value : values) {
+        resetStats();
+        recordTime(StatsTimer::PARSE, value);
+        const uint64_t bound = timerPercentile(StatsTimer::PARSE, 0.5);
+        require (bound >= value && bound - value <= value / 4, "STATS bucket bound is broken");
+    }
+
+    resetStats();
+    require (timerPercentile(StatsTimer::PARSE, 0.5) == 0, "STATS percentile without samples");
+    for (int index = 0; index < 98; ++index) {
+        recordTime(StatsTimer::PARSE, 100);
+    }
+    recordTime(StatsTimer::PARSE, 10000);
+    recordTime(StatsTimer::PARSE, 10000);
+    require (timerCount(StatsTimer::PARSE) == 100 && timerTotal(StatsTimer::PARSE) == 98 * 100 + 2 * 10000,
+             "STATS timer totals are broken");
+    require (timerPercentile(StatsTimer::PARSE, 0.5) < 125 &&
+             timerPercentile(StatsTimer::PARSE, 0.9) < 125 &&
+             timerPercentile(StatsTimer::PARSE, 0.99) >= 10000,
+             "STATS percentiles are broken");
+}
+
+void test_stats_threads()
+{
+    resetStats();
+    std::thread other([]() {
+        addStat(StatsCounter::PROGRAMS, 2);
+        countOpcode(Op::NOT);
+    });
+    other.join();
+    addStat(StatsCounter::PROGRAMS);
+    countOpcode(Op::NOT);
+    require (statValue(StatsCounter::PROGRAMS) == 3 && opcodeCount(Op::NOT) == 2,
+             "STATS does not sum over threads");
+
+    std::ostringstream json;
+    writeStatsJson(json);
+    require (json.str().find("\"programs\":3") != std::string::npos &&
+             json.str().find("\"opcodes\":{\"NOT\":2}") != std::string::npos,
+             "STATS JSON is broken");
+    require (json.str().compare(0, 13, "{\"threads\":2,") == 0, "STATS JSON miscounts threads");
+
+    // The exited thread is forgotten, and this one until it records again.
+    resetStats();
+    json.str("");
+    writeStatsJson(json);
+    require (json.str().compare(0, 13, "{\"threads\":0,") == 0, "STATS keeps exited threads");
+    addStat(StatsCounter::PROGRAMS);
+    json.str("");
+    writeStatsJson(json);
+    require (json.str().compare(0, 13, "{\"threads\":1,") == 0 && statValue(StatsCounter::PROGRAMS) == 1,
+             "STATS loses a thread after a reset");
+}
+
+void test_timed_lock()
+{
+    resetStats();
+    std::mutex mutex;
+    {
+        TimedLock<std::mutex> lock(mutex);
+    }
+    require (statValue(StatsCounter::LOCK_WAITS) == 0, "TIMEDLOCK counts an uncontended lock");
+
+    mutex.lock();
+    std::atomic<bool> started(false);
+    std::thread waiter([&mutex, &started]() {
+        started = true;
+        TimedLock<std::mutex> lock(mutex);
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    mutex.unlock();
+    waiter.join();
+    require (statValue(StatsCounter::LOCK_WAITS) == 1 && timerCount(StatsTimer::LOCK_WAIT) == 1,
+             "TIMEDLOCK does not count a wait");
+}
+
+} } // namespace internal::
+
+
+inline void test_stats()
+{
+    using namespace internal;
+    try {
+        test_stats_disabled();
+        enableStats();
+        test_stats_percentiles();
+        test_stats_threads();
+        test_timed_lock();
+        resetStats();
+        disableStats();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
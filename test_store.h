@@ -0,0 +1,181 @@
+#pragma once
+
+#include "parser.h"
+#include "require.h"
+#include "store.h"
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace internal {
+namespace {
+
+// A path for a store that is removed with the object.
+class TemporaryStorePath {
+public:
+    TemporaryStorePath()
+    {
+        char path[] = "/tmp/bv_store_XXXXXX";
+        const int fd = ::mkstemp(path);
+        require (fd >= 0, "TemporaryStorePath: Unable to create file.");
+        ::close(fd);
+        ::unlink(path);
+        path_ = path;
+    }
+
+    ~TemporaryStorePath() { ::unlink(path_.c_str()); }
+
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+};
+
+Fingerprint keyOf(const std::string& program)
+{
+    const Block block = parseLambda(program);
+    return programKey(block.code().data(), block.code().size());
+}
+
+void test_store_roundtrip()
+{
+    const std::vector<std::string> programs = {
+        "(lambda (x) (plus x 1))",
+        "(lambda (x) (not x))",
+        "(lambda (x) (not (not x)))",
+    };
+    require (keyOf(programs[1]) != keyOf(programs[2]), "STORE keys of different code collide");
+
+    const std::vector<uint64_t> inputs = {3, 5, 7};
+    const TemporaryStorePath path;
+    {
+        ResultStoreWriter writer(path.path(), inputs);
+        for (const auto& program : programs) {
+            const Block block = parseLambda(program);
+            std::vector<uint64_t> outputs;
+            for (uint64_t input : inputs) {
+                outputs.push_back(block.execute({input}));
+            }
+            writer.add(keyOf(program), outputs.data());
+        }
+        writer.commit();
+    }
+
+    const ResultStore store(path.path());
+    require (store.size() == programs.size() && store.inputCount() == inputs.size() &&
+             std::vector<uint64_t>(store.inputs(), store.inputs() + store.inputCount()) == inputs,
+             "STORE header is broken");
+    for (const auto& program : programs) {
+        const uint64_t* const row = store.find(keyOf(program));
+        require (row != nullptr, "STORE loses programs");
+        const Block block = parseLambda(program);
+        for (size_t column = 0; column < inputs.size(); ++column) {
+            require (row[column] == block.execute({inputs[column]}), "STORE outputs are broken");
+        }
+    }
+    require (store.find(keyOf("(lambda (x) x)")) == nullptr, "STORE finds unknown programs");
+
+    const std::vector<size_t> columns = store.columnsOf({7, 9, 3});
+    require (columns == std::vector<size_t>({2, ResultStore::MISSING, 0}), "STORE columns are broken");
+}
+
+void test_store_shards()
+{
+    const std::vector<uint64_t> inputs = {1, 2, 3};
+    const TemporaryStorePath path;
+    {
+        ResultStoreWriter writer(path.path(), inputs);
+        const uint64_t first[] = {1, 1, 1};
+        writer.add(keyOf("(lambda (x) 1)"), first);
+        std::vector<std::thread> threads;
+        for (uint64_t thread = 0; thread < 4; ++thread) {
+            threads.emplace_back([&writer, thread]() {
+                ResultStoreWriter::Shard* const shard = writer.shard();
+                for (uint64_t shift = 0; shift < 50; shift += 4) {
+                    const std::string program = "(lambda (x) (plus x " + std::to_string(shift + thread) + "))";
+                    const uint64_t outputs[] = {1 + shift + thread, 2 + shift + thread, 3 + shift + thread};
+                    shard->add(keyOf(program), outputs);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        // A shard without rows.
+        writer.shard();
+        writer.commit();
+    }
+    require (::access((path.path() + ".tmp.0").c_str(), F_OK) != 0, "STORE leaves a shard behind");
+
+    const ResultStore store(path.path());
+    require (store.size() == 53, "STORE loses shards");
+    require (store.find(keyOf("(lambda (x) 1)")) != nullptr && store.find(keyOf("(lambda (x) 1)"))[2] == 1,
+             "STORE loses rows of the writer");
+    for (uint64_t constant = 0; constant < 52; ++constant) {
+        const uint64_t* const row = store.find(keyOf("(lambda (x) (plus x " + std::to_string(constant) + "))"));
+        require (row != nullptr && row[0] == 1 + constant && row[1] == 2 + constant && row[2] == 3 + constant,
+                 "STORE shards are broken");
+    }
+}
+
+void test_store_invalid()
+{
+    const TemporaryStorePath path;
+    {
+        ResultStoreWriter writer(path.path(), {1, 2});
+        const uint64_t outputs[] = {3, 4};
+        writer.add(keyOf("(lambda (x) x)"), outputs);
+        writer.commit();
+    }
+    std::string contents;
+    {
+        std::ifstream file(path.path(), std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    const auto rejects = [&path](const std::string& contents) {
+        std::ofstream(path.path(), std::ios::binary | std::ios::trunc).write(contents.data(), contents.size());
+        try {
+            ResultStore store(path.path());
+        } catch (const std::exception&) {
+            return true;
+        }
+        return false;
+    };
+    require (rejects("BVCORPUS" + contents.substr(8)), "STORE accepts a foreign file");
+    require (rejects(contents.substr(0, contents.size() - 8)), "STORE accepts a truncated file");
+    // Point the only index entry past the rows.
+    std::string broken = contents;
+    broken[broken.size() - 8] = 1;
+    require (rejects(broken), "STORE accepts an invalid index");
+
+    // A writer that is not committed leaves nothing behind.
+    {
+        ResultStoreWriter writer(path.path() + "2", {1});
+    }
+    require (::access((path.path() + "2.tmp").c_str(), F_OK) != 0 && ::access((path.path() + "2").c_str(), F_OK) != 0,
+             "STORE leaves an uncommitted file");
+}
+
+} } // namespace internal::
+
+
+inline void test_store()
+{
+    using namespace internal;
+    try {
+        test_store_roundtrip();
+        test_store_shards();
+        test_store_invalid();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
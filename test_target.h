@@ -0,0 +1,67 @@
+#pragma once
+
+#include "parser.h"
+#include "require.h"
+#include "target.h"
+#include <exception>
+#include <iostream>
+#include <vector>
+
+namespace internal {
+namespace {
+
+void test_target_order()
+{
+    Target target({1, 2, 3, 4}, {0, 0, 0, 0});
+    std::vector<size_t> order;
+    target.order(&order);
+    require (order == std::vector<size_t>({0, 1, 2, 3}), "TARGET initial order is broken");
+
+    std::vector<uint64_t> counts = {0, 5, 0, 7};
+    target.addRejections(&counts);
+    require (counts == std::vector<uint64_t>(4, 0), "TARGET keeps added rejections");
+    target.order(&order);
+    require (order == std::vector<size_t>({3, 1, 0, 2}), "TARGET order is broken");
+}
+
+void test_target_matcher()
+{
+    // Outputs of (plus x 1), except on the last input.
+    const std::vector<uint64_t> inputs = {0, 1, 2, 3, 4, 5, 6, 7};
+    const std::vector<uint64_t> outputs = {1, 2, 3, 4, 5, 6, 7, 0};
+    Target target(inputs, outputs);
+    ExecutionContext context;
+    {
+        TargetMatcher matcher(&target);
+        const Block plus = parseLambda("(lambda (x) (plus x 1))");
+        const Block xor1 = parseLambda("(lambda (x) (xor x 1))");
+        const Block last = parseLambda("(lambda (x) (and (plus x 1) 7))");
+        for (size_t program = 0; program < 2 * TargetMatcher::REORDER_INTERVAL; ++program) {
+            require (!matcher.matches(plus, &context) && !matcher.matches(xor1, &context),
+                     "TARGET matches wrong programs");
+            require (matcher.matches(last, &context), "TARGET rejects the right program");
+        }
+    }
+
+    // plus fails on input 7 only, xor on inputs 1, 3, 5 and 7; once input 7
+    // is tried first, it rejects both.
+    std::vector<size_t> order;
+    target.order(&order);
+    require (order[0] == 7 && order[1] == 1, "TARGET does not move rejecting inputs first");
+}
+
+} } // namespace internal::
+
+
+inline void test_target()
+{
+    using namespace internal;
+    try {
+        test_target_order();
+        test_target_matcher();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
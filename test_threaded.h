@@ -0,0 +1,99 @@
+#pragma once
+
+#include "block.h"
+#include "require.h"
+#include "test_backends.h"
+#include "threaded.h"
+#include <exception>
+#include <iostream>
+
+namespace internal {
+namespace {
+
+void test_threaded_superinstructions()
+{
+    Block block(0);
+    block.emitLoadArg(0);
+    block.emitShr4();
+    block.emitShr4();
+    block.emitShr16();
+    block.emitLoadArg(1);
+    block.emitShl1();
+    block.emitShl1();
+    block.emitXor();
+    block.emitLoadArg(0);
+    block.emitNot();
+    block.emitLoadConst(0x00ff00ff00ff00ffUL);
+    block.emitAnd();
+    block.emitPlus();
+    block.emitLoadArg(1);
+    block.emitOr();
+    block.emitLoadConst(1);
+    block.emitLoadArg(0);
+    block.emitPlus();
+    block.emitLoadArg(0);
+    block.emitLoadArg(1);
+    block.emitXor();
+    block.emitXor();
+    block.emitPlus();
+    requireSameAsInterpreter<ThreadedBlock>(block, "THREADED superinstructions are broken.");
+
+    // 16 x SHR4 must not collapse into a single shift by 64.
+    Block shifts(0);
+    shifts.emitLoadArg(1);
+    for (int i = 0; i < 16; ++i) {
+        shifts.emitShr4();
+    }
+    requireSameAsInterpreter<ThreadedBlock>(shifts, "THREADED shift chain is broken.");
+}
+
+void test_threaded_jump_targets()
+{
+    // The join after if0 lands on AND, which must not be fused with the
+    // LOAD_ARG that ends the else branch.
+    Block ifBlock(0);
+    ifBlock.emitLoadArg(0);
+    ifBlock.emitUnfold();
+    for (int i = 0; i < 8; ++i) {
+        ifBlock.emitStoreArg(i);
+    }
+    ifBlock.emitLoadArg(2);
+
+    Block elseBlock(0);
+    elseBlock.emitLoadArg(1);
+
+    Block block(0);
+    block.emitLoadArg(1);
+    block.emitLoadArg(0);
+    block.emitLoadConst(1);
+    block.emitAnd();
+    block.emitIf0(ifBlock, elseBlock);
+    block.emitAnd();
+    block.emitLoadArg(0);
+    block.emitIf0(elseBlock, ifBlock);
+    block.emitShr1();
+    block.emitXor();
+    requireSameAsInterpreter<ThreadedBlock>(block, "THREADED jumps are broken.");
+}
+
+void test_threaded_fold()
+{
+    requireSameAsInterpreter<ThreadedBlock>(nestedFoldBlock(), "THREADED fold is broken.");
+}
+
+} } // namespace internal::
+
+
+inline void test_threaded()
+{
+    using namespace internal;
+    try {
+        test_threaded_superinstructions();
+        test_threaded_jump_targets();
+        test_threaded_fold();
+
+    } catch(const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        std::exit(-1);
+    }
+}
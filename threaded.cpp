@@ -0,0 +1,403 @@
+#include "threaded.h"
+#include "require.h"
+
+
+namespace {
+
+enum Handler {
+    H_NOT, H_SHL, H_SHR,
+    H_AND, H_OR, H_XOR, H_PLUS,
+    H_UNFOLD,
+    H_STORE_ARG, H_LOAD_ARG, H_LOAD_CONST,
+    H_DROP, H_JNZ, H_JMP, H_END,
+    H_FOLD_BEGIN, H_FOLD_NEXT,
+
+    H_LOAD_ARG_NOT, H_LOAD_ARG_SHL, H_LOAD_ARG_SHR,
+    H_AND_CONST, H_OR_CONST, H_XOR_CONST, H_PLUS_CONST,
+    H_AND_ARG, H_OR_ARG, H_XOR_ARG, H_PLUS_ARG,
+    H_LOAD_ARG_ARG, H_LOAD_CONST_ARG, H_JNZ_ARG,
+
+    HANDLER_COUNT
+};
+
+struct Decoded {
+    Handler handler;
+    uint64_t imm;
+    uint32_t arg;
+    size_t target;      // bytecode offset of the jump target
+    bool isTarget;      // some jump lands on this instruction
+};
+
+bool isUnary(Handler handler)
+{
+    return handler == H_NOT || handler == H_SHL || handler == H_SHR;
+}
+
+bool isBinary(Handler handler)
+{
+    return handler >= H_AND && handler <= H_PLUS;
+}
+
+// One Decoded per bytecode instruction, with runs of shifts in the same
+// direction merged. offsets[ip] is the index of the instruction at ip.
+std::vector<Decoded> decode(const std::vector<Op>& code, std::vector<size_t>* const offsets)
+{
+    std::vector<bool> targets(code.size() + 1, false);
+    for (size_t ip = 0; ip < code.size(); ip += opSize(code[ip])) {
+        if (code[ip] == Op::JNZ || code[ip] == Op::JMP) {
+            targets[ip + 3 + *(const uint16_t*)&code[ip + 1]] = true;
+        } else if (code[ip] == Op::FOLD_NEXT) {
+            targets[ip - *(const uint16_t*)&code[ip + 2]] = true;
+        }
+    }
+
+    std::vector<Decoded> result;
+    offsets->assign(code.size() + 1, 0);
+    for (size_t ip = 0; ip < code.size(); ip += opSize(code[ip])) {
+        const Op op = code[ip];
+        Decoded decoded = Decoded{H_END, 0, 0, 0, targets[ip]};
+        switch (op) {
+        case Op::NOT:    decoded.handler = H_NOT; break;
+        case Op::SHL1:   decoded.handler = H_SHL; decoded.imm = 1; break;
+        case Op::SHR1:   decoded.handler = H_SHR; decoded.imm = 1; break;
+        case Op::SHR4:   decoded.handler = H_SHR; decoded.imm = 4; break;
+        case Op::SHR16:  decoded.handler = H_SHR; decoded.imm = 16; break;
+        case Op::AND:    decoded.handler = H_AND; break;
+        case Op::OR:     decoded.handler = H_OR; break;
+        case Op::XOR:    decoded.handler = H_XOR; break;
+        case Op::PLUS:   decoded.handler = H_PLUS; break;
+        case Op::UNFOLD: decoded.handler = H_UNFOLD; break;
+        case Op::SHL_N:  decoded.handler = H_SHL; decoded.imm = static_cast<uint64_t>(code[ip + 1]); break;
+        case Op::SHR_N:  decoded.handler = H_SHR; decoded.imm = static_cast<uint64_t>(code[ip + 1]); break;
+        case Op::DROP:   decoded.handler = H_DROP; break;
+
+        case Op::STORE_ARG0:
+        case Op::STORE_ARG1:
+        case Op::STORE_ARG2:
+        case Op::STORE_ARG3:
+        case Op::STORE_ARG4:
+        case Op::STORE_ARG5:
+        case Op::STORE_ARG6:
+        case Op::STORE_ARG7:
+            decoded.handler = H_STORE_ARG;
+            decoded.arg = static_cast<int>(op) - static_cast<int>(Op::STORE_ARG0);
+            break;
+
+        case Op::LOAD_ARG0:
+        case Op::LOAD_ARG1:
+        case Op::LOAD_ARG2:
+        case Op::LOAD_ARG3:
+        case Op::LOAD_ARG4:
+        case Op::LOAD_ARG5:
+        case Op::LOAD_ARG6:
+        case Op::LOAD_ARG7:
+            decoded.handler = H_LOAD_ARG;
+            decoded.arg = static_cast<int>(op) - static_cast<int>(Op::LOAD_ARG0);
+            break;
+
+        case Op::LOAD_0:
+        case Op::LOAD_1:
+        case Op::LOAD_2:
+        case Op::LOAD_3:
+        case Op::LOAD_4:
+        case Op::LOAD_5:
+        case Op::LOAD_6:
+        case Op::LOAD_7:
+            decoded.handler = H_LOAD_CONST;
+            decoded.imm = static_cast<int>(op) - static_cast<int>(Op::LOAD_0);
+            break;
+
+        case Op::LOAD_CONST:
+            decoded.handler = H_LOAD_CONST;
+            decoded.imm = *(const uint64_t*)&code[ip + 1];
+            break;
+
+        case Op::JNZ:
+        case Op::JMP:
+            decoded.handler = op == Op::JNZ ? H_JNZ : H_JMP;
+            decoded.target = ip + 3 + *(const uint16_t*)&code[ip + 1];
+            break;
+
+        case Op::FOLD_BEGIN:
+        case Op::FOLD_NEXT:
+            decoded.handler = op == Op::FOLD_BEGIN ? H_FOLD_BEGIN : H_FOLD_NEXT;
+            decoded.arg = static_cast<uint32_t>(code[ip + 1]);
+            decoded.target = ip - *(const uint16_t*)&code[ip + 2];
+            break;
+        }
+
+        if (!result.empty() && !decoded.isTarget &&
+            (decoded.handler == H_SHL || decoded.handler == H_SHR) &&
+            result.back().handler == decoded.handler &&
+            result.back().imm + decoded.imm < 64)
+        {
+            result.back().imm += decoded.imm;
+        } else {
+            result.push_back(decoded);
+        }
+        (*offsets)[ip] = result.size() - 1;
+    }
+    (*offsets)[code.size()] = result.size();
+    result.push_back(Decoded{H_END, 0, 0, 0, targets[code.size()]});
+    return result;
+}
+
+} // namespace
+
+
+ThreadedBlock::ThreadedBlock(const Block& block)
+{
+    require (block.initalStackSize() == 0, "ThreadedBlock: Block is not runnable.");
+    require (block.stackSize() == 1, "ThreadedBlock: Block incomplete.");
+
+    const std::vector<Op>& code = block.code();
+    stackCapacity_ = block.maxStackSize();
+
+    std::vector<size_t> offsets;
+    const std::vector<Decoded> decoded = decode(code, &offsets);
+
+    const void* const* handlers = nullptr;
+    run(nullptr, nullptr, nullptr, &handlers);
+
+    // Greedy left-to-right fusion; a jump target may only start a superinstruction.
+    std::vector<size_t> positions(decoded.size(), 0);
+    std::vector<Decoded> fused;
+    const auto follows = [&decoded](size_t index) -> const Decoded* {
+        return index < decoded.size() && !decoded[index].isTarget ? &decoded[index] : nullptr;
+    };
+    for (size_t index = 0; index < decoded.size(); ) {
+        positions[index] = fused.size();
+        Decoded current = decoded[index];
+        const Decoded* const next = follows(index + 1);
+        const Decoded* const afterNext = next ? follows(index + 2) : nullptr;
+        const bool nextIsConsumed = afterNext &&
+            (isUnary(afterNext->handler) || isBinary(afterNext->handler) || afterNext->handler == H_JNZ);
+
+        size_t length = 1;
+        if (current.handler == H_LOAD_ARG && next && isUnary(next->handler)) {
+            current.handler =
+                next->handler == H_NOT ? H_LOAD_ARG_NOT :
+                next->handler == H_SHL ? H_LOAD_ARG_SHL : H_LOAD_ARG_SHR;
+            current.imm = next->imm;
+            length = 2;
+        } else if (current.handler == H_LOAD_ARG && next && isBinary(next->handler)) {
+            current.handler = static_cast<Handler>(H_AND_ARG + (next->handler - H_AND));
+            length = 2;
+        } else if (current.handler == H_LOAD_ARG && next && next->handler == H_JNZ) {
+            current.handler = H_JNZ_ARG;
+            current.target = next->target;
+            length = 2;
+        } else if (current.handler == H_LOAD_ARG && next && next->handler == H_LOAD_ARG && !nextIsConsumed) {
+            current.handler = H_LOAD_ARG_ARG;
+            current.imm = next->arg;
+            length = 2;
+        } else if (current.handler == H_LOAD_CONST && next && isBinary(next->handler)) {
+            current.handler = static_cast<Handler>(H_AND_CONST + (next->handler - H_AND));
+            length = 2;
+        } else if (current.handler == H_LOAD_CONST && next && next->handler == H_LOAD_ARG && !nextIsConsumed) {
+            current.handler = H_LOAD_CONST_ARG;
+            current.arg = next->arg;
+            length = 2;
+        }
+        fused.push_back(current);
+        index += length;
+    }
+
+    for (const auto& instruction : fused) {
+        uint32_t target = 0;
+        if (instruction.handler == H_JNZ || instruction.handler == H_JMP ||
+            instruction.handler == H_JNZ_ARG || instruction.handler == H_FOLD_NEXT)
+        {
+            target = positions[offsets[instruction.target]];
+        }
+        code_.push_back(Instruction{handlers[instruction.handler], instruction.imm, instruction.arg, target});
+    }
+}
+
+uint64_t ThreadedBlock::execute(std::vector<uint64_t> argv) const
+{
+    argv.resize(8);
+    std::vector<uint64_t> stack(stackCapacity_);
+    return execute(argv.data(), stack.data());
+}
+
+uint64_t ThreadedBlock::execute(uint64_t* const argv, uint64_t* const stack) const
+{
+    return run(code_.data(), argv, stack, nullptr);
+}
+
+// Computed goto is a GNU extension (gcc and clang); g++ names the warnings
+// -Wpedantic from 4.8 on.
+#pragma GCC diagnostic push
+#if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)
+#pragma GCC diagnostic ignored "-Wpedantic"
+#else
+#pragma GCC diagnostic ignored "-pedantic"
+#endif
+
+// With handlers != nullptr only reports the handler table, indexed by Handler.
+// sp points past the top of the stack.
+uint64_t ThreadedBlock::run(const Instruction* ip, uint64_t* const argv, uint64_t* sp,
+                            const void* const** const handlers)
+{
+    static const void* const HANDLERS[HANDLER_COUNT] = {
+        &&op_not, &&op_shl, &&op_shr,
+        &&op_and, &&op_or, &&op_xor, &&op_plus,
+        &&op_unfold,
+        &&op_store_arg, &&op_load_arg, &&op_load_const,
+        &&op_drop, &&op_jnz, &&op_jmp, &&op_end,
+        &&op_fold_begin, &&op_fold_next,
+
+        &&op_load_arg_not, &&op_load_arg_shl, &&op_load_arg_shr,
+        &&op_and_const, &&op_or_const, &&op_xor_const, &&op_plus_const,
+        &&op_and_arg, &&op_or_arg, &&op_xor_arg, &&op_plus_arg,
+        &&op_load_arg_arg, &&op_load_const_arg, &&op_jnz_arg
+    };
+    if (handlers) {
+        *handlers = HANDLERS;
+        return 0;
+    }
+
+    const Instruction* const code = ip;
+
+#define DISPATCH() goto *ip->handler
+#define NEXT() do { ++ip; DISPATCH(); } while (false)
+#define JUMP() do { ip = code + ip->target; DISPATCH(); } while (false)
+
+    DISPATCH();
+
+op_not:
+    sp[-1] = ~sp[-1];
+    NEXT();
+op_shl:
+    sp[-1] <<= ip->imm;
+    NEXT();
+op_shr:
+    sp[-1] >>= ip->imm;
+    NEXT();
+
+op_and:
+    sp[-2] &= sp[-1];
+    --sp;
+    NEXT();
+op_or:
+    sp[-2] |= sp[-1];
+    --sp;
+    NEXT();
+op_xor:
+    sp[-2] ^= sp[-1];
+    --sp;
+    NEXT();
+op_plus:
+    sp[-2] += sp[-1];
+    --sp;
+    NEXT();
+
+op_unfold: {
+    const uint64_t value = *--sp;
+    for (int offset = 56; offset >= 0; offset -= 8) {
+        *sp++ = 0xff & (value >> offset);
+    }
+    NEXT();
+}
+
+op_store_arg:
+    argv[ip->arg] = *--sp;
+    NEXT();
+op_load_arg:
+    *sp++ = argv[ip->arg];
+    NEXT();
+op_load_const:
+    *sp++ = ip->imm;
+    NEXT();
+
+op_drop:
+    --sp;
+    NEXT();
+op_jnz:
+    if (*--sp != 0) {
+        JUMP();
+    }
+    NEXT();
+op_jmp:
+    JUMP();
+op_end:
+    return sp[-1];
+
+op_fold_begin:
+    argv[ip->arg + 1] = sp[-1];
+    argv[ip->arg] = 0xff & sp[-2];
+    sp[-2] >>= 8;
+    sp[-1] = 7;
+    NEXT();
+op_fold_next:
+    if (sp[-2] != 0) {
+        argv[ip->arg + 1] = sp[-1];
+        argv[ip->arg] = 0xff & sp[-3];
+        sp[-3] >>= 8;
+        --sp[-2];
+        --sp;
+        JUMP();
+    }
+    sp[-3] = sp[-1];
+    sp -= 2;
+    NEXT();
+
+op_load_arg_not:
+    *sp++ = ~argv[ip->arg];
+    NEXT();
+op_load_arg_shl:
+    *sp++ = argv[ip->arg] << ip->imm;
+    NEXT();
+op_load_arg_shr:
+    *sp++ = argv[ip->arg] >> ip->imm;
+    NEXT();
+
+op_and_const:
+    sp[-1] &= ip->imm;
+    NEXT();
+op_or_const:
+    sp[-1] |= ip->imm;
+    NEXT();
+op_xor_const:
+    sp[-1] ^= ip->imm;
+    NEXT();
+op_plus_const:
+    sp[-1] += ip->imm;
+    NEXT();
+
+op_and_arg:
+    sp[-1] &= argv[ip->arg];
+    NEXT();
+op_or_arg:
+    sp[-1] |= argv[ip->arg];
+    NEXT();
+op_xor_arg:
+    sp[-1] ^= argv[ip->arg];
+    NEXT();
+op_plus_arg:
+    sp[-1] += argv[ip->arg];
+    NEXT();
+
+op_load_arg_arg:
+    sp[0] = argv[ip->arg];
+    sp[1] = argv[ip->imm];
+    sp += 2;
+    NEXT();
+op_load_const_arg:
+    sp[0] = ip->imm;
+    sp[1] = argv[ip->arg];
+    sp += 2;
+    NEXT();
+op_jnz_arg:
+    if (argv[ip->arg] != 0) {
+        JUMP();
+    }
+    NEXT();
+
+#undef JUMP
+#undef NEXT
+#undef DISPATCH
+}
+
+#pragma GCC diagnostic pop
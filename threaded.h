@@ -0,0 +1,44 @@
+#pragma once
+
+#include "block.h"
+
+// Pre-decoded, direct-threaded form of a Block.
+//
+// Every instruction carries the address of its handler, so dispatch is a
+// single indirect jump at the end of each handler (computed goto) instead of
+// a shared switch. Frequent opcode sequences are fused into superinstructions;
+// the set was picked from `main --opcode-stats < test.in`:
+//
+//   LOAD_ARG + NOT/SHL/SHR    push a transformed argument
+//   SHL1/SHR1/SHR4/SHR16 runs one shift by the summed amount
+//   LOAD_c + AND/OR/XOR/PLUS  binary op with an immediate
+//   LOAD_ARG + AND/OR/XOR/PLUS binary op with an argument
+//   LOAD_ARG + LOAD_ARG, LOAD_c + LOAD_ARG, LOAD_ARG + JNZ
+class ThreadedBlock {
+public:
+    explicit ThreadedBlock(const Block& block);
+
+    // Drop-in replacement for Block::execute.
+    uint64_t execute(std::vector<uint64_t> argv) const;
+
+    // argv holds 8 arguments (clobbered by STORE_ARG); stack must have room
+    // for stackCapacity() values.
+    uint64_t execute(uint64_t* argv, uint64_t* stack) const;
+
+    size_t stackCapacity() const { return stackCapacity_; }
+    size_t size() const { return code_.size(); }
+
+private:
+    struct Instruction {
+        const void* handler;
+        uint64_t imm;
+        uint32_t arg;
+        uint32_t target;
+    };
+
+    static uint64_t run(const Instruction* ip, uint64_t* argv, uint64_t* stack,
+                        const void* const** handlers);
+
+    std::vector<Instruction> code_;
+    size_t stackCapacity_;
+};